@@ -0,0 +1,218 @@
+#include "SyntheticDataset.hpp"
+
+#include "nuscenes2bag/BufferPool.hpp"
+#include "nuscenes2bag/LidarDirectoryConverter.hpp"
+#include "nuscenes2bag/LidarSweepAccumulator.hpp"
+#include "nuscenes2bag/McapWriter.hpp"
+#include "nuscenes2bag/MetaDataReader.hpp"
+#include "nuscenes2bag/NuScenes2Bag.hpp"
+#include "nuscenes2bag/SceneConverter.hpp"
+#include "nuscenes2bag/utils.hpp"
+
+#include <benchmark/benchmark.h>
+#include <rosbag/bag.h>
+
+#include <algorithm>
+#include <thread>
+
+using namespace nuscenes2bag;
+
+namespace {
+
+void
+removeAll(const fs::path& path)
+{
+#if CMAKE_CXX_STANDARD >= 17
+  std::error_code error;
+#else
+  boost::system::error_code error;
+#endif
+  fs::remove_all(path, error);
+}
+
+}
+
+static void
+BM_GetBoxes(benchmark::State& state)
+{
+  SyntheticDatasetOptions options;
+  options.samplesPerScene = 10;
+  options.annotationsPerSample = state.range(0);
+  options.writeSampleFiles = false;
+  SyntheticDataset dataset(options);
+
+  MetaDataReader reader;
+  reader.loadFromDirectory(dataset.getMetaDataPath());
+  const Token sceneToken = reader.getAllSceneTokens().front();
+  ConversionOptions conversionOptions;
+  SceneConverter sceneConverter(reader, conversionOptions, nullptr);
+  FileProgress fileProgress;
+  sceneConverter.submit(sceneToken, fileProgress);
+
+  // Sweeps between two samples, whose boxes are interpolated
+  std::vector<const SampleDataInfo*> sweeps;
+  for (const auto& sampleData : reader.getSceneSampleData(sceneToken)) {
+    const SampleInfo* sample = reader.findSampleInfo(sampleData.sampleToken);
+    if (!sampleData.isKeyFrame && (sample != nullptr) && !sample->prev.empty()) {
+      sweeps.push_back(&sampleData);
+    }
+  }
+
+  size_t sweepIndex = 0;
+  std::vector<Box> boxes;
+  for (auto _ : state) {
+    boxes.clear();
+    sceneConverter.getBoxes(*sweeps[sweepIndex], boxes);
+    benchmark::DoNotOptimize(boxes.data());
+    sweepIndex = (sweepIndex + 1) % sweeps.size();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_GetBoxes)->Arg(10)->Arg(50)->Arg(200);
+
+static void
+BM_AccumulateLidarSweeps(benchmark::State& state)
+{
+  const fs::path lidarPath =
+    makeTemporaryPath("nuscenes2bag_sample").string() + ".pcd.bin";
+  SyntheticDataset::writeLidarFile(lidarPath, 34688);
+  auto msg = readLidarFile(lidarPath);
+  removeAll(lidarPath);
+  if (!msg) {
+    state.SkipWithError("unable to read the lidar file");
+    return;
+  }
+
+  // The ego vehicle moves and turns a little between sweeps
+  const double rotation[4] = { 0.9999, 0.0, 0.0, 0.0141 };
+  const LidarSweep sweep = makeLidarSweep(*msg, 0, Pose3d::Identity());
+  LidarSweepAccumulator accumulator(static_cast<uint32_t>(state.range(0)));
+  Pose3d pose = Pose3d::Identity();
+  TimeStamp timeStamp = 0;
+  sensor_msgs::PointCloud2 cloud;
+  for (auto _ : state) {
+    const double translation[3] = { 0.5, 0.0, 0.0 };
+    pose = pose * makePose(translation, rotation);
+    timeStamp += 50000;
+    LidarSweep nextSweep = sweep;
+    nextSweep.timeStamp = timeStamp;
+    nextSweep.lidarToGlobal = pose;
+    accumulator.addSweep(std::move(nextSweep));
+    accumulator.accumulate(cloud);
+    benchmark::DoNotOptimize(cloud.data.data());
+    getMessageBufferPool().release(std::move(cloud.data));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0) * sweep.size());
+}
+// The devkit and most detectors use 10 sweeps
+BENCHMARK(BM_AccumulateLidarSweeps)->Arg(1)->Arg(10);
+
+static void
+BM_BagWrite(benchmark::State& state)
+{
+  const fs::path lidarPath =
+    makeTemporaryPath("nuscenes2bag_sample").string() + ".pcd.bin";
+  SyntheticDataset::writeLidarFile(lidarPath, 34688);
+  auto msg = readLidarFile(lidarPath);
+  removeAll(lidarPath);
+  if (!msg) {
+    state.SkipWithError("unable to read the lidar file");
+    return;
+  }
+  const sensor_msgs::PointCloud2& cloud = *msg;
+
+  const fs::path bagPath = makeTemporaryPath("nuscenes2bag_bench").string() + ".bag";
+  const rosbag::CompressionType compressions[] = {
+    rosbag::compression::Uncompressed,
+    rosbag::compression::LZ4,
+    rosbag::compression::BZ2
+  };
+  {
+    rosbag::Bag bag;
+    bag.open(bagPath.string(), rosbag::bagmode::Write);
+    bag.setCompression(compressions[state.range(0)]);
+    uint64_t timeStamp = 1532402927000000;
+    for (auto _ : state) {
+      bag.write("/lidar_top", stampUs2RosTime(timeStamp), cloud);
+      timeStamp += 50000;
+    }
+    bag.close();
+  }
+  removeAll(bagPath);
+  state.SetBytesProcessed(state.iterations() * cloud.data.size());
+}
+// Uncompressed, LZ4 and BZ2
+BENCHMARK(BM_BagWrite)->DenseRange(0, 2);
+
+static void
+BM_McapWrite(benchmark::State& state)
+{
+  const fs::path lidarPath =
+    makeTemporaryPath("nuscenes2bag_sample").string() + ".pcd.bin";
+  SyntheticDataset::writeLidarFile(lidarPath, 34688);
+  auto msg = readLidarFile(lidarPath);
+  removeAll(lidarPath);
+  if (!msg) {
+    state.SkipWithError("unable to read the lidar file");
+    return;
+  }
+  const sensor_msgs::PointCloud2& cloud = *msg;
+
+  const fs::path mcapPath = makeTemporaryPath("nuscenes2bag_bench").string() + ".mcap";
+  {
+    McapWriter mcap(mcapPath,
+                    (state.range(0) == 0) ? McapCompression::NONE : McapCompression::LZ4,
+                    768 * 1024);
+    uint64_t timeStamp = 1532402927000000;
+    for (auto _ : state) {
+      mcap.write("/lidar_top", stampUs2RosTime(timeStamp), cloud);
+      timeStamp += 50000;
+    }
+    mcap.close();
+  }
+  removeAll(mcapPath);
+  state.SetBytesProcessed(state.iterations() * cloud.data.size());
+}
+// Uncompressed and LZ4
+BENCHMARK(BM_McapWrite)->DenseRange(0, 1);
+
+static void
+BM_ConvertScenes(benchmark::State& state)
+{
+  SyntheticDatasetOptions options;
+  options.sceneNumber = 8;
+  options.samplesPerScene = 4;
+  options.sweepsPerSample = 1;
+  SyntheticDataset dataset(options);
+
+  ConversionOptions conversionOptions;
+  conversionOptions.useMetaDataCache = false;
+  const fs::path outputPath = dataset.getDataRoot() / "bags";
+
+  for (auto _ : state) {
+    NuScenes2Bag converter;
+#if CMAKE_CXX_STANDARD >= 17
+    const bool converted = converter.convertDirectory(
+      dataset.getDataRoot(), dataset.getVersion(), outputPath,
+      state.range(0), conversionOptions, std::nullopt);
+#else
+    const bool converted = converter.convertDirectory(
+      dataset.getDataRoot(), dataset.getVersion(), outputPath,
+      state.range(0), conversionOptions, 0);
+#endif
+    if (!converted) {
+      state.SkipWithError("conversion failed");
+      break;
+    }
+    state.PauseTiming();
+    removeAll(outputPath);
+    state.ResumeTiming();
+  }
+  state.counters["scenes_per_second"] = benchmark::Counter(
+    options.sceneNumber, benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_ConvertScenes)
+  ->RangeMultiplier(2)
+  ->Range(1, std::max(1u, std::thread::hardware_concurrency()))
+  ->UseRealTime()
+  ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,93 @@
+#include "SyntheticDataset.hpp"
+
+#include "nuscenes2bag/MetaDataReader.hpp"
+
+#include <benchmark/benchmark.h>
+
+using namespace nuscenes2bag;
+
+namespace {
+
+SyntheticDatasetOptions
+makeMetaDataOptions(uint32_t sceneNumber)
+{
+  SyntheticDatasetOptions options;
+  options.sceneNumber = sceneNumber;
+  options.samplesPerScene = 40;
+  options.writeSampleFiles = false;
+  return options;
+}
+
+uint64_t
+directorySize(const fs::path& directoryPath)
+{
+  uint64_t size = 0;
+  for (const auto& entry : fs::directory_iterator(directoryPath)) {
+    size += fs::file_size(entry.path());
+  }
+  return size;
+}
+
+}
+
+static void
+BM_LoadMetaDataFromDirectory(benchmark::State& state)
+{
+  SyntheticDataset dataset(makeMetaDataOptions(state.range(0)));
+  for (auto _ : state) {
+    MetaDataReader reader;
+    reader.loadFromDirectory(dataset.getMetaDataPath());
+    benchmark::DoNotOptimize(reader);
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          directorySize(dataset.getMetaDataPath()));
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_LoadMetaDataFromDirectory)
+  ->RangeMultiplier(4)
+  ->Range(1, 256)
+  ->Unit(benchmark::kMillisecond);
+
+static void
+BM_LoadMetaDataFromCache(benchmark::State& state)
+{
+  SyntheticDataset dataset(makeMetaDataOptions(state.range(0)));
+  const fs::path cachePath = dataset.getDataRoot() / "metadata.cache";
+  {
+    MetaDataReader reader;
+    reader.loadFromDirectory(dataset.getMetaDataPath());
+    reader.saveToCache(cachePath, dataset.getMetaDataPath());
+  }
+  for (auto _ : state) {
+    MetaDataReader reader;
+    if (!reader.loadFromCache(cachePath, dataset.getMetaDataPath())) {
+      state.SkipWithError("unable to load the metadata cache");
+      break;
+    }
+    benchmark::DoNotOptimize(reader);
+  }
+  state.SetBytesProcessed(state.iterations() * fs::file_size(cachePath));
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_LoadMetaDataFromCache)
+  ->RangeMultiplier(4)
+  ->Range(1, 256)
+  ->Unit(benchmark::kMillisecond);
+
+static void
+BM_LoadMiniMetaData(benchmark::State& state)
+{
+  const fs::path dataRoot = getMiniDataRoot();
+  if (dataRoot.empty()) {
+    state.SkipWithError("NUSCENES_MINI_DATAROOT is not set");
+    return;
+  }
+  const fs::path metaDataPath = dataRoot / "v1.0-mini";
+  for (auto _ : state) {
+    MetaDataReader reader;
+    reader.loadFromDirectory(metaDataPath);
+    benchmark::DoNotOptimize(reader);
+  }
+  state.SetBytesProcessed(state.iterations() * directorySize(metaDataPath));
+}
+BENCHMARK(BM_LoadMiniMetaData)->Unit(benchmark::kMillisecond);
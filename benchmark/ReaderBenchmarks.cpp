@@ -0,0 +1,139 @@
+#include "SyntheticDataset.hpp"
+
+#include "nuscenes2bag/BufferPool.hpp"
+#include "nuscenes2bag/ImageDirectoryConverter.hpp"
+#include "nuscenes2bag/LidarDirectoryConverter.hpp"
+#include "nuscenes2bag/RadarDirectoryConverter.hpp"
+
+#include <benchmark/benchmark.h>
+
+using namespace nuscenes2bag;
+
+namespace {
+
+// Sample file written once per benchmark run, removed at the end
+class SampleFile
+{
+public:
+  explicit SampleFile(const std::string& extension)
+    : filePath(makeTemporaryPath("nuscenes2bag_sample").string() + extension)
+  {}
+  ~SampleFile()
+  {
+#if CMAKE_CXX_STANDARD >= 17
+    std::error_code error;
+#else
+    boost::system::error_code error;
+#endif
+    fs::remove(filePath, error);
+  }
+
+  const fs::path filePath;
+};
+
+uint64_t
+fileSize(const fs::path& filePath)
+{
+  return static_cast<uint64_t>(fs::file_size(filePath));
+}
+
+}
+
+static void
+BM_ReadLidarFile(benchmark::State& state)
+{
+  SampleFile file(".pcd.bin");
+  SyntheticDataset::writeLidarFile(file.filePath, state.range(0));
+  for (auto _ : state) {
+    auto msg = readLidarFile(file.filePath);
+    if (!msg) {
+      state.SkipWithError("unable to read the lidar file");
+      break;
+    }
+    benchmark::DoNotOptimize(msg);
+    // Given back like the bag writer does, to measure the steady state
+    getMessageBufferPool().release(std::move(msg->data));
+  }
+  state.SetBytesProcessed(state.iterations() * fileSize(file.filePath));
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+// A nuScenes LIDAR_TOP sweep has about 34k points
+BENCHMARK(BM_ReadLidarFile)->Arg(1024)->Arg(34688)->Arg(131072);
+
+static void
+BM_ReadRadarFile(benchmark::State& state)
+{
+  SampleFile file(".pcd");
+  SyntheticDataset::writeRadarFile(file.filePath, state.range(0));
+  for (auto _ : state) {
+    auto msg = readRadarFile(file.filePath);
+    if (!msg) {
+      state.SkipWithError("unable to read the radar file");
+      break;
+    }
+    benchmark::DoNotOptimize(msg);
+  }
+  state.SetBytesProcessed(state.iterations() * fileSize(file.filePath));
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ReadRadarFile)->Arg(16)->Arg(64)->Arg(125);
+
+static void
+BM_ReadImageFile(benchmark::State& state)
+{
+  SampleFile file(".jpg");
+  SyntheticDataset::writeImageFile(
+    file.filePath, state.range(0), state.range(1));
+  for (auto _ : state) {
+    auto msg = readImageFile(file.filePath, nullptr, state.range(2));
+    if (!msg) {
+      state.SkipWithError("unable to read the image file");
+      break;
+    }
+    benchmark::DoNotOptimize(msg);
+    getMessageBufferPool().release(std::move(msg->data));
+  }
+  state.SetBytesProcessed(state.iterations() * fileSize(file.filePath));
+}
+// Full size, and decoded at half the size
+BENCHMARK(BM_ReadImageFile)
+  ->Args({ 800, 450, 1 })
+  ->Args({ 1600, 900, 1 })
+  ->Args({ 1600, 900, 2 });
+
+static void
+BM_ReadCompressedImageFile(benchmark::State& state)
+{
+  SampleFile file(".jpg");
+  SyntheticDataset::writeImageFile(
+    file.filePath, state.range(0), state.range(1));
+  for (auto _ : state) {
+    auto msg = readCompressedImageFile(file.filePath);
+    if (!msg) {
+      state.SkipWithError("unable to read the image file");
+      break;
+    }
+    benchmark::DoNotOptimize(msg);
+    getMessageBufferPool().release(std::move(msg->data));
+  }
+  state.SetBytesProcessed(state.iterations() * fileSize(file.filePath));
+}
+BENCHMARK(BM_ReadCompressedImageFile)->Args({ 1600, 900 });
+
+static void
+BM_ReadRadarFileAsPointCloud(benchmark::State& state)
+{
+  SampleFile file(".pcd");
+  SyntheticDataset::writeRadarFile(file.filePath, state.range(0));
+  for (auto _ : state) {
+    auto msg = readRadarFileAsPointCloud(file.filePath);
+    if (!msg) {
+      state.SkipWithError("unable to read the radar file");
+      break;
+    }
+    benchmark::DoNotOptimize(msg);
+  }
+  state.SetBytesProcessed(state.iterations() * fileSize(file.filePath));
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ReadRadarFileAsPointCloud)->Arg(16)->Arg(64)->Arg(125);
@@ -0,0 +1,382 @@
+#include "SyntheticDataset.hpp"
+
+#include "nuscenes2bag/DatasetTypes.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+extern "C" {
+#include <jpeglib.h>
+}
+
+namespace json = nlohmann;
+
+namespace nuscenes2bag {
+
+namespace {
+
+enum TokenKind : uint64_t
+{
+  SCENE_TOKEN = 1,
+  SAMPLE_TOKEN,
+  SAMPLE_DATA_TOKEN,
+  EGO_POSE_TOKEN,
+  CALIBRATED_SENSOR_TOKEN,
+  SENSOR_TOKEN,
+  CATEGORY_TOKEN,
+  INSTANCE_TOKEN,
+  SAMPLE_ANNOTATION_TOKEN
+};
+
+std::string
+makeToken(TokenKind kind, uint64_t index)
+{
+  Token token;
+  token.high = kind;
+  token.low = index + 1;
+  return token.str();
+}
+
+struct SyntheticSensor
+{
+  const char* channel;
+  const char* modality;
+  const char* extension;
+};
+
+const SyntheticSensor SENSORS[] = { { "CAM_FRONT", "camera", "jpg" },
+                                    { "CAM_BACK", "camera", "jpg" },
+                                    { "LIDAR_TOP", "lidar", "pcd.bin" },
+                                    { "RADAR_FRONT", "radar", "pcd" } };
+const size_t SENSOR_NUMBER = sizeof(SENSORS) / sizeof(SENSORS[0]);
+
+const char* const CATEGORIES[] = { "vehicle.car",
+                                   "human.pedestrian.adult",
+                                   "movable_object.trafficcone" };
+const size_t CATEGORY_NUMBER = sizeof(CATEGORIES) / sizeof(CATEGORIES[0]);
+
+// Samples are 0.5 s apart like the nuScenes key frames
+const uint64_t FIRST_TIMESTAMP = 1532402927000000;
+const uint64_t SAMPLE_PERIOD_US = 500000;
+const uint64_t SCENE_PERIOD_US = 100000000;
+
+void
+writeJsonFile(const fs::path& filePath, const json::json& table)
+{
+  std::ofstream file(filePath.string());
+  file << table.dump();
+  if (!file) {
+    throw std::runtime_error("unable to write " + filePath.string());
+  }
+}
+
+void
+writeBinaryFile(const fs::path& filePath, const std::vector<uint8_t>& bytes)
+{
+  fs::create_directories(filePath.parent_path());
+  std::ofstream file(filePath.string(), std::ios::binary);
+  file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+  if (!file) {
+    throw std::runtime_error("unable to write " + filePath.string());
+  }
+}
+
+template<typename T>
+void
+appendValue(std::vector<uint8_t>& bytes, T value)
+{
+  const size_t offset = bytes.size();
+  bytes.resize(offset + sizeof(T));
+  std::memcpy(bytes.data() + offset, &value, sizeof(T));
+}
+
+}
+
+SyntheticDataset::SyntheticDataset(const SyntheticDatasetOptions& options)
+  : options(options)
+  , dataRoot(makeTemporaryPath("nuscenes2bag_bench"))
+{
+  fs::create_directories(getMetaDataPath());
+  writeMetaData();
+}
+
+SyntheticDataset::~SyntheticDataset()
+{
+#if CMAKE_CXX_STANDARD >= 17
+  std::error_code error;
+#else
+  boost::system::error_code error;
+#endif
+  fs::remove_all(dataRoot, error);
+}
+
+void
+SyntheticDataset::writeMetaData()
+{
+  json::json sensors = json::json::array();
+  json::json calibratedSensors = json::json::array();
+  for (size_t i = 0; i < SENSOR_NUMBER; ++i) {
+    sensors.push_back({ { "token", makeToken(SENSOR_TOKEN, i) },
+                        { "channel", SENSORS[i].channel },
+                        { "modality", SENSORS[i].modality } });
+    calibratedSensors.push_back(
+      { { "token", makeToken(CALIBRATED_SENSOR_TOKEN, i) },
+        { "sensor_token", makeToken(SENSOR_TOKEN, i) },
+        { "translation", { 1.0 + i, 0.0, 1.5 } },
+        { "rotation", { 1.0, 0.0, 0.0, 0.0 } },
+        { "camera_intrinsic", json::json::array() } });
+  }
+
+  json::json categories = json::json::array();
+  for (size_t i = 0; i < CATEGORY_NUMBER; ++i) {
+    categories.push_back({ { "token", makeToken(CATEGORY_TOKEN, i) },
+                           { "name", CATEGORIES[i] },
+                           { "description", CATEGORIES[i] } });
+  }
+
+  // A single file per sensor is referenced by all its sample data
+  std::vector<std::string> sensorFileNames;
+  for (const auto& sensor : SENSORS) {
+    sensorFileNames.push_back(std::string("samples/") + sensor.channel +
+                              "/synthetic." + sensor.extension);
+  }
+
+  json::json scenes = json::json::array();
+  json::json samples = json::json::array();
+  json::json sampleDatas = json::json::array();
+  json::json egoPoses = json::json::array();
+  json::json instances = json::json::array();
+  json::json sampleAnnotations = json::json::array();
+
+  uint64_t sampleIndex = 0;
+  uint64_t sampleDataIndex = 0;
+  uint64_t annotationIndex = 0;
+  std::mt19937 random(42);
+  std::uniform_real_distribution<double> offset(-0.5, 0.5);
+
+  for (uint32_t scene = 0; scene < options.sceneNumber; ++scene) {
+    const uint64_t firstSampleIndex = sampleIndex;
+    const uint64_t sceneTimestamp = FIRST_TIMESTAMP + scene * SCENE_PERIOD_US;
+    const uint64_t firstInstanceIndex =
+      static_cast<uint64_t>(scene) * options.annotationsPerSample;
+
+    for (uint32_t i = 0; i < options.annotationsPerSample; ++i) {
+      instances.push_back(
+        { { "token", makeToken(INSTANCE_TOKEN, firstInstanceIndex + i) },
+          { "category_token", makeToken(CATEGORY_TOKEN, i % CATEGORY_NUMBER) },
+          { "nbr_annotations", options.samplesPerScene } });
+    }
+
+    for (uint32_t sample = 0; sample < options.samplesPerScene;
+         ++sample, ++sampleIndex) {
+      const uint64_t sampleTimestamp =
+        sceneTimestamp + sample * SAMPLE_PERIOD_US;
+      samples.push_back(
+        { { "token", makeToken(SAMPLE_TOKEN, sampleIndex) },
+          { "timestamp", sampleTimestamp },
+          { "prev",
+            (sample > 0) ? makeToken(SAMPLE_TOKEN, sampleIndex - 1) : "" },
+          { "next",
+            (sample + 1 < options.samplesPerScene)
+              ? makeToken(SAMPLE_TOKEN, sampleIndex + 1)
+              : "" },
+          { "scene_token", makeToken(SCENE_TOKEN, scene) } });
+
+      for (size_t sensor = 0; sensor < SENSOR_NUMBER; ++sensor) {
+        for (uint32_t sweep = 0; sweep <= options.sweepsPerSample;
+             ++sweep, ++sampleDataIndex) {
+          const uint64_t timestamp =
+            sampleTimestamp +
+            sweep * SAMPLE_PERIOD_US / (options.sweepsPerSample + 1) + sensor;
+          const std::string egoPoseToken =
+            makeToken(EGO_POSE_TOKEN, sampleDataIndex);
+          egoPoses.push_back(
+            { { "token", egoPoseToken },
+              { "timestamp", timestamp },
+              { "translation", { sample * 5.0 + sweep, 0.0, 0.0 } },
+              { "rotation", { 1.0, 0.0, 0.0, 0.0 } } });
+          sampleDatas.push_back(
+            { { "token", makeToken(SAMPLE_DATA_TOKEN, sampleDataIndex) },
+              { "sample_token", makeToken(SAMPLE_TOKEN, sampleIndex) },
+              { "ego_pose_token", egoPoseToken },
+              { "calibrated_sensor_token",
+                makeToken(CALIBRATED_SENSOR_TOKEN, sensor) },
+              { "timestamp", timestamp },
+              { "fileformat", SENSORS[sensor].extension },
+              { "is_key_frame", sweep == 0 },
+              { "filename", sensorFileNames[sensor] } });
+        }
+      }
+
+      for (uint32_t i = 0; i < options.annotationsPerSample;
+           ++i, ++annotationIndex) {
+        sampleAnnotations.push_back(
+          { { "token", makeToken(SAMPLE_ANNOTATION_TOKEN, annotationIndex) },
+            { "sample_token", makeToken(SAMPLE_TOKEN, sampleIndex) },
+            { "instance_token",
+              makeToken(INSTANCE_TOKEN, firstInstanceIndex + i) },
+            { "translation",
+              { i * 2.0 + offset(random), sample * 1.0 + offset(random), 0.5 } },
+            { "size", { 1.8, 4.5, 1.5 } },
+            { "rotation", { 0.7071, 0.0, 0.0, 0.7071 + 0.1 * offset(random) } } });
+      }
+    }
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "scene-%04u", scene + 1);
+    scenes.push_back(
+      { { "token", makeToken(SCENE_TOKEN, scene) },
+        { "nbr_samples", options.samplesPerScene },
+        { "name", name },
+        { "description", "synthetic scene" },
+        { "first_sample_token", makeToken(SAMPLE_TOKEN, firstSampleIndex) },
+        { "last_sample_token", makeToken(SAMPLE_TOKEN, sampleIndex - 1) } });
+  }
+
+  const fs::path metaDataPath = getMetaDataPath();
+  writeJsonFile(metaDataPath / "scene.json", scenes);
+  writeJsonFile(metaDataPath / "sample.json", samples);
+  writeJsonFile(metaDataPath / "sample_data.json", sampleDatas);
+  writeJsonFile(metaDataPath / "ego_pose.json", egoPoses);
+  writeJsonFile(metaDataPath / "calibrated_sensor.json", calibratedSensors);
+  writeJsonFile(metaDataPath / "sensor.json", sensors);
+  writeJsonFile(metaDataPath / "category.json", categories);
+  writeJsonFile(metaDataPath / "instance.json", instances);
+  writeJsonFile(metaDataPath / "sample_annotation.json", sampleAnnotations);
+
+  if (!options.writeSampleFiles) {
+    return;
+  }
+  for (size_t sensor = 0; sensor < SENSOR_NUMBER; ++sensor) {
+    const fs::path filePath = dataRoot / sensorFileNames[sensor];
+    const std::string modality = SENSORS[sensor].modality;
+    if (modality == "camera") {
+      writeImageFile(filePath, options.imageWidth, options.imageHeight);
+    } else if (modality == "lidar") {
+      writeLidarFile(filePath, options.lidarPoints);
+    } else {
+      writeRadarFile(filePath, options.radarPoints);
+    }
+  }
+}
+
+void
+SyntheticDataset::writeLidarFile(const fs::path& filePath, uint32_t pointNumber)
+{
+  // x, y, z, intensity, ring as float32
+  std::mt19937 random(pointNumber);
+  std::uniform_real_distribution<float> coordinate(-50.0f, 50.0f);
+  std::vector<uint8_t> bytes;
+  bytes.reserve(pointNumber * 5 * sizeof(float));
+  for (uint32_t i = 0; i < pointNumber; ++i) {
+    appendValue(bytes, coordinate(random));
+    appendValue(bytes, coordinate(random));
+    appendValue(bytes, coordinate(random) * 0.05f);
+    appendValue(bytes, static_cast<float>(i % 256));
+    appendValue(bytes, static_cast<float>(i % 32));
+  }
+  writeBinaryFile(filePath, bytes);
+}
+
+void
+SyntheticDataset::writeRadarFile(const fs::path& filePath, uint32_t pointNumber)
+{
+  const std::string header =
+    "# .PCD v0.7 - Point Cloud Data file format\n"
+    "VERSION 0.7\n"
+    "FIELDS x y z dyn_prop id rcs vx vy vx_comp vy_comp is_quality_valid "
+    "ambig_state x_rms y_rms invalid_state pdh0 vx_rms vy_rms\n"
+    "SIZE 4 4 4 1 2 4 4 4 4 4 1 1 1 1 1 1 1 1\n"
+    "TYPE F F F I I F F F F F I I I I I I I I\n"
+    "COUNT 1 1 1 1 1 1 1 1 1 1 1 1 1 1 1 1 1 1\n"
+    "WIDTH " + std::to_string(pointNumber) + "\n"
+    "HEIGHT 1\n"
+    "VIEWPOINT 0 0 0 1 0 0 0\n"
+    "POINTS " + std::to_string(pointNumber) + "\n"
+    "DATA binary\n";
+  std::vector<uint8_t> bytes(header.begin(), header.end());
+  for (uint32_t i = 0; i < pointNumber; ++i) {
+    appendValue(bytes, 10.0f + i);
+    appendValue(bytes, 0.5f * i);
+    appendValue(bytes, 0.0f);
+    appendValue(bytes, static_cast<int8_t>(i % 8));
+    appendValue(bytes, static_cast<int16_t>(i));
+    for (int value = 0; value < 5; ++value) {
+      appendValue(bytes, 0.25f * value);
+    }
+    for (int value = 0; value < 8; ++value) {
+      appendValue(bytes, static_cast<int8_t>(value));
+    }
+  }
+  writeBinaryFile(filePath, bytes);
+}
+
+void
+SyntheticDataset::writeImageFile(const fs::path& filePath,
+                                 uint32_t width,
+                                 uint32_t height)
+{
+  // Noise over a gradient, so that the JPEG size is closer to a real image
+  std::mt19937 random(width * height);
+  std::uniform_int_distribution<int> noise(0, 63);
+  std::vector<uint8_t> image(static_cast<size_t>(width) * height * 3);
+  for (uint32_t row = 0; row < height; ++row) {
+    const int gradient = row * 191 / height;
+    for (size_t i = 0; i < width * 3; ++i) {
+      image[row * width * 3 + i] = static_cast<uint8_t>(gradient + noise(random));
+    }
+  }
+
+  // Same quality as the OpenCV default
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr error;
+  cinfo.err = jpeg_std_error(&error);
+  jpeg_create_compress(&cinfo);
+  unsigned char* jpegBytes = nullptr;
+  unsigned long jpegSize = 0;
+  jpeg_mem_dest(&cinfo, &jpegBytes, &jpegSize);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, 95, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row = image.data() + cinfo.next_scanline * width * 3;
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+
+  const std::vector<uint8_t> bytes(jpegBytes, jpegBytes + jpegSize);
+  std::free(jpegBytes);
+  writeBinaryFile(filePath, bytes);
+}
+
+fs::path
+getMiniDataRoot()
+{
+  const char* dataRoot = std::getenv("NUSCENES_MINI_DATAROOT");
+  return (dataRoot != nullptr) ? fs::path(dataRoot) : fs::path();
+}
+
+fs::path
+makeTemporaryPath(const std::string& prefix)
+{
+  static std::atomic<uint32_t> counter(0);
+  return fs::temp_directory_path() /
+         (prefix + "_" + std::to_string(::getpid()) + "_" +
+          std::to_string(counter++));
+}
+
+}
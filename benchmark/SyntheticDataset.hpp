@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#if CMAKE_CXX_STANDARD >= 17
+#include <filesystem>
+namespace fs = std::filesystem;
+#else
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
+#endif
+
+namespace nuscenes2bag {
+
+// Shape of a generated dataset. The defaults are close to a nuScenes scene,
+// scaled down in duration.
+struct SyntheticDatasetOptions
+{
+  uint32_t sceneNumber = 1;
+  uint32_t samplesPerScene = 10;
+  // Non key frame sample data between two samples, for every sensor
+  uint32_t sweepsPerSample = 2;
+  uint32_t annotationsPerSample = 20;
+  uint32_t lidarPoints = 34688;
+  uint32_t radarPoints = 64;
+  uint32_t imageWidth = 1600;
+  uint32_t imageHeight = 900;
+  // Without sample files only the metadata benchmarks can use the dataset
+  bool writeSampleFiles = true;
+};
+
+// A nuScenes-like dataset (metadata tables and sample files) written to a
+// temporary directory, removed on destruction.
+class SyntheticDataset
+{
+public:
+  explicit SyntheticDataset(const SyntheticDatasetOptions& options);
+  ~SyntheticDataset();
+
+  SyntheticDataset(const SyntheticDataset&) = delete;
+  SyntheticDataset& operator=(const SyntheticDataset&) = delete;
+
+  const fs::path& getDataRoot() const { return dataRoot; }
+  static const char* getVersion() { return "v1.0-synthetic"; }
+  fs::path getMetaDataPath() const { return dataRoot / getVersion(); }
+
+  // Sample files in the nuScenes formats, also used standalone by the
+  // reader benchmarks
+  static void writeLidarFile(const fs::path& filePath, uint32_t pointNumber);
+  static void writeRadarFile(const fs::path& filePath, uint32_t pointNumber);
+  static void writeImageFile(const fs::path& filePath,
+                             uint32_t width,
+                             uint32_t height);
+
+private:
+  void writeMetaData();
+
+private:
+  const SyntheticDatasetOptions options;
+  fs::path dataRoot;
+};
+
+// Data root of the v1.0-mini dataset given in NUSCENES_MINI_DATAROOT, empty
+// if the variable is not set
+fs::path getMiniDataRoot();
+
+// Unique path in the temporary directory
+fs::path makeTemporaryPath(const std::string& prefix);
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace nuscenes2bag {
+
+// Byte buffers recycled from one message to the next, so that the payloads
+// of the images and point clouds (MBs each, which the allocator maps and
+// unmaps every time) are not allocated per sample. Buffers are taken by the
+// decoding threads and given back by the writing thread once the message is
+// written, so the pool is shared by all the threads.
+class BufferPool
+{
+public:
+  explicit BufferPool(uint64_t maxRetainedBytes);
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  // The smallest buffer with a capacity of at least minCapacity, or an empty
+  // one if there is none. Its size is 0.
+  std::vector<uint8_t> acquire(size_t minCapacity);
+
+  // Keeps the capacity of buffer for a later acquire, unless the pool
+  // already retains maxRetainedBytes
+  void release(std::vector<uint8_t>&& buffer);
+
+private:
+  const uint64_t maxRetainedBytes;
+
+  std::mutex mutex;
+  std::vector<std::vector<uint8_t>> buffers;
+  uint64_t retainedBytes = 0;
+};
+
+// Shared by the sample readers and the message writers
+BufferPool& getMessageBufferPool();
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "nuscenes2bag/ConversionOptions.hpp"
+#include "nuscenes2bag/DatasetTypes.hpp"
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#if CMAKE_CXX_STANDARD >= 17
+#include <filesystem>
+namespace fs = std::filesystem;
+#else
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
+#endif
+
+namespace nuscenes2bag {
+
+// Record of the scenes converted in an output directory, so that a rerun
+// only converts the scenes whose bag is missing, partial or out of date.
+// Stored as JSON next to the bags. With several shards converting to the
+// same directory, each one writes its own section in a file of its own.
+class ConversionManifest
+{
+public:
+  ConversionManifest(const fs::path& outputDirectoryPath,
+                     uint32_t shardIndex = 0,
+                     uint32_t shardCount = 1);
+
+  // Reads the manifest of the output directory. A missing or malformed
+  // manifest is read as an empty one. The sections of the other shards are
+  // read too, but never written.
+  void load();
+
+  // Written to a temporary file then renamed over the previous manifest.
+  // Throws std::runtime_error if the file can't be written.
+  void save() const;
+
+  // True if the bag of the scene was completed with this fingerprint and
+  // still has the size it had then, according to any section
+  bool isUpToDate(const Token& sceneToken,
+                  const std::string& fingerprint,
+                  const fs::path& bagPath) const;
+
+  void setSceneResult(const Token& sceneToken,
+                      const std::string& sceneName,
+                      const std::string& fingerprint,
+                      const fs::path& bagPath,
+                      bool complete);
+
+  const fs::path& getPath() const { return manifestPath; }
+
+private:
+  struct SceneEntry
+  {
+    std::string name;
+    std::string fingerprint;
+    std::string bagName;
+    uint64_t bagSize = 0;
+    bool complete = false;
+  };
+
+  static void readScenes(const fs::path& filePath,
+                         std::map<std::string, SceneEntry>& scenes);
+  static bool isEntryUpToDate(const SceneEntry& entry,
+                              const std::string& fingerprint,
+                              const fs::path& bagPath);
+
+  const fs::path manifestPath;
+  // Keyed by token string, so that the file is written in a stable order
+  std::map<std::string, SceneEntry> scenes;
+  // Read from the sections of the other shards
+  std::map<std::string, SceneEntry> otherScenes;
+};
+
+// Fingerprint of what the bags depend on besides the sample files, which
+// nuScenes never modifies: the metadata tables (size and modification time)
+// and the options changing the content of the bags
+std::string makeConversionFingerprint(const fs::path& metaDataPath,
+                                      const ConversionOptions& options);
+
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace nuscenes2bag {
+
+enum class ImageFormat
+{
+  // Decoded bgr8 sensor_msgs/Image on <camera>/raw
+  RAW,
+  // Original JPEG bytes as sensor_msgs/CompressedImage on <camera>/compressed
+  JPEG
+};
+
+enum class RadarFormat
+{
+  // nuscenes2bag/RadarObjects, one message field per radar field
+  OBJECTS,
+  // sensor_msgs/PointCloud2 with the PCD point layout
+  POINTCLOUD
+};
+
+enum class OutputFormat
+{
+  // ROS1 bag, <scene>.bag
+  BAG,
+  // MCAP with the ros1 profile, <scene>.mcap
+  MCAP
+};
+
+// Only NONE and LZ4 with OutputFormat::MCAP
+enum class BagCompression
+{
+  NONE,
+  LZ4,
+  BZ2
+};
+
+// Options controlling how a dataset and the samples of its scenes are
+// converted
+struct ConversionOptions
+{
+  // Reuse (and refresh) the binary metadata cache instead of parsing JSON
+  bool useMetaDataCache = true;
+  // Location of the metadata cache, empty means <dataroot>/<version>.cache
+  std::string metaDataCachePath;
+  // Number of threads decoding sample files, shared by all the scenes being
+  // converted. With 1, each scene decodes on its own conversion thread.
+  uint32_t decodeThreadNumber = 1;
+  // Maximum number of decoded samples waiting to be written to the bag
+  uint32_t maxSamplesInFlight = 8;
+  // Number of threads reading sample files ahead of decoding, shared by all
+  // the scenes being converted. With 0, the decoding threads read the files.
+  uint32_t readThreadNumber = 0;
+  // Maximum number of sample files read ahead per scene
+  uint32_t readAheadDepth = 32;
+  // Bytes of decoded messages waiting to be written, for all the scenes
+  // together, see MemoryBudget. 0 means no limit.
+  uint64_t maxMemoryBytes = 0;
+  // Publish the scenes on ROS topics, one after the other, instead of
+  // writing bags
+  bool publish = false;
+  // Publication speed relative to the recording, with publish
+  double publishSpeedFactor = 1.0;
+  OutputFormat outputFormat = OutputFormat::BAG;
+  ImageFormat imageFormat = ImageFormat::RAW;
+  // Raw images are decoded at 1/imageScaleDenominator of their size: 1, 2,
+  // 4 or 8
+  uint32_t imageScaleDenominator = 1;
+  RadarFormat radarFormat = RadarFormat::OBJECTS;
+  BagCompression bagCompression = BagCompression::NONE;
+  // Size in bytes after which a bag (or MCAP) chunk is closed (and
+  // compressed), the rosbag default is 768 KiB
+  uint32_t bagChunkThreshold = 768 * 1024;
+  // Sensor channels to convert (e.g. LIDAR_TOP, CAM_FRONT), empty means all
+  std::vector<std::string> channels;
+  // Sensor modalities to convert (camera, lidar, radar), empty means all
+  std::vector<std::string> modalities;
+  // Also write the last lidarSweepNumber sweeps of each lidar accumulated in
+  // the frame of the latest one, on <lidar>/sweeps. 0 disables it.
+  uint32_t lidarSweepNumber = 0;
+  // Only convert the key frame sample data and their annotations
+  bool keyFramesOnly = false;
+  // Converted time window, in microseconds since the first sample data of
+  // each scene: [timeRangeBegin, timeRangeEnd)
+  uint64_t timeRangeBegin = 0;
+  uint64_t timeRangeEnd = std::numeric_limits<uint64_t>::max();
+  // Only convert the scenes of shard shardIndex of shardCount, see
+  // selectShardScenes. Every node writes its own manifest file.
+  uint32_t shardIndex = 0;
+  uint32_t shardCount = 1;
+  // With several shards, only load the metadata of the scenes of the shard,
+  // and cache it in a file of its own
+  bool shardMetaDataOnly = false;
+  // Skip the scenes the output directory manifest records as converted from
+  // the same metadata and options
+  bool skipUpToDateScenes = true;
+  // Where to write the timing statistics of the run as JSON, empty means no
+  // statistics are collected
+  std::string statsJsonPath;
+};
+
+}
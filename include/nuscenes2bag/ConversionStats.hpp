@@ -0,0 +1,175 @@
+#pragma once
+
+#include "nuscenes2bag/DecodePipeline.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if CMAKE_CXX_STANDARD >= 17
+#include <filesystem>
+namespace fs = std::filesystem;
+#else
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
+#endif
+
+namespace nuscenes2bag {
+
+enum class ConversionStage : uint8_t
+{
+  // Reading and decoding a sample file
+  CAMERA_READ,
+  LIDAR_READ,
+  RADAR_READ,
+  // Sample files read ahead of decoding, only measured in memory
+  READ_AHEAD,
+  // Building the messages computed from the metadata
+  EGO_POSE,
+  BOXES,
+  // Accumulating the last lidar sweeps in the frame of the latest one
+  LIDAR_SWEEPS,
+  // Serializing and writing messages to the bag
+  BAG_WRITE,
+  STAGE_NUMBER
+};
+
+struct StageStats
+{
+  uint64_t count = 0;
+  uint64_t nanoseconds = 0;
+  uint64_t bytesIn = 0;
+  uint64_t bytesOut = 0;
+
+  void merge(const StageStats& other);
+};
+
+typedef std::array<StageStats, static_cast<size_t>(ConversionStage::STAGE_NUMBER)>
+  StageStatsTable;
+
+// Name of the stage in the reports, e.g. "camera_read"
+const char* getStageName(ConversionStage stage);
+
+// Peak bytes of the decoded messages waiting to be written, see MemoryBudget
+struct MemoryStats
+{
+  // 0 if there is no limit
+  uint64_t limitBytes = 0;
+  uint64_t peakBytes = 0;
+  std::array<uint64_t, static_cast<size_t>(ConversionStage::STAGE_NUMBER)>
+    stagePeakBytes{};
+};
+
+// Timings and byte counts of a conversion run, reported as JSON at the end.
+// Stages are recorded by any thread without locking: every thread owns a
+// shard, the shards are only merged by writeJson once the threads are done.
+class ConversionStats
+{
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  explicit ConversionStats(size_t sceneNumber);
+  ~ConversionStats();
+
+  ConversionStats(const ConversionStats&) = delete;
+  ConversionStats& operator=(const ConversionStats&) = delete;
+
+  // Called before the conversion threads start
+  void setMetaDataLoad(const std::string& source,
+                       double seconds,
+                       const std::vector<std::pair<std::string, double>>& tableSeconds);
+  void setScene(size_t sceneIndex, const std::string& token, const std::string& name);
+
+  void record(size_t sceneIndex,
+              ConversionStage stage,
+              Clock::time_point start,
+              uint64_t bytesIn,
+              uint64_t bytesOut);
+
+  // Called by the thread converting the scene
+  void setSceneResult(size_t sceneIndex,
+                      double seconds,
+                      const DecodePipeline::QueueStats& queueStats);
+
+  // Called once the scenes are converted
+  void setMemoryStats(const MemoryStats& stats);
+
+  // Throws std::runtime_error if the file can't be written
+  void writeJson(const fs::path& filePath, double totalSeconds) const;
+
+private:
+  struct ThreadShard
+  {
+    std::vector<StageStatsTable> scenes;
+  };
+
+  struct SceneEntry
+  {
+    std::string token;
+    std::string name;
+    double seconds = 0;
+    DecodePipeline::QueueStats queueStats;
+  };
+
+  ThreadShard& threadShard();
+
+private:
+  const uint64_t instanceId;
+  std::vector<SceneEntry> scenes;
+
+  std::string metaDataSource;
+  double metaDataSeconds = 0;
+  std::vector<std::pair<std::string, double>> metaDataTableSeconds;
+  MemoryStats memoryStats;
+
+  mutable std::mutex shardsMutex;
+  std::vector<std::unique_ptr<ThreadShard>> shards;
+};
+
+// What a scene converter uses to record its stages, does nothing (and reads
+// no clock) when no statistics are collected
+class SceneStatsRecorder
+{
+public:
+  SceneStatsRecorder() = default;
+  SceneStatsRecorder(ConversionStats* stats, size_t sceneIndex)
+    : stats(stats)
+    , sceneIndex(sceneIndex)
+  {}
+
+  bool enabled() const { return stats != nullptr; }
+
+  ConversionStats::Clock::time_point start() const
+  {
+    return enabled() ? ConversionStats::Clock::now()
+                     : ConversionStats::Clock::time_point();
+  }
+
+  void record(ConversionStage stage,
+              ConversionStats::Clock::time_point start,
+              uint64_t bytesIn,
+              uint64_t bytesOut) const
+  {
+    if (enabled()) {
+      stats->record(sceneIndex, stage, start, bytesIn, bytesOut);
+    }
+  }
+
+  void setSceneResult(double seconds,
+                      const DecodePipeline::QueueStats& queueStats) const
+  {
+    if (enabled()) {
+      stats->setSceneResult(sceneIndex, seconds, queueStats);
+    }
+  }
+
+private:
+  ConversionStats* stats = nullptr;
+  size_t sceneIndex = 0;
+};
+
+}
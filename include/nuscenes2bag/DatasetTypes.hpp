@@ -1,8 +1,11 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 
 #include "nuscenes2bag/ToDebugString.hpp"
@@ -17,9 +20,91 @@ enum class SampleType
   LIDAR
 };
 
-typedef std::string Token;
+// nuScenes tokens are 32 hexadecimal characters, they are stored as the
+// 128-bit number they encode. The empty string (e.g. the "prev" of the first
+// sample) maps to the zero token.
+struct Token
+{
+  uint64_t high = 0;
+  uint64_t low = 0;
+
+  // Throws std::invalid_argument if str is neither empty nor a 32 digit
+  // hexadecimal number
+  static Token fromString(const std::string& str)
+  {
+    Token token;
+    if (str.empty()) {
+      return token;
+    }
+    if (str.size() != 32) {
+      throw std::invalid_argument("invalid token [" + str + "]");
+    }
+    for (size_t i = 0; i < 32; ++i) {
+      const char c = str[i];
+      uint64_t digit;
+      if ((c >= '0') && (c <= '9')) {
+        digit = c - '0';
+      } else if ((c >= 'a') && (c <= 'f')) {
+        digit = c - 'a' + 10;
+      } else if ((c >= 'A') && (c <= 'F')) {
+        digit = c - 'A' + 10;
+      } else {
+        throw std::invalid_argument("invalid token [" + str + "]");
+      }
+      uint64_t& half = (i < 16) ? token.high : token.low;
+      half = (half << 4) | digit;
+    }
+    return token;
+  }
+
+  std::string str() const
+  {
+    if (empty()) {
+      return std::string();
+    }
+    static const char digits[] = "0123456789abcdef";
+    std::string str(32, '0');
+    for (size_t i = 0; i < 16; ++i) {
+      str[15 - i] = digits[(high >> (4 * i)) & 0xf];
+      str[31 - i] = digits[(low >> (4 * i)) & 0xf];
+    }
+    return str;
+  }
+
+  bool empty() const { return (high == 0) && (low == 0); }
+
+  friend bool operator==(const Token& l, const Token& r)
+  {
+    return (l.high == r.high) && (l.low == r.low);
+  }
+  friend bool operator!=(const Token& l, const Token& r) { return !(l == r); }
+  // Same order as the hexadecimal strings
+  friend bool operator<(const Token& l, const Token& r)
+  {
+    return (l.high < r.high) || ((l.high == r.high) && (l.low < r.low));
+  }
+  friend std::ostream& operator<<(std::ostream& os, const Token& token)
+  {
+    return os << token.str();
+  }
+};
+
 typedef uint64_t TimeStamp;
 typedef uint32_t SceneId;
 typedef std::array<std::array<double, 3>, 3> IntrinsicsMatrix;
 
 }
+
+namespace std {
+
+template<>
+struct hash<nuscenes2bag::Token>
+{
+  // Tokens are random, mixing both halves is enough
+  size_t operator()(const nuscenes2bag::Token& token) const
+  {
+    return static_cast<size_t>(token.high ^ (token.low * 0x9e3779b97f4a7c15ULL));
+  }
+};
+
+}
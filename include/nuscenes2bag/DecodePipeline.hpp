@@ -0,0 +1,126 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nuscenes2bag {
+
+class DecodeWorkerPool;
+class MemoryBudget;
+
+// Decodes samples on the threads of a DecodeWorkerPool while a single writer
+// (the thread calling run()) consumes the results in submission order.
+// At most maxInFlight samples are decoded but not yet written, which keeps
+// memory usage bounded independently of the scene length.
+class DecodePipeline
+{
+public:
+  // Produced by a decode task, executed on the writer thread.
+  // An empty WriteTask means there is nothing to write.
+  typedef std::function<void()> WriteTask;
+  typedef std::function<WriteTask(size_t)> DecodeTask;
+
+  // Occupancy seen by the writer before each write: samples claimed by the
+  // workers but not written yet, and the time spent waiting for a decode
+  struct QueueStats
+  {
+    uint64_t samples = 0;
+    uint64_t depthSum = 0;
+    uint64_t maxDepth = 0;
+    uint64_t writerWaitNanoseconds = 0;
+  };
+
+  // Without a worker pool, the tasks are decoded on the calling thread.
+  // With a memory budget, no new task is claimed while it is exhausted,
+  // unless none is in flight. The write tasks release their bytes when
+  // destroyed.
+  DecodePipeline(DecodeWorkerPool* workerPool,
+                 uint32_t maxInFlight,
+                 MemoryBudget* memoryBudget = nullptr);
+
+  // Calls decode(0..taskNumber-1) on the pool workers and runs the returned
+  // write tasks in index order on the calling thread. Exceptions thrown by
+  // decode or write tasks are rethrown once no worker uses this pipeline.
+  void run(size_t taskNumber, const DecodeTask& decode);
+
+  // Of the last run(), empty when decoding on the calling thread
+  const QueueStats& getQueueStats() const { return queueStats; }
+
+private:
+  friend class DecodeWorkerPool;
+
+  struct Slot
+  {
+    bool ready = false;
+    WriteTask writeTask;
+    std::exception_ptr error;
+  };
+
+  void runSequential(size_t taskNumber, const DecodeTask& decode);
+  // Called by the pool workers
+  bool tryClaim(size_t& taskIndex);
+  void decodeClaimed(size_t taskIndex);
+
+private:
+  DecodeWorkerPool* const workerPool;
+  const uint32_t maxInFlight;
+  MemoryBudget* const memoryBudget;
+
+  std::mutex mutex;
+  std::condition_variable slotReady;
+  std::vector<Slot> slots;
+  const DecodeTask* decode = nullptr;
+  size_t taskNumber = 0;
+  size_t nextToDecode = 0;
+  size_t nextToWrite = 0;
+  size_t activeDecodes = 0;
+  bool aborted = false;
+  QueueStats queueStats;
+};
+
+// Decode threads shared by all the pipelines running at the same time.
+// Workers take the next task of the attached pipelines in turn, so threads
+// left idle by a finished scene help decoding the scenes still in progress.
+class DecodeWorkerPool
+{
+public:
+  typedef std::function<void()> Job;
+
+  explicit DecodeWorkerPool(uint32_t workerNumber);
+  // Runs the posted jobs left before stopping the workers
+  ~DecodeWorkerPool();
+
+  DecodeWorkerPool(const DecodeWorkerPool&) = delete;
+  DecodeWorkerPool& operator=(const DecodeWorkerPool&) = delete;
+
+  // Runs job on a worker, before the next decode task. Used by the writers
+  // to move work off their thread, job must not throw.
+  void post(Job job);
+
+private:
+  friend class DecodePipeline;
+
+  void attach(DecodePipeline* pipeline);
+  void detach(DecodePipeline* pipeline);
+  // Wakes the workers after a pipeline freed a slot
+  void notifyWork();
+  bool claimTask(DecodePipeline*& pipeline, size_t& taskIndex);
+  void workerLoop();
+
+private:
+  std::mutex mutex;
+  std::condition_variable workAvailable;
+  std::vector<DecodePipeline*> pipelines;
+  size_t nextPipeline = 0;
+  std::deque<Job> jobs;
+  bool stopping = false;
+  std::vector<std::thread> workers;
+};
+
+}
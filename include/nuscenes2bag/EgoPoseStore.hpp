@@ -0,0 +1,44 @@
+#pragma once
+
+#include "nuscenes2bag/MetaDataTypes.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace nuscenes2bag {
+
+// The ego poses of a scene sorted by timestamp, in structure of arrays
+// layout, so that the pose at any time is found by binary search over the
+// timestamps alone
+class EgoPoseStore
+{
+public:
+  EgoPoseStore() = default;
+  // Poses with equal timestamps keep their order
+  explicit EgoPoseStore(std::vector<EgoPoseInfo> egoPoses);
+
+  size_t size() const { return timeStamps.size(); }
+  bool empty() const { return timeStamps.empty(); }
+
+  TimeStamp getTimeStamp(size_t index) const { return timeStamps[index]; }
+  EgoPoseInfo operator[](size_t index) const;
+
+  // Index of the first pose not before timeStamp, size() if there is none
+  size_t lowerBound(TimeStamp timeStamp) const;
+
+  // Pose at timeStamp, the translation linearly interpolated and the
+  // rotation slerped between the poses around it. Before the first and
+  // after the last pose, that pose. The token is the one of a pose at
+  // exactly timeStamp, the zero token otherwise. The store must not be
+  // empty.
+  EgoPoseInfo interpolate(TimeStamp timeStamp) const;
+
+private:
+  std::vector<Token> tokens;
+  std::vector<TimeStamp> timeStamps;
+  std::vector<double> translations[3];
+  // w, x, y, z
+  std::vector<double> rotations[4];
+};
+
+}
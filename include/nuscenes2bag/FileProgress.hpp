@@ -1,6 +1,11 @@
 #pragma once 
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
 
 namespace nuscenes2bag {
 
@@ -14,9 +19,23 @@ class FileProgress {
 
         float getProgressPercentage();
 
+        // Called once per scene when its conversion ended, whether it
+        // succeeded or not. Wakes up waitForFinishedScene.
+        void addFinishedScene(size_t sceneIndex);
+
+        // Waits until a scene finished or the deadline is reached.
+        // Returns false on timeout, otherwise sceneIndex is the finished scene.
+        bool waitForFinishedScene(size_t& sceneIndex,
+                                  std::chrono::system_clock::time_point deadline);
+
     public:
         std::atomic<uint32_t> processedFiles;
         std::atomic<uint32_t> toProcessFiles;
+
+    private:
+        std::mutex mutex;
+        std::condition_variable sceneFinished;
+        std::deque<size_t> finishedScenes;
 };
 
-}
\ No newline at end of file
+}
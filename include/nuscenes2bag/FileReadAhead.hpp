@@ -0,0 +1,107 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nuscenes2bag {
+
+class FileReadPool;
+class MemoryBudget;
+
+// Reads the files of a work list, in order, ahead of the threads consuming
+// them. At most depth files are read but not taken yet, which bounds the
+// memory used by the buffers. They are charged to memoryBudget, if not null,
+// until taken.
+class FileReadAhead
+{
+public:
+  // Without a pool, every file is read by the thread taking it
+  FileReadAhead(FileReadPool* pool,
+                std::vector<std::string> filePaths,
+                uint32_t depth,
+                MemoryBudget* memoryBudget = nullptr);
+  // Waits for the reads in progress
+  ~FileReadAhead();
+
+  FileReadAhead(const FileReadAhead&) = delete;
+  FileReadAhead& operator=(const FileReadAhead&) = delete;
+
+  // Bytes of the file at index in the work list, blocks until they are read.
+  // A file not read yet is read by the calling thread. Each index is taken
+  // once. Throws UnableToParseFileException if the file can't be read.
+  std::vector<uint8_t> take(size_t index);
+
+private:
+  friend class FileReadPool;
+
+  enum class State : uint8_t
+  {
+    PENDING,
+    READING,
+    READY,
+    TAKEN
+  };
+
+  struct Entry
+  {
+    State state = State::PENDING;
+    std::vector<uint8_t> bytes;
+    std::exception_ptr error;
+  };
+
+  // Called by the pool threads
+  bool tryClaim(size_t& index);
+  void readClaimed(size_t index);
+
+private:
+  FileReadPool* const pool;
+  const std::vector<std::string> filePaths;
+  const uint32_t depth;
+  MemoryBudget* const memoryBudget;
+
+  std::mutex mutex;
+  std::condition_variable entryReady;
+  std::vector<Entry> entries;
+  size_t nextToRead = 0;
+  size_t takenNumber = 0;
+  size_t activeReads = 0;
+  bool stopping = false;
+};
+
+// I/O threads shared by the read-aheads of all the scenes being converted.
+// Reads from network storage are latency bound, so using more threads than
+// cores keeps more requests in flight.
+class FileReadPool
+{
+public:
+  explicit FileReadPool(uint32_t threadNumber);
+  ~FileReadPool();
+
+  FileReadPool(const FileReadPool&) = delete;
+  FileReadPool& operator=(const FileReadPool&) = delete;
+
+private:
+  friend class FileReadAhead;
+
+  void attach(FileReadAhead* readAhead);
+  void detach(FileReadAhead* readAhead);
+  // Wakes the threads after a read-ahead window moved
+  void notifyWork();
+  bool claimRead(FileReadAhead*& readAhead, size_t& index);
+  void threadLoop();
+
+private:
+  std::mutex mutex;
+  std::condition_variable workAvailable;
+  std::vector<FileReadAhead*> readAheads;
+  size_t nextReadAhead = 0;
+  bool stopping = false;
+  std::vector<std::thread> threads;
+};
+
+}
@@ -1,14 +1,14 @@
 #pragma once
 
+#include "sensor_msgs/CompressedImage.h"
 #include "sensor_msgs/Image.h"
 
-#include <cv_bridge/cv_bridge.h>
-
-#include <opencv2/core/core.hpp>
-#include <opencv2/imgcodecs.hpp>
+#include <cstdint>
+#include <vector>
 
 #if CMAKE_CXX_STANDARD >= 17
 #include <filesystem>
+#include <optional>
 namespace fs = std::filesystem;
 #else
 #include <boost/filesystem.hpp>
@@ -17,10 +17,27 @@ namespace fs = boost::filesystem;
 
 namespace nuscenes2bag {
 
+// fileBytes, if not null, are the bytes of the file already read, decoded
+// instead of reading the file again and then given back to the buffer pool.
+// The image is decoded at 1/scaleDenominator of its size (1, 2, 4 or 8),
+// scaled by the inverse DCT of libjpeg instead of resized afterwards.
+#if CMAKE_CXX_STANDARD >= 17
+std::optional<sensor_msgs::Image> readImageFile(const fs::path& filePath,
+                                                std::vector<uint8_t>* fileBytes = nullptr,
+                                                uint32_t scaleDenominator = 1) noexcept;
+#else
+sensor_msgs::ImagePtr readImageFile(const fs::path& filePath,
+                                    std::vector<uint8_t>* fileBytes = nullptr,
+                                    uint32_t scaleDenominator = 1) noexcept;
+#endif
+
+// Copies the JPEG file as is into the message, without decoding it
 #if CMAKE_CXX_STANDARD >= 17
-std::optional<sensor_msgs::Image> readImageFile(const fs::path& filePath) noexcept;
+std::optional<sensor_msgs::CompressedImage> readCompressedImageFile(const fs::path& filePath,
+                                                                    std::vector<uint8_t>* fileBytes = nullptr) noexcept;
 #else
-sensor_msgs::ImagePtr readImageFile(const fs::path& filePath) noexcept;
+sensor_msgs::CompressedImagePtr readCompressedImageFile(const fs::path& filePath,
+                                                        std::vector<uint8_t>* fileBytes = nullptr) noexcept;
 #endif
 
 }
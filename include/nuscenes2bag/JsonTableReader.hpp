@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "nuscenes2bag/DatasetTypes.hpp"
+
+#if CMAKE_CXX_STANDARD >= 17
+#include <filesystem>
+namespace fs = std::filesystem;
+#else
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
+#endif
+
+namespace nuscenes2bag {
+
+// One element of a metadata table. Values of nested arrays are flattened
+// into a single list of numbers per key (e.g. "translation", "rotation").
+// Field storage is reused from one record to the next.
+class JsonRecord
+{
+public:
+  enum class FieldType
+  {
+    NONE,
+    STRING,
+    UNSIGNED,
+    INTEGER,
+    FLOAT,
+    BOOLEAN,
+    ARRAY
+  };
+
+  struct Field
+  {
+    std::string key;
+    FieldType type = FieldType::NONE;
+    std::string stringValue;
+    uint64_t unsignedValue = 0;
+    int64_t integerValue = 0;
+    double floatValue = 0.0;
+    bool booleanValue = false;
+    std::vector<double> numbers;
+  };
+
+  void clear();
+  Field& addField(std::string& key);
+
+  // The getters throw InvalidMetaDataException if the key is missing or
+  // has an unexpected type
+  const std::string& getString(const char* key) const;
+  Token getToken(const char* key) const;
+  uint64_t getUnsigned(const char* key) const;
+  double getNumber(const char* key) const;
+  bool getBoolean(const char* key) const;
+  const std::vector<double>& getNumbers(const char* key,
+                                        size_t expectedSize) const;
+
+private:
+  const Field& getField(const char* key, FieldType type) const;
+  const Field* findField(const char* key) const;
+
+private:
+  std::vector<Field> fields;
+  size_t fieldNumber = 0;
+};
+
+// Streams a metadata table (a JSON array of objects) from disk and calls
+// onRecord for each element, without building a DOM of the whole file.
+void
+readJsonTable(const fs::path& filePath,
+              const std::function<void(const JsonRecord&)>& onRecord);
+
+}
@@ -1,10 +1,10 @@
 #pragma once
 
 #include "sensor_msgs/PointCloud2.h"
-#include <pcl_ros/point_cloud.h>
 
 #if CMAKE_CXX_STANDARD >= 17
 #include <filesystem>
+#include <optional>
 namespace fs = std::filesystem;
 #else
 #include <boost/filesystem.hpp>
@@ -13,10 +13,14 @@ namespace fs = boost::filesystem;
 
 namespace nuscenes2bag {
 
+// fileBytes, if not null, are the bytes of the file already read, moved into
+// the message instead of reading the file again
 #if CMAKE_CXX_STANDARD >= 17
-std::optional<sensor_msgs::PointCloud2> readLidarFile(const fs::path& filePath);
+std::optional<sensor_msgs::PointCloud2> readLidarFile(const fs::path& filePath,
+                                                      std::vector<uint8_t>* fileBytes = nullptr);
 #else
-sensor_msgs::PointCloud2Ptr readLidarFile(const fs::path& filePath);
+sensor_msgs::PointCloud2Ptr readLidarFile(const fs::path& filePath,
+                                          std::vector<uint8_t>* fileBytes = nullptr);
 #endif
 
 }
@@ -1,10 +1,10 @@
 #pragma once
 
 #include "sensor_msgs/PointCloud2.h"
-#include <pcl_ros/point_cloud.h>
 
 #if CMAKE_CXX_STANDARD >= 17
 #include <filesystem>
+#include <optional>
 namespace fs = std::filesystem;
 #else
 #include <boost/filesystem.hpp>
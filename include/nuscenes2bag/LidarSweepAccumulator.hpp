@@ -0,0 +1,83 @@
+#pragma once
+
+#include "nuscenes2bag/DatasetTypes.hpp"
+#include "nuscenes2bag/MemoryBudget.hpp"
+
+#include "sensor_msgs/PointCloud2.h"
+
+#include <Eigen/Geometry>
+
+#include <cstdint>
+#include <vector>
+
+namespace nuscenes2bag {
+
+// Unaligned, so that it can be stored in std::vector and in the messages
+// of the pipeline without an aligned allocator
+typedef Eigen::Transform<double, 3, Eigen::Isometry, Eigen::DontAlign> Pose3d;
+
+// Translation and rotation (w, x, y, z) as stored in the nuScenes tables
+Pose3d makePose(const double translation[3], const double rotation[4]);
+
+// Applies the rigid transform m (the first 3 rows of a row major 4x4
+// matrix) in place to n points in structure of arrays layout. The loop is
+// vectorized by the compiler, in place it only needs a few alias checks.
+void transformPoints(const float m[12], size_t n, float* x, float* y, float* z);
+
+// A decoded lidar sweep in structure of arrays layout, with its pose
+struct LidarSweep
+{
+  TimeStamp timeStamp = 0;
+  // Lidar frame -> global frame at timeStamp
+  Pose3d lidarToGlobal = Pose3d::Identity();
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+  std::vector<float> intensity;
+
+  size_t size() const { return x.size(); }
+};
+
+// cloud is a cloud of readLidarFile (x, y, z, intensity as float32)
+LidarSweep makeLidarSweep(const sensor_msgs::PointCloud2& cloud,
+                          TimeStamp timeStamp,
+                          const Pose3d& lidarToGlobal);
+
+// The last sweepNumber sweeps of a lidar, accumulated in the frame of the
+// latest one like the nuScenes devkit multi-sweep clouds. Every sweep is
+// decoded once and kept until enough newer ones were added. Not thread
+// safe, it is fed in timeline order by the thread writing the bag.
+class LidarSweepAccumulator
+{
+public:
+  // The kept sweeps are charged to memoryBudget, if not null, until dropped
+  explicit LidarSweepAccumulator(uint32_t sweepNumber,
+                                 MemoryBudget* memoryBudget = nullptr);
+  ~LidarSweepAccumulator();
+
+  LidarSweepAccumulator(const LidarSweepAccumulator&) = delete;
+  LidarSweepAccumulator& operator=(const LidarSweepAccumulator&) = delete;
+
+  // Drops the oldest sweep once sweepNumber are kept
+  void addSweep(LidarSweep&& sweep);
+
+  // The kept sweeps, latest first, in the frame of the latest one. The
+  // fields are x, y, z, intensity and time_lag, the seconds between the
+  // sweep of the point and the latest one (float32).
+  void accumulate(sensor_msgs::PointCloud2& cloud);
+
+private:
+  const uint32_t sweepNumber;
+  MemoryBudget* const memoryBudget;
+  // Ring buffer, the latest sweep is before sweeps[nextSweep]
+  std::vector<LidarSweep> sweeps;
+  size_t nextSweep = 0;
+  // Charged to memoryBudget for the kept sweeps
+  uint64_t keptBytes = 0;
+  // Transformed coordinates of one sweep, reused
+  std::vector<float> transformedX;
+  std::vector<float> transformedY;
+  std::vector<float> transformedZ;
+};
+
+}
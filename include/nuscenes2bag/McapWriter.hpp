@@ -0,0 +1,167 @@
+#pragma once
+
+#include <ros/message_traits.h>
+#include <ros/serialization.h>
+#include <ros/time.h>
+
+#if CMAKE_CXX_STANDARD >= 17
+#include <filesystem>
+namespace fs = std::filesystem;
+#else
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
+#endif
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace nuscenes2bag {
+
+class DecodeWorkerPool;
+
+enum class McapCompression
+{
+  NONE,
+  // LZ4 frames, as written by roslz4
+  LZ4
+};
+
+// Writes ROS1 messages to an MCAP file (https://mcap.dev, ros1 profile).
+// The messages are grouped in chunks, each followed by the message index of
+// its channels, and the summary section lists the schemas, channels,
+// statistics and chunk indices, so that readers can seek to a time range or
+// a topic without scanning the file. Written by a single thread.
+// With a worker pool, a full chunk is compressed on a pool worker while the
+// next one is filled, and written once the next one is full in turn.
+class McapWriter
+{
+public:
+  // Throws std::runtime_error if path can't be created
+  McapWriter(const fs::path& path,
+             McapCompression compression,
+             uint32_t chunkThreshold,
+             DecodeWorkerPool* workerPool = nullptr);
+  // Waits for the chunk being compressed, if any
+  ~McapWriter();
+
+  McapWriter(const McapWriter&) = delete;
+  McapWriter& operator=(const McapWriter&) = delete;
+
+  // Latched messages are flagged on their channel, for the readers
+  // republishing them
+  template<typename T>
+  void write(const std::string& topicName,
+             const ros::Time& time,
+             const T& msg,
+             bool latched = false);
+
+  // Writes the last chunk, the summary and the footer. A file which is not
+  // closed has no summary. Throws std::runtime_error on write errors.
+  void close();
+
+private:
+  typedef std::vector<uint8_t> Bytes;
+
+  // Creates the channel (and its schema) on first use
+  uint16_t getChannelId(const std::string& topicName,
+                        const char* dataType,
+                        const char* md5Sum,
+                        const char* definition,
+                        bool latched);
+  // Appends a message record to the current chunk and returns where its
+  // size bytes of data go
+  uint8_t* addMessage(uint16_t channelId, uint64_t logTime, uint32_t size);
+  // Writes the pending chunk and makes the current one pending
+  void writeChunk();
+  void compressPendingChunk();
+  // Rethrows the exception of the compression, if any
+  void waitPendingChunk();
+  void writePendingChunk();
+  void writeToFile(const uint8_t* bytes, size_t size);
+  void writeToFile(const Bytes& bytes) { writeToFile(bytes.data(), bytes.size()); }
+
+private:
+  const std::string path;
+  const McapCompression compression;
+  const uint32_t chunkThreshold;
+  DecodeWorkerPool* const workerPool;
+  std::ofstream file;
+  uint64_t filePosition = 0;
+  bool closed = false;
+
+  std::unordered_map<std::string, uint16_t> schemaIds;
+  std::unordered_map<std::string, uint16_t> channelIds;
+  // All the schema and channel records, repeated in the summary
+  Bytes schemaRecords;
+  Bytes channelRecords;
+  // By channel id
+  std::vector<uint64_t> channelMessageCounts;
+  uint64_t messageCount = 0;
+  uint64_t messageStartTime;
+  uint64_t messageEndTime = 0;
+
+  // Records of the current chunk, uncompressed
+  Bytes chunkRecords;
+  uint64_t chunkStartTime;
+  uint64_t chunkEndTime = 0;
+  // Log time and offset in chunkRecords of the messages of the current
+  // chunk, by channel id
+  std::vector<std::vector<std::pair<uint64_t, uint64_t>>> chunkMessageIndices;
+  Bytes chunkIndexRecords;
+  uint32_t chunkCount = 0;
+
+  // Full chunk waiting to be written, swapped with the current one so that
+  // the buffers are reused
+  struct PendingChunk
+  {
+    Bytes records;
+    uint64_t startTime = 0;
+    uint64_t endTime = 0;
+    std::vector<std::vector<std::pair<uint64_t, uint64_t>>> messageIndices;
+    Bytes compressedRecords;
+    // 0 if left uncompressed
+    uint64_t compressedSize = 0;
+  };
+  PendingChunk pendingChunk;
+  bool hasPendingChunk = false;
+  // Set while a pool worker compresses the pending chunk
+  std::mutex compressionMutex;
+  std::condition_variable compressionDone;
+  bool compressing = false;
+  std::exception_ptr compressionError;
+
+  // Reused from one record to the next
+  Bytes recordBuffer;
+};
+
+template<typename T>
+void
+McapWriter::write(const std::string& topicName,
+                  const ros::Time& time,
+                  const T& msg,
+                  bool latched)
+{
+  const uint16_t channelId =
+    getChannelId(topicName,
+                 ros::message_traits::datatype<T>(),
+                 ros::message_traits::md5sum<T>(),
+                 ros::message_traits::definition<T>(),
+                 latched);
+  // Serialized in place, in the chunk
+  const uint32_t size = ros::serialization::serializationLength(msg);
+  ros::serialization::OStream stream(addMessage(channelId, time.toNSec(), size),
+                                     size);
+  ros::serialization::serialize(stream, msg);
+  if (chunkRecords.size() >= chunkThreshold) {
+    writeChunk();
+  }
+}
+
+}
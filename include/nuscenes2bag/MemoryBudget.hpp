@@ -0,0 +1,77 @@
+#pragma once
+
+#include "nuscenes2bag/ConversionStats.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+namespace nuscenes2bag {
+
+// Bytes of the decoded messages waiting to be written, shared by all the
+// scenes being converted. The files read ahead and the lidar sweeps kept
+// for accumulation are charged too. Once the limit is reached the decode
+// pipelines stop claiming new samples until some are written, except for a
+// pipeline with nothing in flight, so that every scene keeps progressing.
+// The limit can thus be exceeded by about one message per decode worker.
+class MemoryBudget
+{
+public:
+  // 0 means no limit, the usage is still measured
+  explicit MemoryBudget(uint64_t limitBytes);
+
+  MemoryBudget(const MemoryBudget&) = delete;
+  MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+  bool isExhausted() const
+  {
+    return usedBytes.load(std::memory_order_relaxed) >= limitBytes;
+  }
+
+  void charge(ConversionStage stage, uint64_t bytes);
+  void release(ConversionStage stage, uint64_t bytes);
+
+  // Peak usage so far, per stage and in total
+  MemoryStats getStats() const;
+
+private:
+  const uint64_t limitBytes;
+  std::atomic<uint64_t> usedBytes;
+
+  mutable std::mutex mutex;
+  MemoryStats stats;
+  std::array<uint64_t, static_cast<size_t>(ConversionStage::STAGE_NUMBER)>
+    stageBytes{};
+};
+
+// Bytes charged to a budget (if not null) until destroyed
+class MemoryCharge
+{
+public:
+  MemoryCharge(MemoryBudget* budget, ConversionStage stage, uint64_t bytes)
+    : budget(budget)
+    , stage(stage)
+    , bytes(bytes)
+  {
+    if (budget != nullptr) {
+      budget->charge(stage, bytes);
+    }
+  }
+
+  ~MemoryCharge()
+  {
+    if (budget != nullptr) {
+      budget->release(stage, bytes);
+    }
+  }
+
+  MemoryCharge(const MemoryCharge&) = delete;
+  MemoryCharge& operator=(const MemoryCharge&) = delete;
+
+private:
+  MemoryBudget* const budget;
+  const ConversionStage stage;
+  const uint64_t bytes;
+};
+
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "nuscenes2bag/McapWriter.hpp"
+
+#include "ros/ros.h"
+#include "rosbag/bag.h"
+
+#include <boost/make_shared.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace nuscenes2bag {
+
+// Destination of the messages of a scene, written in timeline order by a
+// single thread: a bag, an MCAP file, or ROS topics published at the pace of
+// the dataset
+class MessageSink
+{
+public:
+  // Writes the messages to bag
+  explicit MessageSink(rosbag::Bag& bag);
+
+  // Writes the messages to mcap
+  explicit MessageSink(McapWriter& mcap);
+
+  // Publishes the messages on the topics of nodeHandle, speedFactor times
+  // faster than they were recorded, along with the matching /clock
+  MessageSink(ros::NodeHandle& nodeHandle, double speedFactor);
+
+  MessageSink(const MessageSink&) = delete;
+  MessageSink& operator=(const MessageSink&) = delete;
+
+  // Latched messages are delivered to the subscribers connecting later
+  template<typename T>
+  void write(const std::string& topicName,
+             const ros::Time& time,
+             const T& msg,
+             bool latched = false);
+
+  // Restarts the playback clock, the next message is published immediately.
+  // Called at the start of each scene.
+  void restartPlayback();
+
+private:
+  template<typename T>
+  const ros::Publisher& getPublisher(const std::string& topicName, bool latched);
+
+  // Sleeps until the wall time time is due at, then publishes it on /clock.
+  // Throws std::runtime_error once ROS is shut down.
+  void waitForTime(const ros::Time& time);
+  void waitForSubscribers();
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  rosbag::Bag* const bag;
+  McapWriter* const mcap;
+  ros::NodeHandle* const nodeHandle;
+  const double speedFactor;
+
+  std::unordered_map<std::string, ros::Publisher> publishers;
+  ros::Publisher clockPublisher;
+  bool playbackStarted = false;
+  ros::Time playbackStartTime;
+  Clock::time_point playbackStartWallTime;
+};
+
+template<typename T>
+void
+MessageSink::write(const std::string& topicName,
+                   const ros::Time& time,
+                   const T& msg,
+                   bool latched)
+{
+  if (bag != nullptr) {
+    if (latched) {
+      // Read back by rosbag play, which then advertises the topic as latched
+      auto connectionHeader = boost::make_shared<ros::M_string>();
+      (*connectionHeader)["latching"] = "1";
+      bag->write(topicName, time, msg, connectionHeader);
+    } else {
+      bag->write(topicName, time, msg);
+    }
+    return;
+  }
+  if (mcap != nullptr) {
+    mcap->write(topicName, time, msg, latched);
+    return;
+  }
+
+  const ros::Publisher& publisher = getPublisher<T>(topicName, latched);
+  waitForTime(time);
+  publisher.publish(msg);
+}
+
+template<typename T>
+const ros::Publisher&
+MessageSink::getPublisher(const std::string& topicName, bool latched)
+{
+  auto it = publishers.find(topicName);
+  if (it == publishers.end()) {
+    it = publishers
+           .emplace(topicName,
+                    nodeHandle->advertise<T>(topicName, 100, latched))
+           .first;
+    waitForSubscribers();
+  }
+  return it->second;
+}
+
+}
@@ -1,10 +1,16 @@
+#pragma once
+
+#include "nuscenes2bag/EgoPoseStore.hpp"
 #include "nuscenes2bag/MetaDataTypes.hpp"
+#include "nuscenes2bag/Span.hpp"
 
 #include <exception>
 #include <vector>
 
 #if CMAKE_CXX_STANDARD >= 17
 #include <optional>
+#else
+#include <boost/shared_ptr.hpp>
 #endif
 
 namespace nuscenes2bag {
@@ -28,19 +34,26 @@ public:
   virtual boost::shared_ptr<SceneInfo> getSceneInfoByNumber(const uint32_t sceneNumber) const = 0;
 #endif
 
-  virtual std::vector<SampleDataInfo> getSceneSampleData(
-    const Token& sceneSampleData) const = 0;
-  virtual std::vector<EgoPoseInfo> getEgoPoseInfo(
+  // The returned views and references point into the provider storage and
+  // stay valid as long as the provider
+  virtual Span<SampleDataInfo> getSceneSampleData(
     const Token& sceneToken) const = 0;
-  virtual std::map<Token, SampleInfo> getSceneSamples(
+  // Sorted by timestamp
+  virtual const EgoPoseStore& getEgoPoses(
     const Token& sceneToken) const = 0;
-  virtual std::map<Token, std::vector<SampleAnnotationInfo>> getSceneSampleAnnotations(
+  virtual Span<SampleInfo> getSceneSamples(
     const Token& sceneToken) const = 0;
-  virtual CalibratedSensorInfo getCalibratedSensorInfo(
+  // Returns nullptr if there is no sample with this token
+  virtual const SampleInfo* findSampleInfo(
+    const Token& sampleToken) const = 0;
+  // Empty if the sample has no annotation
+  virtual Span<SampleAnnotationInfo> getSampleAnnotations(
+    const Token& sampleToken) const = 0;
+  virtual const CalibratedSensorInfo& getCalibratedSensorInfo(
     const Token& calibratedSensorToken) const = 0;
   virtual std::vector<CalibratedSensorInfoAndName> getSceneCalibratedSensorInfo(
     const Token& sceneToken) const = 0;
-  virtual CalibratedSensorName getSensorName(
+  virtual const CalibratedSensorName& getSensorName(
     const Token& sensorToken) const = 0;
 };
 
@@ -1,6 +1,11 @@
+#pragma once
+
 #include <iostream>
 #include <map>
+#include <unordered_map>
 #include <set>
+#include <stdexcept>
+#include <string>
 
 #if CMAKE_CXX_STANDARD >= 17
 #include <filesystem>
@@ -10,53 +15,72 @@ namespace fs = std::filesystem;
 namespace fs = boost::filesystem;
 #endif
 
-#include <nlohmann/json.hpp>
-
 #include "nuscenes2bag/MetaDataTypes.hpp"
 #include "nuscenes2bag/MetaDataProvider.hpp"
 #include "nuscenes2bag/ToDebugString.hpp"
 
 namespace nuscenes2bag {
 
-class InvalidMetaDataException : public std::exception
+// A runtime_error, so that the callers catching those report it too
+class InvalidMetaDataException : public std::runtime_error
 {
-private:
-  std::string msg;
-
 public:
   InvalidMetaDataException(const std::string& msg)
-    : msg(msg)
+    : std::runtime_error(msg)
   {}
-  ~InvalidMetaDataException() throw(){}
-  const char* what() const throw() { return this->msg.c_str(); }
 };
 
 class MetaDataReader : public MetaDataProvider {
 public:
-  void loadFromDirectory(const fs::path &directoryPath);
+  // With shardCount > 1, only the scenes of shard shardIndex, and the rows
+  // of the tables they reference, are kept once loaded
+  void loadFromDirectory(const fs::path &directoryPath,
+                         uint32_t shardIndex = 0,
+                         uint32_t shardCount = 1);
+
+  // Restores the tables written by saveToCache. Returns false if the cache
+  // is missing, malformed, out of date with the JSON files of directoryPath
+  // or saved from another shard
+  bool loadFromCache(const fs::path &cachePath,
+                     const fs::path &directoryPath,
+                     uint32_t shardIndex = 0,
+                     uint32_t shardCount = 1);
+  // Writes the loaded tables to cachePath, throws std::runtime_error on failure
+  void saveToCache(const fs::path &cachePath, const fs::path &directoryPath) const;
+
+  // Time in seconds spent by loadFromDirectory on each table, for reporting
+  const std::vector<std::pair<std::string, double>>& getTableLoadSeconds() const;
 
 
   std::vector<Token> getAllSceneTokens() const override;
 
+  // Scenes of shard shardIndex of shardCount, see selectShardScenes. Once
+  // loaded restricted to a shard, only that shard can be asked for and
+  // std::invalid_argument is thrown for any other.
+  std::vector<Token> getShardSceneTokens(uint32_t shardIndex,
+                                         uint32_t shardCount) const;
+
 #if CMAKE_CXX_STANDARD >= 17
   std::optional<SceneInfo> getSceneInfo(const Token &sceneToken) const override;
 #else
   boost::shared_ptr<SceneInfo> getSceneInfo(const Token &sceneToken) const override;
 #endif
 
-  std::vector<SampleDataInfo>
+  Span<SampleDataInfo>
   getSceneSampleData(const Token &sceneToken) const override;
-  std::vector<EgoPoseInfo>
-  getEgoPoseInfo(const Token &sceneToken) const override;
-  std::map<Token, SampleInfo>
+  const EgoPoseStore&
+  getEgoPoses(const Token &sceneToken) const override;
+  Span<SampleInfo>
   getSceneSamples(const Token& sceneToken) const override;
-  std::map<Token, std::vector<SampleAnnotationInfo>>
-  getSceneSampleAnnotations(const Token& sceneToken) const override;
-  CalibratedSensorInfo
+  const SampleInfo*
+  findSampleInfo(const Token& sampleToken) const override;
+  Span<SampleAnnotationInfo>
+  getSampleAnnotations(const Token& sampleToken) const override;
+  const CalibratedSensorInfo&
   getCalibratedSensorInfo(const Token &calibratedSensorToken) const override;
   std::vector<CalibratedSensorInfoAndName>
   getSceneCalibratedSensorInfo(const Token &sceneToken) const override;
-  CalibratedSensorName
+  const CalibratedSensorName&
   getSensorName(const Token &sensorToken) const override;
 
 #if CMAKE_CXX_STANDARD >= 17
@@ -67,41 +91,59 @@ public:
 #endif
 
 private:
-  static nlohmann::json slurpJsonFile(const fs::path &filePath);
+  void groupSampleDataByScene(
+    std::unordered_map<Token, std::vector<SampleDataInfo>>& sample2SampleData);
+  void decorateSampleAnnotations();
+  std::unordered_map<Token, Token> buildSceneRelations();
+  // Number of sample data of each scene, in scenes order
+  std::vector<uint64_t> getSceneSampleDataNumbers() const;
+  // Drops the other scenes, with their samples, sample data and annotations
+  void keepScenes(const std::vector<Token>& sceneTokens);
+
   static std::vector<SceneInfo>
   loadScenesFromFile(const fs::path &filePath);
-  static std::map<Token, std::vector<SampleInfo>>
+  static std::unordered_map<Token, std::vector<SampleInfo>>
   loadSampleInfos(const fs::path &filePath);
-  static std::map<Token, std::vector<SampleDataInfo>>
+  static std::unordered_map<Token, std::vector<SampleDataInfo>>
   loadSampleDataInfos(const fs::path &filePath);
-  static std::map<Token, std::vector<EgoPoseInfo>> loadEgoPoseInfos(
+  static std::unordered_map<Token, EgoPoseStore> loadEgoPoseInfos(
       const fs::path &filePath,
-      std::map<Token, Token> sample2SampleData);
-  static std::map<Token, CalibratedSensorInfo>
+      const std::unordered_map<Token, Token> &sampleDataToken2SceneToken,
+      bool skipUnknownSampleData);
+  static std::unordered_map<Token, CalibratedSensorInfo>
   loadCalibratedSensorInfo(const fs::path &filePath);
-  static std::map<Token, CalibratedSensorName>
+  static std::unordered_map<Token, CalibratedSensorName>
   loadCalibratedSensorNames(const fs::path &filePath);
-  static std::map<Token, AttributeInfo>
+  static std::unordered_map<Token, AttributeInfo>
   loadAttributeInfo(const fs::path& filePath);
-  static std::map<Token, CategoryInfo>
+  static std::unordered_map<Token, CategoryInfo>
   loadCategories(const fs::path& filePath);
-  static std::map<Token, InstanceInfo>
+  static std::unordered_map<Token, InstanceInfo>
   loadInstances(const fs::path& filePath);
-  static std::map<Token, std::vector<SampleAnnotationInfo>>
+  static std::unordered_map<Token, std::vector<SampleAnnotationInfo>>
   loadSampleAnnotations(const fs::path& filePath);
 
   std::vector<SceneInfo> scenes;
-  std::map<Token, std::vector<SampleInfo>> scene2Samples;
-  std::map<Token, std::vector<SampleDataInfo>> sample2SampleData;
-  std::map<Token, std::vector<EgoPoseInfo>> scene2EgoPose;
-  std::map<Token, CalibratedSensorInfo> calibratedSensorToken2CalibratedSensorInfo;
-  std::map<Token, std::set<CalibratedSensorInfoAndName>> scene2CalibratedSensorInfo;
-  std::map<Token, CalibratedSensorName> sensorToken2CalibratedSensorName;
-  std::map<Token, AttributeInfo> attributeInfo;
-  std::map<Token, CategoryInfo> categories;
-  std::map<Token, InstanceInfo> instances;
-  std::map<Token, std::vector<SampleAnnotationInfo>> sample2SampleAnnotations;
+  std::unordered_map<Token, std::vector<SampleInfo>> scene2Samples;
+  std::unordered_map<Token, SampleInfo> sampleToken2SampleInfo;
+  // Sample data of all the samples of a scene, in scene sample order
+  std::unordered_map<Token, std::vector<SampleDataInfo>> scene2SampleData;
+  std::unordered_map<Token, EgoPoseStore> scene2EgoPose;
+  std::unordered_map<Token, CalibratedSensorInfo> calibratedSensorToken2CalibratedSensorInfo;
+  std::unordered_map<Token, std::set<CalibratedSensorInfoAndName>> scene2CalibratedSensorInfo;
+  std::unordered_map<Token, CalibratedSensorName> sensorToken2CalibratedSensorName;
+  std::unordered_map<Token, AttributeInfo> attributeInfo;
+  std::unordered_map<Token, CategoryInfo> categories;
+  std::unordered_map<Token, InstanceInfo> instances;
+  std::unordered_map<Token, std::vector<SampleAnnotationInfo>> sample2SampleAnnotations;
+  std::vector<std::pair<std::string, double>> tableLoadSeconds;
   bool loadFromDirectoryCalled = false;
+  // Shard the tables were restricted to, 1 shard when they are complete
+  uint32_t loadedShardIndex = 0;
+  uint32_t loadedShardCount = 1;
 };
 
-}
\ No newline at end of file
+// Default display color (r, g, b, a) of a category, chosen from its name
+void getCategoryColor(const std::string& categoryName, float color[4]);
+
+}
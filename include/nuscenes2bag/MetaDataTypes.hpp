@@ -79,6 +79,8 @@ struct SampleAnnotationInfo {
     float rotation[4];
     float size[3];
     std::string categoryName;
+    // Display color (r, g, b, a) of the category, resolved when loading
+    float color[4];
     //std::vector<Token> anns;
 };
 
@@ -2,6 +2,7 @@
 
 #include <rosbag/bag.h>
 
+#include "nuscenes2bag/ConversionOptions.hpp"
 #include "nuscenes2bag/DatasetTypes.hpp"
 
 #if CMAKE_CXX_STANDARD >= 17
@@ -13,17 +14,44 @@ namespace fs = std::filesystem;
 namespace fs = boost::filesystem;
 #endif
 
+#include <functional>
+#include <string>
+
 namespace nuscenes2bag {
 
+// Outcome of the conversion of one scene
+struct SceneConversionResult {
+  Token sceneToken;
+  std::string sceneName;
+  bool success = true;
+  // The bag was already up to date in the output directory, not converted
+  bool skipped = false;
+  std::string errorMessage;
+};
+
+typedef std::function<void(const SceneConversionResult&)> SceneCompletionCallback;
+
 struct NuScenes2Bag {
 
 public:
   NuScenes2Bag();
 
-  void convertDirectory(const fs::path &inDatasetPath,
+  // Called on the thread running convertDirectory, once per scene, in the
+  // order the scenes finish
+  void setSceneCompletionCallback(const SceneCompletionCallback& callback);
+
+  // Returns once every scene finished, true if all of them were converted,
+  // false right away if the metadata can't be loaded. A failing scene
+  // doesn't stop the other ones. Scenes the manifest of the
+  // output directory records as up to date are skipped, see
+  // ConversionOptions::skipUpToDateScenes. With ConversionOptions::publish,
+  // the scenes are published on ROS topics instead and outputRosbagPath is
+  // not used.
+  bool convertDirectory(const fs::path &inDatasetPath,
                         const std::string& version,
                         const fs::path &outputRosbagPath,
                         int32_t threadNumber,
+                        const ConversionOptions& conversionOptions,
 #if CMAKE_CXX_STANDARD >= 17
                         std::optional<int32_t> sceneNumberOpt
 #else
@@ -33,6 +61,7 @@ public:
 
 private:
   std::string inDatasetPathString;
+  SceneCompletionCallback sceneCompletionCallback;
 };
 
 }
\ No newline at end of file
@@ -1,10 +1,11 @@
 #pragma once
 
 #include "nuscenes2bag/RadarObjects.h"
-#include "nuscenes2bag/PclRadarObject.hpp"
+#include "sensor_msgs/PointCloud2.h"
 
 #if CMAKE_CXX_STANDARD >= 17
 #include <filesystem>
+#include <optional>
 namespace fs = std::filesystem;
 #else
 #include <boost/filesystem.hpp>
@@ -13,10 +14,24 @@ namespace fs = boost::filesystem;
 
 namespace nuscenes2bag {
 
+// Reads a nuScenes radar .pcd file (binary, fixed field layout). fileBytes,
+// if not null, are the bytes of the file already read.
 #if CMAKE_CXX_STANDARD >= 17
-std::optional<nuscenes2bag::RadarObjects> readRadarFile(const fs::path& filePath);
+std::optional<nuscenes2bag::RadarObjects> readRadarFile(const fs::path& filePath,
+                                                        std::vector<uint8_t>* fileBytes = nullptr);
 #else
-nuscenes2bag::RadarObjectsPtr readRadarFile(const fs::path& filePath);
+nuscenes2bag::RadarObjectsPtr readRadarFile(const fs::path& filePath,
+                                            std::vector<uint8_t>* fileBytes = nullptr);
 #endif
 
-}
\ No newline at end of file
+// Same file as a point cloud with the PCD fields (x, y, z, dyn_prop, id,
+// rcs, ...), the packed points are copied as they are
+#if CMAKE_CXX_STANDARD >= 17
+std::optional<sensor_msgs::PointCloud2> readRadarFileAsPointCloud(const fs::path& filePath,
+                                                                  std::vector<uint8_t>* fileBytes = nullptr);
+#else
+sensor_msgs::PointCloud2Ptr readRadarFileAsPointCloud(const fs::path& filePath,
+                                                      std::vector<uint8_t>* fileBytes = nullptr);
+#endif
+
+}
@@ -14,12 +14,17 @@ public:
     auto now = std::chrono::system_clock::now();
     auto dtMs = std::chrono::duration_cast<std::chrono::milliseconds>(
         now - lastExecutionTime);
-    if (dtMs > periodMs) {
+    if (dtMs >= periodMs) {
       lambda();
       lastExecutionTime = now;
     }
   }
 
+  // Time at which the next update() runs the lambda, to wait until then
+  std::chrono::time_point<std::chrono::system_clock> nextExecutionTime() const {
+    return lastExecutionTime + periodMs;
+  }
+
   std::chrono::milliseconds periodMs;
   std::chrono::time_point<std::chrono::system_clock> lastExecutionTime;
   T lambda;
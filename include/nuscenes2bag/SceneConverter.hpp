@@ -8,12 +8,20 @@ namespace fs = std::filesystem;
 namespace fs = boost::filesystem;
 #endif
 
+#include "nuscenes2bag/ConversionOptions.hpp"
+#include "nuscenes2bag/ConversionStats.hpp"
+#include "nuscenes2bag/DecodePipeline.hpp"
+#include "nuscenes2bag/FileReadAhead.hpp"
+#include "nuscenes2bag/LidarSweepAccumulator.hpp"
+#include "nuscenes2bag/MemoryBudget.hpp"
+#include "nuscenes2bag/MessageSink.hpp"
 #include "nuscenes2bag/MetaDataReader.hpp"
 #include "nuscenes2bag/FileProgress.hpp"
 #include "nuscenes2bag/Boxes.h"
 
 #include "rosbag/bag.h"
 #include <geometry_msgs/Point.h>
+#include <geometry_msgs/TransformStamped.h>
 #include <visualization_msgs/Marker.h>
 #include <visualization_msgs/MarkerArray.h>
 
@@ -21,26 +29,136 @@ namespace fs = boost::filesystem;
 
 namespace nuscenes2bag {
 
+// Box poses in structure of arrays layout: x, y, z of the centers and
+// w, x, y, z of the rotations, so that a whole frame is interpolated with
+// loops over contiguous values
+struct BoxPoses {
+    enum { CX, CY, CZ, QW, QX, QY, QZ, VALUE_NUMBER };
+
+    void clear();
+    void push_back(const SampleAnnotationInfo& annotation);
+    size_t size() const { return values[CX].size(); }
+
+    std::vector<double> values[VALUE_NUMBER];
+};
+
+// Linear interpolation of the centers and spherical linear interpolation of
+// the rotations, amount = 0 gives poses0 and 1 gives poses1
+void interpolateBoxPoses(const BoxPoses& poses0, const BoxPoses& poses1, const double amount, BoxPoses& result);
+
 class SceneConverter {
     public:
-    SceneConverter(const MetaDataProvider& metaDataProvider);
+    // Sample files are decoded on decodeWorkerPool, or on the thread calling
+    // run() if it is null. If fileReadPool is not null, they are read ahead of
+    // decoding on its threads. The decoded messages are charged to
+    // memoryBudget, if not null, until written.
+    SceneConverter(const MetaDataProvider& metaDataProvider, const ConversionOptions& options, DecodeWorkerPool* decodeWorkerPool, const SceneStatsRecorder& statsRecorder = SceneStatsRecorder(), FileReadPool* fileReadPool = nullptr, MemoryBudget* memoryBudget = nullptr);
 
     void submit(const Token& sceneToken, FileProgress& fileProgress);
 
+    // Relative conversion cost of the submitted scene, in bytes of input.
+    // The size of one file per sensor is used for all its sample files.
+    uint64_t estimateCost(const fs::path& inPath) const;
+
+    // Writes the bag (or MCAP file) of the submitted scene, see getBagPath.
+    // Throws std::runtime_error, without writing it, if a sample file can't
+    // be read.
     void run(const fs::path& inPath, const fs::path& outDirectoryPath, FileProgress& fileProgress);
 
+    // Publishes the messages of the submitted scene on sink, from its first
+    // message, at the pace of the sink. Throws like run once done.
+    void publish(const fs::path& inPath, MessageSink& sink, FileProgress& fileProgress);
+
+    // Location of the bag (or MCAP file) of a scene in the output directory
+    static fs::path getBagPath(const fs::path& outDirectoryPath, SceneId sceneId, OutputFormat format = OutputFormat::BAG);
+
+    // Annotations of the sample of sampleData, interpolated from the previous
+    // sample for sweeps. sampleData must belong to the submitted scene.
+    // Reentrant, the BOXES records are converted by the decoding threads.
+    void getBoxes(const SampleDataInfo& sampleData, std::vector<Box>& boxes) const;
+
     private:
-    void convertSampleDatas(rosbag::Bag& outBag, const fs::path &inPath, FileProgress& fileProgress);
-    void convertEgoPoseInfos(rosbag::Bag& outBag, const std::vector<CalibratedSensorInfoAndName>& calibratedSensorInfo);
-    void convertAnnotations(rosbag::Bag& outBag);
-    void getBoxes(const SampleDataInfo& sampleData, std::vector<Box>& boxes);
+    // Per calibrated sensor values, computed once per scene in submit
+    struct SensorTopic {
+        SampleType sampleType;
+        std::string frameID;
+        std::string topicName;
+        // Kept by the channel and modality options
+        bool selected;
+        // Calibration of the sensor, base_link -> frameID
+        geometry_msgs::TransformStamped transform;
+        // The same calibration, to accumulate the lidar sweeps
+        Pose3d sensorToBase;
+        std::string sweepsTopicName;
+    };
+
+    enum class RecordType : uint8_t {
+        EGO_POSE,
+        BOXES,
+        SAMPLE_DATA,
+        STATIC_TRANSFORMS
+    };
+
+    // A message (or group of messages) of the bag. index refers to
+    // egoPoses for EGO_POSE records, to staticTransformSensors for
+    // STATIC_TRANSFORMS records and to sampleDatas otherwise.
+    struct TimelineRecord {
+        TimeStamp timeStamp;
+        RecordType type;
+        uint32_t index;
+    };
+
+    // A sample of the scene and the annotation of the same instance in the
+    // previous sample, for each of its annotations
+    struct SampleAnnotationPairing {
+        const SampleInfo* sample;
+        // Null if the sample has no previous sample
+        const SampleInfo* prevSample;
+        Span<SampleAnnotationInfo> annotations;
+        Span<SampleAnnotationInfo> prevAnnotations;
+        // Start of the annotations of the sample in prevAnnotationIndices
+        size_t prevIndicesOffset;
+    };
+
+    void pairSampleAnnotations();
+    void addStaticTransformRecords();
+
+    DecodePipeline::QueueStats writeTimeline(MessageSink& sink, const fs::path &inPath, FileProgress& fileProgress);
+    // readAhead, if not null, provides the bytes of the sample file at readIndex
+    DecodePipeline::WriteTask convertSampleData(size_t sampleDataIndex, MessageSink& sink, const fs::path &inPath, FileProgress& fileProgress, FileReadAhead* readAhead, size_t readIndex);
+    // Null if the scene has no ego pose
+    DecodePipeline::WriteTask convertLidarSweep(const SampleDataInfo& sampleData, const SensorTopic& sensor, const sensor_msgs::PointCloud2& cloud, MessageSink& sink);
+    DecodePipeline::WriteTask convertEgoPose(const EgoPoseInfo& egoPose, MessageSink& sink);
+    DecodePipeline::WriteTask convertBoxes(const SampleDataInfo& sampleData, MessageSink& sink);
+    DecodePipeline::WriteTask convertStaticTransforms(const std::vector<uint32_t>& sensorIndices, TimeStamp timeStamp, MessageSink& sink);
 
     private:
     const MetaDataProvider& metaDataProvider;
-    std::vector<SampleDataInfo> sampleDatas;
-    std::vector<EgoPoseInfo> egoPoseInfos;
-    std::map<Token, SampleInfo> sceneSamples;
-    std::map<Token, std::vector<SampleAnnotationInfo>> sceneAnnotations;
+    const ConversionOptions& options;
+    DecodeWorkerPool* decodeWorkerPool;
+    const SceneStatsRecorder statsRecorder;
+    FileReadPool* fileReadPool;
+    MemoryBudget* memoryBudget;
+    Span<SampleDataInfo> sampleDatas;
+    std::vector<SensorTopic> sensorTopics;
+    // Index in sensorTopics of the sensor of each element of sampleDatas
+    std::vector<uint32_t> sampleDataSensorIndices;
+    // Every message of the scene, sorted by timestamp
+    std::vector<TimelineRecord> timeline;
+    // Sensors (indices in sensorTopics) of each /tf_static message. A new
+    // message is written when the calibration of a sensor changes.
+    std::vector<std::vector<uint32_t>> staticTransformSensors;
+    const EgoPoseStore* egoPoses = nullptr;
+    // Last sweeps of each lidar frame, only used by the thread writing
+    std::unordered_map<std::string, LidarSweepAccumulator> sweepAccumulators;
+    // Samples of the current writeTimeline that could not be read, only
+    // used by the thread writing
+    uint32_t failedSampleNumber = 0;
+    std::vector<SampleAnnotationPairing> sampleAnnotationPairings;
+    std::unordered_map<Token, uint32_t> sampleIndices;
+    // Index in prevAnnotations of the same instance, NO_PREV_ANNOTATION if
+    // the instance is new
+    std::vector<uint32_t> prevAnnotationIndices;
     SceneId sceneId;
     Token sceneToken;
 };
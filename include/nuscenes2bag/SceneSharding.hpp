@@ -0,0 +1,20 @@
+#pragma once
+
+#include "nuscenes2bag/DatasetTypes.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace nuscenes2bag {
+
+// Splits the scenes into shardCount shards of about the same total cost
+// (their number of sample data) and returns the scenes of shard shardIndex,
+// in the order of sceneTokens. The partition only depends on the tokens and
+// the costs, every node of a conversion farm computes the same one from the
+// same metadata.
+std::vector<Token> selectShardScenes(const std::vector<Token>& sceneTokens,
+                                     const std::vector<uint64_t>& sceneCosts,
+                                     uint32_t shardIndex,
+                                     uint32_t shardCount);
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace nuscenes2bag {
+
+// Read-only view over contiguous elements owned by someone else (the subset
+// of C++20 std::span used here). It is only valid as long as the owner is not
+// modified or destroyed.
+template<typename T>
+class Span
+{
+public:
+  Span() = default;
+  Span(const T* first, size_t count)
+    : first(first)
+    , count(count)
+  {}
+  Span(const std::vector<T>& vector)
+    : first(vector.data())
+    , count(vector.size())
+  {}
+
+  const T* begin() const { return first; }
+  const T* end() const { return first + count; }
+  const T* data() const { return first; }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  const T& operator[](size_t index) const { return first[index]; }
+  const T& front() const { return first[0]; }
+  const T& back() const { return first[count - 1]; }
+
+private:
+  const T* first = nullptr;
+  size_t count = 0;
+};
+
+}
@@ -7,6 +7,7 @@
 #include <string>
 #include <iostream>
 #include <exception>
+#include <vector>
 
 #if CMAKE_CXX_STANDARD >= 17
 #include <string_view>
@@ -34,6 +35,17 @@ bool string_icontains(const std::string &string,
 
 ros::Time stampUs2RosTime(uint64_t stampUs);
 
+// Reads the whole file with a single read, sizing the buffer from the file length.
+// A buffer too small is replaced by one of the message buffer pool.
+// Throws UnableToParseFileException if the file cannot be read.
+void readFileBytes(const std::string& filePath, std::vector<uint8_t>& bytes);
+
+// Moves the bytes already read from the file (by a FileReadAhead) into bytes,
+// or reads the file if there are none
+void takeFileBytes(const std::string& filePath,
+                   std::vector<uint8_t>* fileBytes,
+                   std::vector<uint8_t>& bytes);
+
 template <class T> T uniq(T t) {
   sort(t.begin(), t.end());
   t.erase(unique(t.begin(), t.end()), t.end());
@@ -0,0 +1,69 @@
+#include "nuscenes2bag/BufferPool.hpp"
+
+namespace nuscenes2bag {
+
+// About a hundred camera images, enough for the messages in flight of
+// several scenes
+static const uint64_t MESSAGE_POOL_MAX_RETAINED_BYTES = 512ull << 20;
+
+BufferPool::BufferPool(uint64_t maxRetainedBytes)
+  : maxRetainedBytes(maxRetainedBytes)
+{}
+
+std::vector<uint8_t>
+BufferPool::acquire(size_t minCapacity)
+{
+  std::vector<uint8_t> buffer;
+  // Freed once the lock is released
+  std::vector<uint8_t> dropped;
+  std::lock_guard<std::mutex> lock(mutex);
+  size_t best = buffers.size();
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    const size_t capacity = buffers[i].capacity();
+    if ((capacity >= minCapacity) &&
+        ((best == buffers.size()) || (capacity < buffers[best].capacity()))) {
+      best = i;
+    }
+  }
+  if (best == buffers.size()) {
+    // Dropping a buffer that is too small leaves room for a larger one, so
+    // that the pool doesn't fill up with buffers fitting nothing
+    if (!buffers.empty()) {
+      dropped.swap(buffers.back());
+      buffers.pop_back();
+      retainedBytes -= dropped.capacity();
+    }
+    return buffer;
+  }
+
+  buffer.swap(buffers[best]);
+  buffers[best].swap(buffers.back());
+  buffers.pop_back();
+  retainedBytes -= buffer.capacity();
+  return buffer;
+}
+
+void
+BufferPool::release(std::vector<uint8_t>&& buffer)
+{
+  const uint64_t capacity = buffer.capacity();
+  if (capacity == 0) {
+    return;
+  }
+  buffer.clear();
+  std::lock_guard<std::mutex> lock(mutex);
+  if (retainedBytes + capacity > maxRetainedBytes) {
+    return;
+  }
+  retainedBytes += capacity;
+  buffers.push_back(std::move(buffer));
+}
+
+BufferPool&
+getMessageBufferPool()
+{
+  static BufferPool pool(MESSAGE_POOL_MAX_RETAINED_BYTES);
+  return pool;
+}
+
+}
@@ -0,0 +1,282 @@
+#include "nuscenes2bag/ConversionManifest.hpp"
+#include "nuscenes2bag/utils.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace json = nlohmann;
+
+namespace nuscenes2bag {
+
+static const char* const MANIFEST_FILE_STEM = "nuscenes2bag_manifest";
+static const char* const MANIFEST_FILE_EXTENSION = ".json";
+static const uint32_t MANIFEST_FORMAT_VERSION = 1;
+// Part of every fingerprint, to be increased by every change writing
+// different bags from the same inputs and options (new topics, other
+// message contents). The options themselves are in the fingerprint.
+// 2: /sweeps topics of --lidar-sweeps, images decoded by libjpeg
+static const uint32_t BAG_LAYOUT_VERSION = 2;
+
+// nuscenes2bag_manifest.json, or nuscenes2bag_manifest.shard-<i>-of-<N>.json
+static std::string
+getManifestFileName(uint32_t shardIndex, uint32_t shardCount)
+{
+  std::ostringstream fileName;
+  fileName << MANIFEST_FILE_STEM;
+  if (shardCount > 1) {
+    fileName << ".shard-" << shardIndex << "-of-" << shardCount;
+  }
+  fileName << MANIFEST_FILE_EXTENSION;
+  return fileName.str();
+}
+
+static bool
+isManifestFileName(const std::string& fileName)
+{
+  const std::string stem(MANIFEST_FILE_STEM);
+  const std::string extension(MANIFEST_FILE_EXTENSION);
+  return (fileName.size() >= stem.size() + extension.size()) &&
+         (fileName.compare(0, stem.size(), stem) == 0) &&
+         (fileName.compare(fileName.size() - extension.size(),
+                           extension.size(), extension) == 0);
+}
+
+ConversionManifest::ConversionManifest(const fs::path& outputDirectoryPath,
+                                       uint32_t shardIndex,
+                                       uint32_t shardCount)
+  : manifestPath(outputDirectoryPath /
+                 getManifestFileName(shardIndex, shardCount))
+{}
+
+void
+ConversionManifest::load()
+{
+  scenes.clear();
+  otherScenes.clear();
+  readScenes(manifestPath, scenes);
+
+  // A scene converted by another shard, or before the dataset was split into
+  // another number of shards, is not converted again
+#if CMAKE_CXX_STANDARD >= 17
+  std::error_code error;
+#else
+  boost::system::error_code error;
+#endif
+  for (fs::directory_iterator it(manifestPath.parent_path(), error), end;
+       !error && (it != end); it.increment(error)) {
+    const fs::path& filePath = it->path();
+    if ((filePath.filename() != manifestPath.filename()) &&
+        isManifestFileName(filePath.filename().string())) {
+      readScenes(filePath, otherScenes);
+    }
+  }
+}
+
+void
+ConversionManifest::readScenes(const fs::path& filePath,
+                               std::map<std::string, SceneEntry>& scenes)
+{
+  std::ifstream file(filePath.string());
+  if (!file) {
+    return;
+  }
+  std::map<std::string, SceneEntry> fileScenes;
+  try {
+    const json::json manifest = json::json::parse(file);
+    if (manifest.at("format_version").get<uint32_t>() != MANIFEST_FORMAT_VERSION) {
+      return;
+    }
+    for (const auto& scene : manifest.at("scenes").items()) {
+      const json::json& value = scene.value();
+      SceneEntry entry;
+      entry.name = value.at("name").get<std::string>();
+      entry.fingerprint = value.at("fingerprint").get<std::string>();
+      entry.bagName = value.at("bag").get<std::string>();
+      entry.bagSize = value.at("bag_size").get<uint64_t>();
+      entry.complete = (value.at("status").get<std::string>() == "complete");
+      fileScenes.emplace(scene.key(), entry);
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "Warning: ignoring malformed manifest " << filePath.string()
+              << ": " << e.what() << std::endl;
+    return;
+  }
+  // A scene found in several sections is up to date if any completed it
+  for (const auto& scene : fileScenes) {
+    auto inserted = scenes.insert(scene);
+    if (!inserted.second && !inserted.first->second.complete) {
+      inserted.first->second = scene.second;
+    }
+  }
+}
+
+void
+ConversionManifest::save() const
+{
+  json::json sceneObject = json::json::object();
+  for (const auto& scene : scenes) {
+    const SceneEntry& entry = scene.second;
+    sceneObject[scene.first] = { { "name", entry.name },
+                                 { "fingerprint", entry.fingerprint },
+                                 { "bag", entry.bagName },
+                                 { "bag_size", entry.bagSize },
+                                 { "status", entry.complete ? "complete" : "failed" } };
+  }
+  const json::json manifest = { { "format_version", MANIFEST_FORMAT_VERSION },
+                                { "scenes", sceneObject } };
+
+  // A crash while writing leaves the previous manifest in place
+  const fs::path temporaryPath = manifestPath.string() + ".tmp";
+  {
+    std::ofstream file(temporaryPath.string());
+    file << manifest.dump(2) << std::endl;
+    if (!file) {
+      throw std::runtime_error("unable to write " + temporaryPath.string());
+    }
+  }
+  fs::rename(temporaryPath, manifestPath);
+}
+
+bool
+ConversionManifest::isUpToDate(const Token& sceneToken,
+                               const std::string& fingerprint,
+                               const fs::path& bagPath) const
+{
+  auto it = scenes.find(sceneToken.str());
+  if ((it != scenes.end()) && isEntryUpToDate(it->second, fingerprint, bagPath)) {
+    return true;
+  }
+  it = otherScenes.find(sceneToken.str());
+  return (it != otherScenes.end()) &&
+         isEntryUpToDate(it->second, fingerprint, bagPath);
+}
+
+bool
+ConversionManifest::isEntryUpToDate(const SceneEntry& entry,
+                                    const std::string& fingerprint,
+                                    const fs::path& bagPath)
+{
+  if (!entry.complete || (entry.fingerprint != fingerprint) ||
+      (entry.bagName != bagPath.filename().string())) {
+    return false;
+  }
+#if CMAKE_CXX_STANDARD >= 17
+  std::error_code error;
+#else
+  boost::system::error_code error;
+#endif
+  const auto bagSize = fs::file_size(bagPath, error);
+  return !error && (bagSize == entry.bagSize);
+}
+
+void
+ConversionManifest::setSceneResult(const Token& sceneToken,
+                                   const std::string& sceneName,
+                                   const std::string& fingerprint,
+                                   const fs::path& bagPath,
+                                   bool complete)
+{
+  SceneEntry& entry = scenes[sceneToken.str()];
+  entry.name = sceneName;
+  entry.fingerprint = fingerprint;
+  entry.bagName = bagPath.filename().string();
+  entry.bagSize = 0;
+  entry.complete = false;
+  if (complete) {
+#if CMAKE_CXX_STANDARD >= 17
+    std::error_code error;
+#else
+    boost::system::error_code error;
+#endif
+    const auto bagSize = fs::file_size(bagPath, error);
+    entry.bagSize = error ? 0 : bagSize;
+    entry.complete = !error;
+  }
+}
+
+// 64-bit FNV-1a, stable across platforms and standard libraries
+static uint64_t
+hashString(const std::string& str)
+{
+  uint64_t hash = 14695981039346656037ull;
+  for (const char c : str) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+static std::string
+joinList(const std::vector<std::string>& items)
+{
+  std::vector<std::string> sortedItems(items);
+  std::sort(sortedItems.begin(), sortedItems.end());
+  std::string list;
+  for (const auto& item : sortedItems) {
+    list += item + ",";
+  }
+  return list;
+}
+
+// The channels are selected whatever their case
+static std::vector<std::string>
+toLowerItems(const std::vector<std::string>& items)
+{
+  std::vector<std::string> lowerItems;
+  lowerItems.reserve(items.size());
+  for (const auto& item : items) {
+    lowerItems.push_back(toLower(item));
+  }
+  return lowerItems;
+}
+
+std::string
+makeConversionFingerprint(const fs::path& metaDataPath,
+                          const ConversionOptions& options)
+{
+  std::ostringstream description;
+  description << "layout=" << BAG_LAYOUT_VERSION << ";";
+
+  std::vector<std::string> tableStamps;
+  for (const auto& entry : fs::directory_iterator(metaDataPath)) {
+    const fs::path& filePath = entry.path();
+    struct stat fileStat;
+    if ((filePath.extension() != ".json") ||
+        (::stat(filePath.string().c_str(), &fileStat) != 0)) {
+      continue;
+    }
+    std::ostringstream tableStamp;
+    tableStamp << filePath.filename().string() << ":" << fileStat.st_size << ":"
+               << fileStat.st_mtim.tv_sec << "." << fileStat.st_mtim.tv_nsec;
+    tableStamps.push_back(tableStamp.str());
+  }
+  description << "tables=" << joinList(tableStamps) << ";";
+
+  description << "format=" << static_cast<int>(options.outputFormat)
+              << ";image=" << static_cast<int>(options.imageFormat)
+              << ";scale=" << options.imageScaleDenominator
+              << ";radar=" << static_cast<int>(options.radarFormat)
+              << ";compression=" << static_cast<int>(options.bagCompression)
+              << ";chunk=" << options.bagChunkThreshold
+              << ";channels=" << joinList(toLowerItems(options.channels))
+              << ";modalities=" << joinList(options.modalities)
+              << ";sweeps=" << options.lidarSweepNumber
+              << ";keyframes=" << options.keyFramesOnly
+              << ";time=" << options.timeRangeBegin << ":" << options.timeRangeEnd;
+
+  std::ostringstream fingerprint;
+  fingerprint << std::hex << std::setw(16) << std::setfill('0')
+              << hashString(description.str());
+  return fingerprint.str();
+}
+
+}
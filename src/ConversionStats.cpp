@@ -0,0 +1,222 @@
+#include "nuscenes2bag/ConversionStats.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <fstream>
+#include <stdexcept>
+
+namespace json = nlohmann;
+
+namespace nuscenes2bag {
+
+static const char* const STAGE_NAMES[] = { "camera_read",  "lidar_read",
+                                           "radar_read",   "read_ahead",
+                                           "ego_pose",     "boxes",
+                                           "lidar_sweeps", "bag_write" };
+
+static_assert(sizeof(STAGE_NAMES) / sizeof(STAGE_NAMES[0]) ==
+                static_cast<size_t>(ConversionStage::STAGE_NUMBER),
+              "a name is needed for every stage");
+
+const char*
+getStageName(ConversionStage stage)
+{
+  return STAGE_NAMES[static_cast<size_t>(stage)];
+}
+
+static double
+toSeconds(uint64_t nanoseconds)
+{
+  return static_cast<double>(nanoseconds) * 1e-9;
+}
+
+void
+StageStats::merge(const StageStats& other)
+{
+  count += other.count;
+  nanoseconds += other.nanoseconds;
+  bytesIn += other.bytesIn;
+  bytesOut += other.bytesOut;
+}
+
+static void
+mergeTable(StageStatsTable& table, const StageStatsTable& other)
+{
+  for (size_t i = 0; i < table.size(); ++i) {
+    table[i].merge(other[i]);
+  }
+}
+
+static json::json
+toJson(const StageStatsTable& table)
+{
+  json::json stages = json::json::object();
+  for (size_t i = 0; i < table.size(); ++i) {
+    const StageStats& stage = table[i];
+    if (stage.count == 0) {
+      continue;
+    }
+    const double seconds = toSeconds(stage.nanoseconds);
+    stages[STAGE_NAMES[i]] = {
+      { "count", stage.count },
+      { "seconds", seconds },
+      { "bytes_in", stage.bytesIn },
+      { "bytes_out", stage.bytesOut },
+      { "per_second", (seconds > 0) ? stage.count / seconds : 0.0 }
+    };
+  }
+  return stages;
+}
+
+// Distinguishes the instances in the thread local shard lookup, an address
+// could be reused by a later instance
+static std::atomic<uint64_t> nextInstanceId(1);
+
+ConversionStats::ConversionStats(size_t sceneNumber)
+  : instanceId(nextInstanceId++)
+  , scenes(sceneNumber)
+{}
+
+ConversionStats::~ConversionStats() = default;
+
+void
+ConversionStats::setMetaDataLoad(
+  const std::string& source,
+  double seconds,
+  const std::vector<std::pair<std::string, double>>& tableSeconds)
+{
+  metaDataSource = source;
+  metaDataSeconds = seconds;
+  metaDataTableSeconds = tableSeconds;
+}
+
+void
+ConversionStats::setScene(size_t sceneIndex,
+                          const std::string& token,
+                          const std::string& name)
+{
+  scenes[sceneIndex].token = token;
+  scenes[sceneIndex].name = name;
+}
+
+ConversionStats::ThreadShard&
+ConversionStats::threadShard()
+{
+  thread_local uint64_t shardInstanceId = 0;
+  thread_local ThreadShard* shard = nullptr;
+  if (shardInstanceId != instanceId) {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    shards.emplace_back(new ThreadShard());
+    shard = shards.back().get();
+    shard->scenes.resize(scenes.size());
+    shardInstanceId = instanceId;
+  }
+  return *shard;
+}
+
+void
+ConversionStats::record(size_t sceneIndex,
+                        ConversionStage stage,
+                        Clock::time_point start,
+                        uint64_t bytesIn,
+                        uint64_t bytesOut)
+{
+  const auto duration = Clock::now() - start;
+  StageStats& stageStats =
+    threadShard().scenes[sceneIndex][static_cast<size_t>(stage)];
+  stageStats.count++;
+  stageStats.nanoseconds +=
+    std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  stageStats.bytesIn += bytesIn;
+  stageStats.bytesOut += bytesOut;
+}
+
+void
+ConversionStats::setSceneResult(size_t sceneIndex,
+                                double seconds,
+                                const DecodePipeline::QueueStats& queueStats)
+{
+  scenes[sceneIndex].seconds = seconds;
+  scenes[sceneIndex].queueStats = queueStats;
+}
+
+void
+ConversionStats::setMemoryStats(const MemoryStats& stats)
+{
+  memoryStats = stats;
+}
+
+void
+ConversionStats::writeJson(const fs::path& filePath, double totalSeconds) const
+{
+  std::lock_guard<std::mutex> lock(shardsMutex);
+
+  json::json tables = json::json::object();
+  for (const auto& table : metaDataTableSeconds) {
+    tables[table.first] = table.second;
+  }
+
+  StageStatsTable total{};
+  std::vector<StageStatsTable> sceneTables(scenes.size(), StageStatsTable{});
+  json::json threads = json::json::array();
+  for (const auto& shard : shards) {
+    StageStatsTable threadTable{};
+    for (size_t i = 0; i < scenes.size(); ++i) {
+      mergeTable(threadTable, shard->scenes[i]);
+      mergeTable(sceneTables[i], shard->scenes[i]);
+    }
+    mergeTable(total, threadTable);
+    threads.push_back({ { "thread", threads.size() },
+                        { "stages", toJson(threadTable) } });
+  }
+
+  json::json sceneArray = json::json::array();
+  for (size_t i = 0; i < scenes.size(); ++i) {
+    const SceneEntry& scene = scenes[i];
+    const DecodePipeline::QueueStats& queue = scene.queueStats;
+    sceneArray.push_back(
+      { { "token", scene.token },
+        { "name", scene.name },
+        { "seconds", scene.seconds },
+        { "stages", toJson(sceneTables[i]) },
+        { "queue",
+          { { "max_depth", queue.maxDepth },
+            { "mean_depth",
+              (queue.samples > 0)
+                ? static_cast<double>(queue.depthSum) / queue.samples
+                : 0.0 },
+            { "writer_wait_seconds",
+              toSeconds(queue.writerWaitNanoseconds) } } } });
+  }
+
+  json::json memoryStages = json::json::object();
+  for (size_t i = 0; i < memoryStats.stagePeakBytes.size(); ++i) {
+    if (memoryStats.stagePeakBytes[i] > 0) {
+      memoryStages[STAGE_NAMES[i]] = { { "peak_bytes",
+                                         memoryStats.stagePeakBytes[i] } };
+    }
+  }
+
+  json::json report = {
+    { "metadata",
+      { { "source", metaDataSource },
+        { "seconds", metaDataSeconds },
+        { "tables", tables } } },
+    { "total", { { "seconds", totalSeconds }, { "stages", toJson(total) } } },
+    { "memory",
+      { { "limit_bytes", memoryStats.limitBytes },
+        { "peak_bytes", memoryStats.peakBytes },
+        { "stages", memoryStages } } },
+    { "scenes", sceneArray },
+    { "threads", threads }
+  };
+
+  std::ofstream file(filePath.string());
+  file << report.dump(2) << std::endl;
+  if (!file) {
+    throw std::runtime_error("unable to write " + filePath.string());
+  }
+}
+
+}
@@ -0,0 +1,251 @@
+#include "nuscenes2bag/DecodePipeline.hpp"
+#include "nuscenes2bag/MemoryBudget.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace nuscenes2bag {
+
+DecodePipeline::DecodePipeline(DecodeWorkerPool* workerPool,
+                               uint32_t maxInFlight,
+                               MemoryBudget* memoryBudget)
+  : workerPool(workerPool)
+  , maxInFlight(std::max<uint32_t>(maxInFlight, 1))
+  , memoryBudget(memoryBudget)
+{}
+
+void
+DecodePipeline::run(size_t taskNumber, const DecodeTask& decode)
+{
+  if (workerPool == nullptr) {
+    runSequential(taskNumber, decode);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    slots.assign(maxInFlight, Slot());
+    this->decode = &decode;
+    this->taskNumber = taskNumber;
+    nextToDecode = 0;
+    nextToWrite = 0;
+    activeDecodes = 0;
+    aborted = false;
+    queueStats = QueueStats();
+  }
+  workerPool->attach(this);
+
+  std::exception_ptr error;
+  for (size_t i = 0; i < taskNumber; ++i) {
+    WriteTask writeTask;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      Slot& slot = slots[i % maxInFlight];
+      const uint64_t depth = nextToDecode - nextToWrite;
+      queueStats.samples++;
+      queueStats.depthSum += depth;
+      queueStats.maxDepth = std::max(queueStats.maxDepth, depth);
+      if (!slot.ready) {
+        const auto waitStart = std::chrono::steady_clock::now();
+        slotReady.wait(lock, [&slot]() { return slot.ready; });
+        queueStats.writerWaitNanoseconds +=
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - waitStart)
+            .count();
+      }
+      error = slot.error;
+      writeTask = std::move(slot.writeTask);
+      slot = Slot();
+      nextToWrite++;
+    }
+    workerPool->notifyWork();
+
+    if (!error && writeTask) {
+      try {
+        writeTask();
+      } catch (...) {
+        error = std::current_exception();
+      }
+    }
+    if (memoryBudget != nullptr) {
+      // Releases the bytes held by the task, the workers waiting for the
+      // budget of any scene may claim again
+      writeTask = nullptr;
+      workerPool->notifyWork();
+    }
+    if (error) {
+      break;
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    aborted = true;
+  }
+  // Once detached no worker claims new tasks, wait for the ones in progress
+  workerPool->detach(this);
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    slotReady.wait(lock, [this]() { return activeDecodes == 0; });
+    slots.clear();
+    this->decode = nullptr;
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void
+DecodePipeline::runSequential(size_t taskNumber, const DecodeTask& decode)
+{
+  queueStats = QueueStats();
+  for (size_t i = 0; i < taskNumber; ++i) {
+    WriteTask writeTask = decode(i);
+    if (writeTask) {
+      writeTask();
+    }
+  }
+}
+
+bool
+DecodePipeline::tryClaim(size_t& taskIndex)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (aborted || (nextToDecode >= taskNumber) ||
+      (nextToDecode >= nextToWrite + maxInFlight)) {
+    return false;
+  }
+  if ((memoryBudget != nullptr) && (nextToDecode > nextToWrite) &&
+      memoryBudget->isExhausted()) {
+    return false;
+  }
+  taskIndex = nextToDecode++;
+  activeDecodes++;
+  return true;
+}
+
+void
+DecodePipeline::decodeClaimed(size_t taskIndex)
+{
+  Slot result;
+  try {
+    result.writeTask = (*decode)(taskIndex);
+  } catch (...) {
+    result.error = std::current_exception();
+  }
+  result.ready = true;
+
+  // Notify under the lock: as soon as it is released with activeDecodes == 0,
+  // run() may return and the pipeline may be destroyed
+  std::lock_guard<std::mutex> lock(mutex);
+  slots[taskIndex % maxInFlight] = std::move(result);
+  activeDecodes--;
+  slotReady.notify_all();
+}
+
+DecodeWorkerPool::DecodeWorkerPool(uint32_t workerNumber)
+{
+  workerNumber = std::max<uint32_t>(workerNumber, 1);
+  for (uint32_t i = 0; i < workerNumber; ++i) {
+    workers.emplace_back([this]() { workerLoop(); });
+  }
+}
+
+DecodeWorkerPool::~DecodeWorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  workAvailable.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void
+DecodeWorkerPool::post(Job job)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(std::move(job));
+  }
+  workAvailable.notify_one();
+}
+
+void
+DecodeWorkerPool::attach(DecodePipeline* pipeline)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pipelines.push_back(pipeline);
+  }
+  workAvailable.notify_all();
+}
+
+void
+DecodeWorkerPool::detach(DecodePipeline* pipeline)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  pipelines.erase(std::remove(pipelines.begin(), pipelines.end(), pipeline),
+                  pipelines.end());
+}
+
+void
+DecodeWorkerPool::notifyWork()
+{
+  // Taking the lock orders the notification after a worker that is about to
+  // wait has checked the pipelines
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+  }
+  workAvailable.notify_all();
+}
+
+bool
+DecodeWorkerPool::claimTask(DecodePipeline*& pipeline, size_t& taskIndex)
+{
+  // Round robin over the pipelines, so that every scene in progress gets
+  // decoding time
+  const size_t pipelineNumber = pipelines.size();
+  for (size_t i = 0; i < pipelineNumber; ++i) {
+    const size_t index = (nextPipeline + i) % pipelineNumber;
+    if (pipelines[index]->tryClaim(taskIndex)) {
+      pipeline = pipelines[index];
+      nextPipeline = (index + 1) % pipelineNumber;
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+DecodeWorkerPool::workerLoop()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    DecodePipeline* pipeline = nullptr;
+    size_t taskIndex = 0;
+    workAvailable.wait(lock, [&]() {
+      return !jobs.empty() || claimTask(pipeline, taskIndex) || stopping;
+    });
+    if (!jobs.empty() && (pipeline == nullptr)) {
+      Job job = std::move(jobs.front());
+      jobs.pop_front();
+      lock.unlock();
+      job();
+      lock.lock();
+      continue;
+    }
+    if (pipeline == nullptr) {
+      return;
+    }
+
+    lock.unlock();
+    pipeline->decodeClaimed(taskIndex);
+    lock.lock();
+  }
+}
+
+}
@@ -0,0 +1,100 @@
+#include "nuscenes2bag/EgoPoseStore.hpp"
+
+#include <Eigen/Geometry>
+
+#include <algorithm>
+#include <cassert>
+
+namespace nuscenes2bag {
+
+EgoPoseStore::EgoPoseStore(std::vector<EgoPoseInfo> egoPoses)
+{
+  // The ego_pose table is in no particular order
+  std::stable_sort(egoPoses.begin(),
+                   egoPoses.end(),
+                   [](const EgoPoseInfo& l, const EgoPoseInfo& r) {
+                     return l.timeStamp < r.timeStamp;
+                   });
+
+  tokens.reserve(egoPoses.size());
+  timeStamps.reserve(egoPoses.size());
+  for (auto& values : translations) {
+    values.reserve(egoPoses.size());
+  }
+  for (auto& values : rotations) {
+    values.reserve(egoPoses.size());
+  }
+  for (const EgoPoseInfo& egoPose : egoPoses) {
+    tokens.push_back(egoPose.token);
+    timeStamps.push_back(egoPose.timeStamp);
+    for (size_t i = 0; i < 3; ++i) {
+      translations[i].push_back(egoPose.translation[i]);
+    }
+    for (size_t i = 0; i < 4; ++i) {
+      rotations[i].push_back(egoPose.rotation[i]);
+    }
+  }
+}
+
+EgoPoseInfo
+EgoPoseStore::operator[](size_t index) const
+{
+  EgoPoseInfo egoPose;
+  egoPose.token = tokens[index];
+  egoPose.timeStamp = timeStamps[index];
+  for (size_t i = 0; i < 3; ++i) {
+    egoPose.translation[i] = translations[i][index];
+  }
+  for (size_t i = 0; i < 4; ++i) {
+    egoPose.rotation[i] = rotations[i][index];
+  }
+  return egoPose;
+}
+
+size_t
+EgoPoseStore::lowerBound(TimeStamp timeStamp) const
+{
+  return std::lower_bound(timeStamps.begin(), timeStamps.end(), timeStamp) -
+         timeStamps.begin();
+}
+
+EgoPoseInfo
+EgoPoseStore::interpolate(TimeStamp timeStamp) const
+{
+  assert(!empty());
+  const size_t next = lowerBound(timeStamp);
+  if ((next < size()) && (timeStamps[next] == timeStamp)) {
+    return (*this)[next];
+  }
+  if ((next == 0) || (next == size())) {
+    EgoPoseInfo egoPose = (*this)[(next == 0) ? 0 : next - 1];
+    egoPose.token = Token();
+    egoPose.timeStamp = timeStamp;
+    return egoPose;
+  }
+
+  const size_t prev = next - 1;
+  const double amount =
+    static_cast<double>(timeStamp - timeStamps[prev]) /
+    static_cast<double>(timeStamps[next] - timeStamps[prev]);
+
+  EgoPoseInfo egoPose;
+  egoPose.timeStamp = timeStamp;
+  for (size_t i = 0; i < 3; ++i) {
+    egoPose.translation[i] =
+      translations[i][prev] +
+      amount * (translations[i][next] - translations[i][prev]);
+  }
+  const Eigen::Quaterniond q0(
+    rotations[0][prev], rotations[1][prev], rotations[2][prev], rotations[3][prev]);
+  const Eigen::Quaterniond q1(
+    rotations[0][next], rotations[1][next], rotations[2][next], rotations[3][next]);
+  const Eigen::Quaterniond q = q0.slerp(amount, q1);
+  egoPose.rotation[0] = q.w();
+  egoPose.rotation[1] = q.x();
+  egoPose.rotation[2] = q.y();
+  egoPose.rotation[3] = q.z();
+  return egoPose;
+}
+
+}
@@ -23,7 +23,34 @@ FileProgress::addToProcessed(uint32_t processed)
 float
 FileProgress::getProgressPercentage()
 {
+  if (toProcessFiles == 0) {
+    return 1.0f;
+  }
   return ((double)processedFiles) / toProcessFiles;
 }
 
+void
+FileProgress::addFinishedScene(size_t sceneIndex)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    finishedScenes.push_back(sceneIndex);
+  }
+  sceneFinished.notify_all();
+}
+
+bool
+FileProgress::waitForFinishedScene(size_t& sceneIndex,
+                                   std::chrono::system_clock::time_point deadline)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  if (!sceneFinished.wait_until(
+        lock, deadline, [this]() { return !finishedScenes.empty(); })) {
+    return false;
+  }
+  sceneIndex = finishedScenes.front();
+  finishedScenes.pop_front();
+  return true;
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include "nuscenes2bag/FileReadAhead.hpp"
+#include "nuscenes2bag/MemoryBudget.hpp"
+#include "nuscenes2bag/utils.hpp"
+
+#include <algorithm>
+
+namespace nuscenes2bag {
+
+FileReadAhead::FileReadAhead(FileReadPool* pool,
+                             std::vector<std::string> filePaths,
+                             uint32_t depth,
+                             MemoryBudget* memoryBudget)
+  : pool(pool)
+  , filePaths(std::move(filePaths))
+  , depth(std::max<uint32_t>(depth, 1))
+  , memoryBudget(memoryBudget)
+  , entries(this->filePaths.size())
+{
+  if (pool != nullptr) {
+    pool->attach(this);
+  }
+}
+
+FileReadAhead::~FileReadAhead()
+{
+  if (pool == nullptr) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  // Once detached no thread claims new reads, wait for the ones in progress
+  pool->detach(this);
+  std::unique_lock<std::mutex> lock(mutex);
+  entryReady.wait(lock, [this]() { return activeReads == 0; });
+  if (memoryBudget != nullptr) {
+    // Read but never taken when a scene fails
+    for (const Entry& entry : entries) {
+      if (entry.state == State::READY) {
+        memoryBudget->release(ConversionStage::READ_AHEAD, entry.bytes.size());
+      }
+    }
+  }
+}
+
+std::vector<uint8_t>
+FileReadAhead::take(size_t index)
+{
+  std::vector<uint8_t> bytes;
+  std::exception_ptr error;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    Entry& entry = entries[index];
+    if (entry.state == State::PENDING) {
+      // The pool is behind (or absent), read it here rather than wait
+      entry.state = State::READING;
+      lock.unlock();
+      try {
+        readFileBytes(filePaths[index], bytes);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      lock.lock();
+    } else {
+      entryReady.wait(lock, [&entry]() { return entry.state == State::READY; });
+      if (memoryBudget != nullptr) {
+        memoryBudget->release(ConversionStage::READ_AHEAD, entry.bytes.size());
+      }
+      bytes = std::move(entry.bytes);
+      error = entry.error;
+    }
+    entry = Entry();
+    entry.state = State::TAKEN;
+    takenNumber++;
+  }
+  if (pool != nullptr) {
+    pool->notifyWork();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return bytes;
+}
+
+bool
+FileReadAhead::tryClaim(size_t& index)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  // Skip the files already taken by the consumers
+  while ((nextToRead < entries.size()) &&
+         (entries[nextToRead].state != State::PENDING)) {
+    nextToRead++;
+  }
+  if (stopping || (nextToRead >= entries.size()) ||
+      (nextToRead >= takenNumber + depth)) {
+    return false;
+  }
+  index = nextToRead++;
+  entries[index].state = State::READING;
+  activeReads++;
+  return true;
+}
+
+void
+FileReadAhead::readClaimed(size_t index)
+{
+  Entry result;
+  try {
+    readFileBytes(filePaths[index], result.bytes);
+  } catch (...) {
+    result.error = std::current_exception();
+  }
+  result.state = State::READY;
+  if (memoryBudget != nullptr) {
+    memoryBudget->charge(ConversionStage::READ_AHEAD, result.bytes.size());
+  }
+
+  // Notify under the lock: as soon as it is released with activeReads == 0,
+  // the read-ahead may be destroyed
+  std::lock_guard<std::mutex> lock(mutex);
+  entries[index] = std::move(result);
+  activeReads--;
+  entryReady.notify_all();
+}
+
+FileReadPool::FileReadPool(uint32_t threadNumber)
+{
+  threadNumber = std::max<uint32_t>(threadNumber, 1);
+  for (uint32_t i = 0; i < threadNumber; ++i) {
+    threads.emplace_back([this]() { threadLoop(); });
+  }
+}
+
+FileReadPool::~FileReadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  workAvailable.notify_all();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+void
+FileReadPool::attach(FileReadAhead* readAhead)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    readAheads.push_back(readAhead);
+  }
+  workAvailable.notify_all();
+}
+
+void
+FileReadPool::detach(FileReadAhead* readAhead)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  readAheads.erase(
+    std::remove(readAheads.begin(), readAheads.end(), readAhead),
+    readAheads.end());
+}
+
+void
+FileReadPool::notifyWork()
+{
+  // Taking the lock orders the notification after a thread that is about to
+  // wait has checked the read-aheads
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+  }
+  workAvailable.notify_all();
+}
+
+bool
+FileReadPool::claimRead(FileReadAhead*& readAhead, size_t& index)
+{
+  // Round robin over the scenes, like the decode workers
+  const size_t readAheadNumber = readAheads.size();
+  for (size_t i = 0; i < readAheadNumber; ++i) {
+    const size_t position = (nextReadAhead + i) % readAheadNumber;
+    if (readAheads[position]->tryClaim(index)) {
+      readAhead = readAheads[position];
+      nextReadAhead = (position + 1) % readAheadNumber;
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+FileReadPool::threadLoop()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    FileReadAhead* readAhead = nullptr;
+    size_t index = 0;
+    workAvailable.wait(lock, [&]() {
+      return claimRead(readAhead, index) || stopping;
+    });
+    if (readAhead == nullptr) {
+      return;
+    }
+
+    lock.unlock();
+    readAhead->readClaimed(index);
+    lock.lock();
+  }
+}
+
+}
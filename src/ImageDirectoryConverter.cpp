@@ -1,23 +1,154 @@
 #include "nuscenes2bag/ImageDirectoryConverter.hpp"
+#include "nuscenes2bag/BufferPool.hpp"
 #include "nuscenes2bag/utils.hpp"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
 #include <thread>
 
+extern "C" {
+#include <jpeglib.h>
+}
+
+#if CMAKE_CXX_STANDARD < 17
+#include <boost/make_shared.hpp>
+#endif
+
 namespace nuscenes2bag {
 
+// libjpeg reports errors through error_exit, which must not return. The
+// decoding steps jump back to where they started, as libjpeg can't be
+// unwound by a C++ exception.
+struct JpegErrorManager
+{
+  jpeg_error_mgr manager;
+  std::jmp_buf jump;
+};
+
+static void
+onJpegError(j_common_ptr cinfo)
+{
+  std::longjmp(reinterpret_cast<JpegErrorManager*>(cinfo->err)->jump, 1);
+}
+
+// Reads the header and starts decompressing to bgr8 at 1/scaleDenominator of
+// the image size. False on error, nothing with a destructor lives here.
+static bool
+startJpegDecompress(jpeg_decompress_struct& cinfo,
+                    JpegErrorManager& error,
+                    const std::vector<uint8_t>& bytes,
+                    uint32_t scaleDenominator)
+{
+  if (setjmp(error.jump)) {
+    return false;
+  }
+  jpeg_mem_src(&cinfo, const_cast<uint8_t*>(bytes.data()), bytes.size());
+  jpeg_read_header(&cinfo, TRUE);
+#ifdef JCS_EXTENSIONS
+  // libjpeg-turbo converts to bgr8 in its SIMD color conversion
+  cinfo.out_color_space = JCS_EXT_BGR;
+#else
+  cinfo.out_color_space = JCS_RGB;
+#endif
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = scaleDenominator;
+  jpeg_start_decompress(&cinfo);
+  return true;
+}
+
+// Decompresses the rows, step bytes apart, into data. False on error.
+static bool
+readJpegScanlines(jpeg_decompress_struct& cinfo,
+                  JpegErrorManager& error,
+                  uint8_t* data,
+                  size_t step)
+{
+  if (setjmp(error.jump)) {
+    return false;
+  }
+  const JDIMENSION maxRows = 16;
+  JSAMPROW rows[maxRows];
+  while (cinfo.output_scanline < cinfo.output_height) {
+    const JDIMENSION rowNumber =
+      std::min(maxRows, cinfo.output_height - cinfo.output_scanline);
+    for (JDIMENSION i = 0; i < rowNumber; ++i) {
+      rows[i] = data + (cinfo.output_scanline + i) * step;
+    }
+    jpeg_read_scanlines(&cinfo, rows, rowNumber);
+  }
+  jpeg_finish_decompress(&cinfo);
+  return true;
+}
+
+// Decodes the JPEG to bgr8 straight into a pooled message buffer
+static void
+decodeImage(const std::string& fileName,
+            const std::vector<uint8_t>& bytes,
+            uint32_t scaleDenominator,
+            sensor_msgs::Image& msg)
+{
+  jpeg_decompress_struct cinfo;
+  JpegErrorManager error;
+  cinfo.err = jpeg_std_error(&error.manager);
+  error.manager.error_exit = onJpegError;
+  jpeg_create_decompress(&cinfo);
+  struct DecompressGuard
+  {
+    jpeg_decompress_struct& cinfo;
+    ~DecompressGuard() { jpeg_destroy_decompress(&cinfo); }
+  } guard{ cinfo };
+
+  if (!startJpegDecompress(cinfo, error, bytes, scaleDenominator) ||
+      (cinfo.output_components != 3)) {
+    throw UnableToParseFileException(fileName);
+  }
+  msg.height = cinfo.output_height;
+  msg.width = cinfo.output_width;
+  msg.encoding = "bgr8";
+  msg.is_bigendian = false;
+  msg.step = cinfo.output_width * 3;
+  const size_t size = static_cast<size_t>(msg.step) * msg.height;
+  msg.data = getMessageBufferPool().acquire(size);
+  msg.data.resize(size);
+  if (!readJpegScanlines(cinfo, error, msg.data.data(), msg.step)) {
+    getMessageBufferPool().release(std::move(msg.data));
+    throw UnableToParseFileException(fileName);
+  }
+
+#ifndef JCS_EXTENSIONS
+  for (size_t i = 0; i < size; i += 3) {
+    std::swap(msg.data[i], msg.data[i + 2]);
+  }
+#endif
+}
+
 #if CMAKE_CXX_STANDARD >= 17
-std::optional<sensor_msgs::Image> readImageFile(const fs::path& filePath) noexcept
+std::optional<sensor_msgs::Image> readImageFile(const fs::path& filePath,
+                                                std::vector<uint8_t>* fileBytes,
+                                                uint32_t scaleDenominator) noexcept
 #else
-sensor_msgs::ImagePtr readImageFile(const fs::path& filePath) noexcept
+sensor_msgs::ImagePtr readImageFile(const fs::path& filePath,
+                                    std::vector<uint8_t>* fileBytes,
+                                    uint32_t scaleDenominator) noexcept
 #endif
 {
-  cv::Mat image;
+  // Only borrowed from the pool while decoding, like the radar files
+  std::vector<uint8_t> bytes;
   try {
-    image = imread(filePath.string().c_str(), cv::IMREAD_COLOR);
-    sensor_msgs::ImagePtr msg =
-    cv_bridge::CvImage(std_msgs::Header(), "bgr8", image).toImageMsg();
+    takeFileBytes(filePath.string(), fileBytes, bytes);
 
 #if CMAKE_CXX_STANDARD >= 17
-    return std::optional(*msg);
+    sensor_msgs::Image msg;
+    decodeImage(filePath.string(), bytes, scaleDenominator, msg);
+#else
+    sensor_msgs::ImagePtr msg = boost::make_shared<sensor_msgs::Image>();
+    decodeImage(filePath.string(), bytes, scaleDenominator, *msg);
+#endif
+    getMessageBufferPool().release(std::move(bytes));
+
+#if CMAKE_CXX_STANDARD >= 17
+    return std::optional(std::move(msg));
 #else
     return msg;
 #endif
@@ -25,6 +156,8 @@ sensor_msgs::ImagePtr readImageFile(const fs::path& filePath) noexcept
   } catch (const std::exception& e) {
     PRINT_EXCEPTION(e);
   }
+  // Given back on errors too, a corrupt file must not drain the pool
+  getMessageBufferPool().release(std::move(bytes));
 
 #if CMAKE_CXX_STANDARD >= 17
   return std::nullopt;
@@ -35,4 +168,36 @@ sensor_msgs::ImagePtr readImageFile(const fs::path& filePath) noexcept
 
 }
 
+#if CMAKE_CXX_STANDARD >= 17
+std::optional<sensor_msgs::CompressedImage> readCompressedImageFile(const fs::path& filePath,
+                                                                    std::vector<uint8_t>* fileBytes) noexcept
+#else
+sensor_msgs::CompressedImagePtr readCompressedImageFile(const fs::path& filePath,
+                                                        std::vector<uint8_t>* fileBytes) noexcept
+#endif
+{
+  try {
+    sensor_msgs::CompressedImage msg;
+    msg.format = "jpeg";
+    takeFileBytes(filePath.string(), fileBytes, msg.data);
+
+#if CMAKE_CXX_STANDARD >= 17
+    return std::optional(std::move(msg));
+#else
+    return boost::make_shared<sensor_msgs::CompressedImage>(msg);
+#endif
+
+  } catch (const std::exception& e) {
+    PRINT_EXCEPTION(e);
+  }
+
+#if CMAKE_CXX_STANDARD >= 17
+  return std::nullopt;
+#else
+  sensor_msgs::CompressedImagePtr empty_msg;
+  return empty_msg;
+#endif
+
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,293 @@
+#include "nuscenes2bag/JsonTableReader.hpp"
+#include "nuscenes2bag/MetaDataReader.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <fstream>
+#include <stdexcept>
+
+namespace json = nlohmann;
+
+namespace nuscenes2bag {
+
+void
+JsonRecord::clear()
+{
+  fieldNumber = 0;
+}
+
+JsonRecord::Field&
+JsonRecord::addField(std::string& key)
+{
+  if (fieldNumber == fields.size()) {
+    fields.emplace_back();
+  }
+  Field& field = fields[fieldNumber++];
+  field.key.swap(key);
+  field.type = FieldType::NONE;
+  field.numbers.clear();
+  return field;
+}
+
+const JsonRecord::Field*
+JsonRecord::findField(const char* key) const
+{
+  for (size_t i = 0; i < fieldNumber; ++i) {
+    if (fields[i].key == key) {
+      return &fields[i];
+    }
+  }
+  return nullptr;
+}
+
+const JsonRecord::Field&
+JsonRecord::getField(const char* key, FieldType type) const
+{
+  const Field* field = findField(key);
+  if (field == nullptr) {
+    throw InvalidMetaDataException(std::string("MetaDataError: missing key [") +
+                                   key + "]");
+  }
+  if (field->type != type) {
+    throw InvalidMetaDataException(
+      std::string("MetaDataError: unexpected type for key [") + key + "]");
+  }
+  return *field;
+}
+
+const std::string&
+JsonRecord::getString(const char* key) const
+{
+  return getField(key, FieldType::STRING).stringValue;
+}
+
+Token
+JsonRecord::getToken(const char* key) const
+{
+  try {
+    return Token::fromString(getString(key));
+  } catch (const std::invalid_argument& e) {
+    throw InvalidMetaDataException(std::string("MetaDataError: ") + e.what() +
+                                   " for key [" + key + "]");
+  }
+}
+
+uint64_t
+JsonRecord::getUnsigned(const char* key) const
+{
+  const Field* field = findField(key);
+  if ((field != nullptr) && (field->type == FieldType::INTEGER) &&
+      (field->integerValue >= 0)) {
+    return static_cast<uint64_t>(field->integerValue);
+  }
+  return getField(key, FieldType::UNSIGNED).unsignedValue;
+}
+
+double
+JsonRecord::getNumber(const char* key) const
+{
+  const Field* field = findField(key);
+  if (field != nullptr) {
+    switch (field->type) {
+      case FieldType::UNSIGNED:
+        return static_cast<double>(field->unsignedValue);
+      case FieldType::INTEGER:
+        return static_cast<double>(field->integerValue);
+      default:
+        break;
+    }
+  }
+  return getField(key, FieldType::FLOAT).floatValue;
+}
+
+bool
+JsonRecord::getBoolean(const char* key) const
+{
+  return getField(key, FieldType::BOOLEAN).booleanValue;
+}
+
+const std::vector<double>&
+JsonRecord::getNumbers(const char* key, size_t expectedSize) const
+{
+  const std::vector<double>& numbers = getField(key, FieldType::ARRAY).numbers;
+  if (numbers.size() != expectedSize) {
+    throw InvalidMetaDataException(
+      std::string("MetaDataError: unexpected array size for key [") + key +
+      "]");
+  }
+  return numbers;
+}
+
+namespace {
+
+// Depth 1 is the table array, depth 2 a record, deeper levels are values
+// nested inside a record field
+class TableSaxHandler : public json::json_sax<json::json>
+{
+public:
+  TableSaxHandler(const std::function<void(const JsonRecord&)>& onRecord)
+    : onRecord(onRecord)
+  {}
+
+  bool null() override
+  {
+    if (depth == RECORD_DEPTH) {
+      currentField().type = JsonRecord::FieldType::NONE;
+    }
+    return true;
+  }
+
+  bool boolean(bool val) override
+  {
+    if (depth == RECORD_DEPTH) {
+      auto& value = currentField();
+      value.type = JsonRecord::FieldType::BOOLEAN;
+      value.booleanValue = val;
+    }
+    return true;
+  }
+
+  bool number_integer(number_integer_t val) override
+  {
+    if (depth == RECORD_DEPTH) {
+      auto& value = currentField();
+      value.type = JsonRecord::FieldType::INTEGER;
+      value.integerValue = val;
+    } else if (depth > RECORD_DEPTH) {
+      currentField().numbers.push_back(static_cast<double>(val));
+    }
+    return true;
+  }
+
+  bool number_unsigned(number_unsigned_t val) override
+  {
+    if (depth == RECORD_DEPTH) {
+      auto& value = currentField();
+      value.type = JsonRecord::FieldType::UNSIGNED;
+      value.unsignedValue = val;
+    } else if (depth > RECORD_DEPTH) {
+      currentField().numbers.push_back(static_cast<double>(val));
+    }
+    return true;
+  }
+
+  bool number_float(number_float_t val, const string_t&) override
+  {
+    if (depth == RECORD_DEPTH) {
+      auto& value = currentField();
+      value.type = JsonRecord::FieldType::FLOAT;
+      value.floatValue = val;
+    } else if (depth > RECORD_DEPTH) {
+      currentField().numbers.push_back(val);
+    }
+    return true;
+  }
+
+  bool string(string_t& val) override
+  {
+    // Strings nested in arrays (e.g. attribute_tokens) are not used
+    if (depth == RECORD_DEPTH) {
+      auto& value = currentField();
+      value.type = JsonRecord::FieldType::STRING;
+      value.stringValue.swap(val);
+    }
+    return true;
+  }
+
+  bool start_object(std::size_t) override
+  {
+    depth++;
+    if (depth == RECORD_DEPTH) {
+      record.clear();
+      field = nullptr;
+    } else if (depth < RECORD_DEPTH) {
+      throw std::runtime_error("expected an array of objects");
+    }
+    return true;
+  }
+
+  bool key(string_t& val) override
+  {
+    if (depth == RECORD_DEPTH) {
+      field = &record.addField(val);
+    }
+    return true;
+  }
+
+  bool end_object() override
+  {
+    if (depth == RECORD_DEPTH) {
+      onRecord(record);
+      field = nullptr;
+    }
+    depth--;
+    return true;
+  }
+
+  bool start_array(std::size_t) override
+  {
+    depth++;
+    if (depth == RECORD_DEPTH + 1) {
+      currentField().type = JsonRecord::FieldType::ARRAY;
+    } else if (depth == RECORD_DEPTH) {
+      throw std::runtime_error("expected an array of objects");
+    }
+    return true;
+  }
+
+  bool end_array() override
+  {
+    depth--;
+    return true;
+  }
+
+  bool parse_error(std::size_t,
+                   const std::string&,
+                   const json::detail::exception& ex) override
+  {
+    throw std::runtime_error(ex.what());
+  }
+
+private:
+  JsonRecord::Field& currentField()
+  {
+    if (field == nullptr) {
+      throw std::runtime_error("value without key");
+    }
+    return *field;
+  }
+
+private:
+  static const int RECORD_DEPTH = 2;
+
+  const std::function<void(const JsonRecord&)>& onRecord;
+  JsonRecord record;
+  JsonRecord::Field* field = nullptr;
+  int depth = 0;
+};
+
+}
+
+void
+readJsonTable(const fs::path& filePath,
+              const std::function<void(const JsonRecord&)>& onRecord)
+{
+  std::ifstream file(filePath.string());
+  if (!file.is_open()) {
+    std::string errMsg = std::string("Unable to open ") + filePath.string();
+    throw std::runtime_error(errMsg);
+  }
+
+  TableSaxHandler handler(onRecord);
+  try {
+    json::json::sax_parse(file, &handler);
+  } catch (const InvalidMetaDataException& e) {
+    // Thrown by onRecord, which does not know the file
+    throw InvalidMetaDataException(filePath.string() + ": " + e.what());
+  } catch (const std::exception& e) {
+    throw InvalidMetaDataException(std::string("MetaDataError: unable to parse ") +
+                                   filePath.string() + ": " + e.what());
+  }
+}
+
+}
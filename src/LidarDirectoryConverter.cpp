@@ -1,13 +1,18 @@
 #include "nuscenes2bag/LidarDirectoryConverter.hpp"
 #include "nuscenes2bag/utils.hpp"
+#include <cstring>
 #include <exception>
 
+#if CMAKE_CXX_STANDARD < 17
+#include <boost/make_shared.hpp>
+#endif
+
 using namespace sensor_msgs;
 using namespace std;
 
 namespace nuscenes2bag {
 
-inline void fillFieldsForPointcloud(std::vector<PointField>& fields) {
+static void fillFieldsForPointcloud(std::vector<PointField>& fields) {
     PointField field;
     field.datatype = sensor_msgs::PointField::FLOAT32;
     field.offset = 0;
@@ -34,77 +39,62 @@ inline void fillFieldsForPointcloud(std::vector<PointField>& fields) {
     fields.push_back(field);
 }
 
-// Convert float32 to 4 bytes
-union {
-    float value;
-    uint8_t byte[4];
-} floatToBytes;
-
-inline void push_back_float32(std::vector<uint8_t>& data, float float_data) {
-
-  /*
-  // dereferencing type-punned pointer will break strict-aliasing rules
-  data.push_back((*reinterpret_cast<uint32_t*>(&float_data) >> 0) & 0xFF);
-  data.push_back((*reinterpret_cast<uint32_t*>(&float_data) >> 8) & 0xFF);
-  data.push_back((*reinterpret_cast<uint32_t*>(&float_data) >> 16) & 0xFF);
-  data.push_back((*reinterpret_cast<uint32_t*>(&float_data) >> 24) & 0xFF);
-  */
-
-  floatToBytes.value = float_data;
-  data.push_back(floatToBytes.byte[0]);
-  data.push_back(floatToBytes.byte[1]);
-  data.push_back(floatToBytes.byte[2]);
-  data.push_back(floatToBytes.byte[3]);
+// The field descriptors are built once and only read afterwards, so the
+// scenes converted in parallel share them without any synchronization
+static const std::vector<PointField>& pointcloudFields() {
+  static const std::vector<PointField> fields = [] {
+    std::vector<PointField> fields;
+    fillFieldsForPointcloud(fields);
+    return fields;
+  }();
+  return fields;
 }
 
-inline std::vector<float> readBinaryPcdFile(std::ifstream& fin) {
-  std::vector<float> fileValues;
-  uint8_t skipCounter = 0;
-  float f;
-  while (fin.read(reinterpret_cast<char*>(&f), sizeof(float))) {
-    // skip 5th value of each point
-    if (skipCounter < 4) {
-      fileValues.push_back(f);
-      skipCounter++;
-    } else {
-      skipCounter = 0;
-    }
+// Each point of a nuScenes .pcd.bin file is x, y, z, intensity, ring (float32)
+static const size_t FILE_POINT_STEP = sizeof(float) * 5;
+static const size_t CLOUD_POINT_STEP = sizeof(float) * 4;
+
+// Drops the 5th value of each point, compacting the buffer in place.
+// Sources are always ahead of destinations, so a forward pass is safe and
+// every iteration compiles down to one 16 byte load and store.
+static void compactPointsToXYZI(std::vector<uint8_t>& data) {
+  const size_t pointsNumber = data.size() / FILE_POINT_STEP;
+  uint8_t* bytes = data.data();
+  for (size_t i = 0; i < pointsNumber; ++i) {
+    float point[4];
+    std::memcpy(point, bytes + i * FILE_POINT_STEP, CLOUD_POINT_STEP);
+    std::memcpy(bytes + i * CLOUD_POINT_STEP, point, CLOUD_POINT_STEP);
   }
-
-  return fileValues;
+  data.resize(pointsNumber * CLOUD_POINT_STEP);
 }
 
 #if CMAKE_CXX_STANDARD >= 17
-std::optional<sensor_msgs::PointCloud2> readLidarFile(const fs::path& filePath)
+std::optional<sensor_msgs::PointCloud2> readLidarFile(const fs::path& filePath,
+                                                      std::vector<uint8_t>* fileBytes)
 #else
-sensor_msgs::PointCloud2Ptr readLidarFile(const fs::path& filePath)
+sensor_msgs::PointCloud2Ptr readLidarFile(const fs::path& filePath,
+                                          std::vector<uint8_t>* fileBytes)
 #endif
 {
 
   PointCloud2 cloud;
   cloud.header.frame_id = std::string("lidar");
   cloud.is_bigendian = false;
-  cloud.point_step = sizeof(float) * 4; // Length of each point in bytes
+  cloud.point_step = CLOUD_POINT_STEP; // Length of each point in bytes
   cloud.height = 1;
 
   try {
-    std::ifstream fin(filePath.string(), std::ios::binary);
-    const std::vector<float> fileValues = readBinaryPcdFile(fin);
+    // The file is read straight into the message buffer, then compacted
+    takeFileBytes(filePath.string(), fileBytes, cloud.data);
 
-    if(fileValues.size() % 4 != 0) {
+    if(cloud.data.size() % FILE_POINT_STEP != 0) {
       throw UnableToParseFileException(filePath.string());
     }
-    const size_t pointsNumber = fileValues.size() / 4;
-    cloud.width = pointsNumber;
-
-    std::vector<uint8_t> data;
-    for (auto float_data : fileValues) {
-      push_back_float32(data, float_data);
-    }
+    compactPointsToXYZI(cloud.data);
+    cloud.width = cloud.data.size() / CLOUD_POINT_STEP;
 
-    fillFieldsForPointcloud(cloud.fields);
-    cloud.data = data;
-    cloud.row_step = data.size(); // Length of row in bytes
+    cloud.fields = pointcloudFields();
+    cloud.row_step = cloud.data.size(); // Length of row in bytes
 
   } catch (const std::exception& e) {
     PRINT_EXCEPTION(e);
@@ -119,7 +109,7 @@ sensor_msgs::PointCloud2Ptr readLidarFile(const fs::path& filePath)
   }
 
 #if CMAKE_CXX_STANDARD >= 17
-  return std::optional(cloud);
+  return std::optional(std::move(cloud));
 #else
   return boost::make_shared<sensor_msgs::PointCloud2>(cloud);
 #endif
@@ -2,12 +2,16 @@
 #include "nuscenes2bag/utils.hpp"
 #include <exception>
 
+#if CMAKE_CXX_STANDARD < 17
+#include <boost/make_shared.hpp>
+#endif
+
 using namespace sensor_msgs;
 using namespace std;
 
 namespace nuscenes2bag {
 
-inline void fillFieldsForPointcloudXYZIR(std::vector<PointField>& fields) {
+static void fillFieldsForPointcloudXYZIR(std::vector<PointField>& fields) {
     PointField field;
     field.datatype = sensor_msgs::PointField::FLOAT32;
     field.offset = 0;
@@ -42,29 +46,20 @@ inline void fillFieldsForPointcloudXYZIR(std::vector<PointField>& fields) {
     fields.push_back(field);
 }
 
-// Convert float32 to 4 bytes
-union {
-    float value;
-    uint8_t byte[4];
-} floatToBytes;
-
-inline void push_back_float32_XYZIR(std::vector<uint8_t>& data, float float_data) {
-  floatToBytes.value = float_data;
-  data.push_back(floatToBytes.byte[0]);
-  data.push_back(floatToBytes.byte[1]);
-  data.push_back(floatToBytes.byte[2]);
-  data.push_back(floatToBytes.byte[3]);
+// The field descriptors are built once and only read afterwards, so the
+// scenes converted in parallel share them without any synchronization
+static const std::vector<PointField>& pointcloudFieldsXYZIR() {
+  static const std::vector<PointField> fields = [] {
+    std::vector<PointField> fields;
+    fillFieldsForPointcloudXYZIR(fields);
+    return fields;
+  }();
+  return fields;
 }
 
-inline std::vector<float> readBinaryPcdFileXYZIR(std::ifstream& fin) {
-  std::vector<float> fileValues;
-  float f;
-  while (fin.read(reinterpret_cast<char*>(&f), sizeof(float))) {
-      fileValues.push_back(f);
-  }
-
-  return fileValues;
-}
+// Each point of a nuScenes .pcd.bin file is x, y, z, intensity, ring (float32),
+// which is already the layout of the published pointcloud
+static const size_t POINT_STEP = sizeof(float) * 5;
 
 #if CMAKE_CXX_STANDARD >= 17
 std::optional<sensor_msgs::PointCloud2> readLidarFileXYZIR(const fs::path& filePath)
@@ -76,27 +71,19 @@ sensor_msgs::PointCloud2Ptr readLidarFileXYZIR(const fs::path& filePath)
   PointCloud2 cloud;
   cloud.header.frame_id = std::string("lidar");
   cloud.is_bigendian = false;
-  cloud.point_step = sizeof(float) * 5; // Length of each point in bytes
+  cloud.point_step = POINT_STEP; // Length of each point in bytes
   cloud.height = 1;
 
   try {
-    std::ifstream fin(filePath.string(), std::ios::binary);
-    const std::vector<float> fileValues = readBinaryPcdFileXYZIR(fin);
+    readFileBytes(filePath.string(), cloud.data);
 
-    if(fileValues.size() % 5 != 0) {
+    if(cloud.data.size() % POINT_STEP != 0) {
       throw UnableToParseFileException(filePath.string());
     }
-    const size_t pointsNumber = fileValues.size() / 5;
-    cloud.width = pointsNumber;
-
-    std::vector<uint8_t> data;
-    for (auto float_data : fileValues) {
-      push_back_float32_XYZIR(data, float_data);
-    }
+    cloud.width = cloud.data.size() / POINT_STEP;
 
-    fillFieldsForPointcloudXYZIR(cloud.fields);
-    cloud.data = data;
-    cloud.row_step = data.size(); // Length of row in bytes
+    cloud.fields = pointcloudFieldsXYZIR();
+    cloud.row_step = cloud.data.size(); // Length of row in bytes
 
   } catch (const std::exception& e) {
     PRINT_EXCEPTION(e);
@@ -111,7 +98,7 @@ sensor_msgs::PointCloud2Ptr readLidarFileXYZIR(const fs::path& filePath)
   }
 
 #if CMAKE_CXX_STANDARD >= 17
-  return std::optional(cloud);
+  return std::optional(std::move(cloud));
 #else
   return boost::make_shared<sensor_msgs::PointCloud2>(cloud);
 #endif
@@ -0,0 +1,189 @@
+#include "nuscenes2bag/LidarSweepAccumulator.hpp"
+#include "nuscenes2bag/BufferPool.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace sensor_msgs;
+
+namespace nuscenes2bag {
+
+// Layout of the readLidarFile clouds, and of the accumulated ones
+static const size_t SWEEP_POINT_STEP = sizeof(float) * 4;
+static const size_t ACCUMULATED_POINT_STEP = sizeof(float) * 5;
+
+static const std::vector<PointField>&
+accumulatedFields()
+{
+  static const std::vector<PointField> fields = [] {
+    std::vector<PointField> fields;
+    const char* const names[] = { "x", "y", "z", "intensity", "time_lag" };
+    for (size_t i = 0; i < 5; ++i) {
+      PointField field;
+      field.name = names[i];
+      field.offset = static_cast<uint32_t>(i * sizeof(float));
+      field.datatype = PointField::FLOAT32;
+      field.count = 1;
+      fields.push_back(field);
+    }
+    return fields;
+  }();
+  return fields;
+}
+
+Pose3d
+makePose(const double translation[3], const double rotation[4])
+{
+  Pose3d pose = Pose3d::Identity();
+  pose.translate(Eigen::Vector3d(translation[0], translation[1], translation[2]));
+  pose.rotate(
+    Eigen::Quaterniond(rotation[0], rotation[1], rotation[2], rotation[3])
+      .normalized());
+  return pose;
+}
+
+void
+transformPoints(const float m[12], size_t n, float* x, float* y, float* z)
+{
+  // Copied to locals, the compiler can't assume m is not written through
+  // the point arrays
+  const float m00 = m[0], m01 = m[1], m02 = m[2], m03 = m[3];
+  const float m10 = m[4], m11 = m[5], m12 = m[6], m13 = m[7];
+  const float m20 = m[8], m21 = m[9], m22 = m[10], m23 = m[11];
+  for (size_t i = 0; i < n; ++i) {
+    const float px = x[i];
+    const float py = y[i];
+    const float pz = z[i];
+    x[i] = m00 * px + m01 * py + m02 * pz + m03;
+    y[i] = m10 * px + m11 * py + m12 * pz + m13;
+    z[i] = m20 * px + m21 * py + m22 * pz + m23;
+  }
+}
+
+LidarSweep
+makeLidarSweep(const PointCloud2& cloud,
+               TimeStamp timeStamp,
+               const Pose3d& lidarToGlobal)
+{
+  LidarSweep sweep;
+  sweep.timeStamp = timeStamp;
+  sweep.lidarToGlobal = lidarToGlobal;
+
+  const size_t pointNumber = cloud.data.size() / SWEEP_POINT_STEP;
+  sweep.x.resize(pointNumber);
+  sweep.y.resize(pointNumber);
+  sweep.z.resize(pointNumber);
+  sweep.intensity.resize(pointNumber);
+  const uint8_t* bytes = cloud.data.data();
+  for (size_t i = 0; i < pointNumber; ++i) {
+    float point[4];
+    std::memcpy(point, bytes + i * SWEEP_POINT_STEP, SWEEP_POINT_STEP);
+    sweep.x[i] = point[0];
+    sweep.y[i] = point[1];
+    sweep.z[i] = point[2];
+    sweep.intensity[i] = point[3];
+  }
+  return sweep;
+}
+
+LidarSweepAccumulator::LidarSweepAccumulator(uint32_t sweepNumber,
+                                             MemoryBudget* memoryBudget)
+  : sweepNumber(std::max<uint32_t>(sweepNumber, 1))
+  , memoryBudget(memoryBudget)
+{}
+
+LidarSweepAccumulator::~LidarSweepAccumulator()
+{
+  if (memoryBudget != nullptr) {
+    memoryBudget->release(ConversionStage::LIDAR_SWEEPS, keptBytes);
+  }
+}
+
+// x, y, z and intensity, as in the cloud it was made from
+static uint64_t
+getSweepBytes(const LidarSweep& sweep)
+{
+  return sweep.size() * SWEEP_POINT_STEP;
+}
+
+void
+LidarSweepAccumulator::addSweep(LidarSweep&& sweep)
+{
+  const uint64_t addedBytes = getSweepBytes(sweep);
+  uint64_t droppedBytes = 0;
+  if (sweeps.size() < sweepNumber) {
+    sweeps.push_back(std::move(sweep));
+    nextSweep = sweeps.size() % sweepNumber;
+  } else {
+    droppedBytes = getSweepBytes(sweeps[nextSweep]);
+    sweeps[nextSweep] = std::move(sweep);
+    nextSweep = (nextSweep + 1) % sweepNumber;
+  }
+
+  keptBytes += addedBytes - droppedBytes;
+  if (memoryBudget != nullptr) {
+    memoryBudget->charge(ConversionStage::LIDAR_SWEEPS, addedBytes);
+    memoryBudget->release(ConversionStage::LIDAR_SWEEPS, droppedBytes);
+  }
+}
+
+void
+LidarSweepAccumulator::accumulate(PointCloud2& cloud)
+{
+  size_t pointNumber = 0;
+  for (const auto& sweep : sweeps) {
+    pointNumber += sweep.size();
+  }
+
+  cloud.fields = accumulatedFields();
+  cloud.is_bigendian = false;
+  cloud.is_dense = true;
+  cloud.point_step = ACCUMULATED_POINT_STEP;
+  cloud.height = 1;
+  cloud.width = static_cast<uint32_t>(pointNumber);
+  cloud.row_step = static_cast<uint32_t>(pointNumber * ACCUMULATED_POINT_STEP);
+  cloud.data = getMessageBufferPool().acquire(cloud.row_step);
+  cloud.data.resize(cloud.row_step);
+  if (sweeps.empty()) {
+    return;
+  }
+
+  const size_t latestIndex = (nextSweep + sweeps.size() - 1) % sweeps.size();
+  const LidarSweep& latest = sweeps[latestIndex];
+  const Pose3d globalToLatest = latest.lidarToGlobal.inverse();
+
+  uint8_t* out = cloud.data.data();
+  for (size_t i = 0; i < sweeps.size(); ++i) {
+    const LidarSweep& sweep =
+      sweeps[(latestIndex + sweeps.size() - i) % sweeps.size()];
+    const size_t n = sweep.size();
+
+    // Relative transforms are small, float precision is enough once the
+    // global coordinates cancel out
+    const Eigen::Matrix4d relative = (globalToLatest * sweep.lidarToGlobal).matrix();
+    float m[12];
+    for (int row = 0; row < 3; ++row) {
+      for (int col = 0; col < 4; ++col) {
+        m[row * 4 + col] = static_cast<float>(relative(row, col));
+      }
+    }
+    // The kept sweep is left as decoded, it is transformed again for the
+    // next ones
+    transformedX.assign(sweep.x.begin(), sweep.x.end());
+    transformedY.assign(sweep.y.begin(), sweep.y.end());
+    transformedZ.assign(sweep.z.begin(), sweep.z.end());
+    transformPoints(m, n, transformedX.data(), transformedY.data(),
+                    transformedZ.data());
+
+    const float timeLag = static_cast<float>(
+      (static_cast<double>(latest.timeStamp) - static_cast<double>(sweep.timeStamp)) * 1e-6);
+    for (size_t j = 0; j < n; ++j) {
+      const float point[5] = { transformedX[j], transformedY[j],
+                               transformedZ[j], sweep.intensity[j], timeLag };
+      std::memcpy(out, point, ACCUMULATED_POINT_STEP);
+      out += ACCUMULATED_POINT_STEP;
+    }
+  }
+}
+
+}
@@ -0,0 +1,451 @@
+#include "nuscenes2bag/McapWriter.hpp"
+#include "nuscenes2bag/DecodePipeline.hpp"
+
+#include <roslz4/lz4s.h>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace nuscenes2bag {
+
+namespace {
+
+typedef std::vector<uint8_t> Bytes;
+
+const uint8_t MAGIC[] = { 0x89, 'M', 'C', 'A', 'P', '0', '\r', '\n' };
+
+enum Opcode : uint8_t
+{
+  HEADER = 0x01,
+  FOOTER = 0x02,
+  SCHEMA = 0x03,
+  CHANNEL = 0x04,
+  MESSAGE = 0x05,
+  CHUNK = 0x06,
+  MESSAGE_INDEX = 0x07,
+  CHUNK_INDEX = 0x08,
+  STATISTICS = 0x0B,
+  SUMMARY_OFFSET = 0x0E,
+  DATA_END = 0x0F
+};
+
+// Same block size as the LZ4 chunks of rosbag (256 KiB)
+const int LZ4_BLOCK_SIZE_ID = 6;
+const uint64_t LZ4_BLOCK_SIZE = 256 * 1024;
+
+const uint64_t NO_TIME = std::numeric_limits<uint64_t>::max();
+
+// MCAP integers are little endian
+template<typename T>
+void
+appendInt(Bytes& out, T value)
+{
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    out.push_back(static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i)));
+  }
+}
+
+void
+setInt(Bytes& out, size_t position, uint64_t value, size_t size)
+{
+  for (size_t i = 0; i < size; ++i) {
+    out[position + i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+void
+appendString(Bytes& out, const std::string& str)
+{
+  appendInt<uint32_t>(out, static_cast<uint32_t>(str.size()));
+  out.insert(out.end(), str.begin(), str.end());
+}
+
+// Appends the opcode and a length filled in by endRecord, returns the start
+// of the record
+size_t
+beginRecord(Bytes& out, Opcode opcode)
+{
+  const size_t start = out.size();
+  out.push_back(opcode);
+  appendInt<uint64_t>(out, 0);
+  return start;
+}
+
+void
+endRecord(Bytes& out, size_t start)
+{
+  setInt(out, start + 1, out.size() - start - 9, sizeof(uint64_t));
+}
+
+// Same for the byte length prefix of maps and arrays
+size_t
+beginLengthPrefix(Bytes& out)
+{
+  const size_t start = out.size();
+  appendInt<uint32_t>(out, 0);
+  return start;
+}
+
+void
+endLengthPrefix(Bytes& out, size_t start)
+{
+  setInt(out, start, out.size() - start - 4, sizeof(uint32_t));
+}
+
+}
+
+McapWriter::McapWriter(const fs::path& path,
+                       McapCompression compression,
+                       uint32_t chunkThreshold,
+                       DecodeWorkerPool* workerPool)
+  : path(path.string())
+  , compression(compression)
+  , chunkThreshold(chunkThreshold)
+  , workerPool(workerPool)
+  , file(path.string(), std::ios::binary | std::ios::trunc)
+  , messageStartTime(NO_TIME)
+  , chunkStartTime(NO_TIME)
+{
+  if (!file) {
+    throw std::runtime_error("Unable to create " + this->path);
+  }
+  writeToFile(MAGIC, sizeof(MAGIC));
+
+  recordBuffer.clear();
+  const size_t start = beginRecord(recordBuffer, HEADER);
+  appendString(recordBuffer, "ros1");
+  appendString(recordBuffer, "nuscenes2bag");
+  endRecord(recordBuffer, start);
+  writeToFile(recordBuffer);
+}
+
+McapWriter::~McapWriter()
+{
+  // The worker uses the pending chunk
+  std::unique_lock<std::mutex> lock(compressionMutex);
+  compressionDone.wait(lock, [this]() { return !compressing; });
+}
+
+uint16_t
+McapWriter::getChannelId(const std::string& topicName,
+                         const char* dataType,
+                         const char* md5Sum,
+                         const char* definition,
+                         bool latched)
+{
+  auto channelIt = channelIds.find(topicName);
+  if (channelIt != channelIds.end()) {
+    return channelIt->second;
+  }
+
+  // The records are in the chunk of the first message using them
+  auto schemaIt = schemaIds.find(dataType);
+  if (schemaIt == schemaIds.end()) {
+    // 0 means no schema
+    const uint16_t schemaId = static_cast<uint16_t>(schemaIds.size() + 1);
+    schemaIt = schemaIds.emplace(dataType, schemaId).first;
+
+    recordBuffer.clear();
+    const size_t start = beginRecord(recordBuffer, SCHEMA);
+    appendInt<uint16_t>(recordBuffer, schemaId);
+    appendString(recordBuffer, dataType);
+    appendString(recordBuffer, "ros1msg");
+    appendString(recordBuffer, definition);
+    endRecord(recordBuffer, start);
+    schemaRecords.insert(schemaRecords.end(), recordBuffer.begin(), recordBuffer.end());
+    chunkRecords.insert(chunkRecords.end(), recordBuffer.begin(), recordBuffer.end());
+  }
+
+  const uint16_t channelId = static_cast<uint16_t>(channelIds.size());
+  channelIds.emplace(topicName, channelId);
+  channelMessageCounts.push_back(0);
+  chunkMessageIndices.emplace_back();
+
+  recordBuffer.clear();
+  const size_t start = beginRecord(recordBuffer, CHANNEL);
+  appendInt<uint16_t>(recordBuffer, channelId);
+  appendInt<uint16_t>(recordBuffer, schemaIt->second);
+  appendString(recordBuffer, topicName);
+  appendString(recordBuffer, "ros1");
+  const size_t metadataStart = beginLengthPrefix(recordBuffer);
+  appendString(recordBuffer, "md5sum");
+  appendString(recordBuffer, md5Sum);
+  if (latched) {
+    appendString(recordBuffer, "latching");
+    appendString(recordBuffer, "1");
+  }
+  endLengthPrefix(recordBuffer, metadataStart);
+  endRecord(recordBuffer, start);
+  channelRecords.insert(channelRecords.end(), recordBuffer.begin(), recordBuffer.end());
+  chunkRecords.insert(chunkRecords.end(), recordBuffer.begin(), recordBuffer.end());
+
+  return channelId;
+}
+
+uint8_t*
+McapWriter::addMessage(uint16_t channelId, uint64_t logTime, uint32_t size)
+{
+  messageStartTime = std::min(messageStartTime, logTime);
+  messageEndTime = std::max(messageEndTime, logTime);
+  chunkStartTime = std::min(chunkStartTime, logTime);
+  chunkEndTime = std::max(chunkEndTime, logTime);
+  const uint32_t sequence = static_cast<uint32_t>(channelMessageCounts[channelId]++);
+  messageCount++;
+
+  chunkMessageIndices[channelId].emplace_back(logTime, chunkRecords.size());
+  chunkRecords.push_back(MESSAGE);
+  appendInt<uint64_t>(chunkRecords, 2 + 4 + 8 + 8 + static_cast<uint64_t>(size));
+  appendInt<uint16_t>(chunkRecords, channelId);
+  appendInt<uint32_t>(chunkRecords, sequence);
+  // Log and publish time
+  appendInt<uint64_t>(chunkRecords, logTime);
+  appendInt<uint64_t>(chunkRecords, logTime);
+  chunkRecords.resize(chunkRecords.size() + size);
+  return chunkRecords.data() + chunkRecords.size() - size;
+}
+
+void
+McapWriter::writeChunk()
+{
+  if (chunkRecords.empty()) {
+    return;
+  }
+  waitPendingChunk();
+  writePendingChunk();
+
+  pendingChunk.records.swap(chunkRecords);
+  pendingChunk.startTime = chunkStartTime;
+  pendingChunk.endTime = chunkEndTime;
+  // The entries of the swapped indices were cleared once written
+  pendingChunk.messageIndices.swap(chunkMessageIndices);
+  chunkMessageIndices.resize(channelIds.size());
+  hasPendingChunk = true;
+  chunkRecords.clear();
+  chunkStartTime = NO_TIME;
+  chunkEndTime = 0;
+
+  if ((compression == McapCompression::NONE) || (workerPool == nullptr)) {
+    compressPendingChunk();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(compressionMutex);
+    compressing = true;
+  }
+  workerPool->post([this]() {
+    std::exception_ptr error;
+    try {
+      compressPendingChunk();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    // Notify under the lock: once released, the writer may be destroyed
+    std::lock_guard<std::mutex> lock(compressionMutex);
+    compressionError = error;
+    compressing = false;
+    compressionDone.notify_all();
+  });
+}
+
+void
+McapWriter::compressPendingChunk()
+{
+  pendingChunk.compressedSize = 0;
+  if (compression != McapCompression::LZ4) {
+    return;
+  }
+  const uint64_t uncompressedSize = pendingChunk.records.size();
+  // Worst case of incompressible blocks, with the frame and block headers
+  unsigned int compressedSize = static_cast<unsigned int>(
+    uncompressedSize + uncompressedSize / 255 +
+    32 * (uncompressedSize / LZ4_BLOCK_SIZE + 1) + 64);
+  pendingChunk.compressedRecords.resize(compressedSize);
+  // Left uncompressed if the bound was still too small
+  if (roslz4_buffToBuffCompress(
+        reinterpret_cast<char*>(pendingChunk.records.data()),
+        static_cast<unsigned int>(uncompressedSize),
+        reinterpret_cast<char*>(pendingChunk.compressedRecords.data()),
+        &compressedSize,
+        LZ4_BLOCK_SIZE_ID) == ROSLZ4_OK) {
+    pendingChunk.compressedSize = compressedSize;
+  }
+}
+
+void
+McapWriter::waitPendingChunk()
+{
+  std::unique_lock<std::mutex> lock(compressionMutex);
+  compressionDone.wait(lock, [this]() { return !compressing; });
+  if (compressionError) {
+    std::exception_ptr error = compressionError;
+    compressionError = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+void
+McapWriter::writePendingChunk()
+{
+  if (!hasPendingChunk) {
+    return;
+  }
+  hasPendingChunk = false;
+
+  const uint64_t uncompressedSize = pendingChunk.records.size();
+  const uint8_t* records = pendingChunk.records.data();
+  uint64_t recordsSize = uncompressedSize;
+  std::string compressionName;
+  if (pendingChunk.compressedSize > 0) {
+    records = pendingChunk.compressedRecords.data();
+    recordsSize = pendingChunk.compressedSize;
+    compressionName = "lz4";
+  }
+  // A chunk may only hold the channels of a message written in the next one
+  const uint64_t startTime =
+    (pendingChunk.startTime != NO_TIME) ? pendingChunk.startTime : 0;
+  const uint64_t endTime =
+    (pendingChunk.startTime != NO_TIME) ? pendingChunk.endTime : 0;
+
+  // The CRCs are 0, which means not computed
+  const uint64_t chunkStart = filePosition;
+  recordBuffer.clear();
+  recordBuffer.push_back(CHUNK);
+  appendInt<uint64_t>(recordBuffer,
+                      8 + 8 + 8 + 4 + 4 + compressionName.size() + 8 + recordsSize);
+  appendInt<uint64_t>(recordBuffer, startTime);
+  appendInt<uint64_t>(recordBuffer, endTime);
+  appendInt<uint64_t>(recordBuffer, uncompressedSize);
+  appendInt<uint32_t>(recordBuffer, 0);
+  appendString(recordBuffer, compressionName);
+  appendInt<uint64_t>(recordBuffer, recordsSize);
+  writeToFile(recordBuffer);
+  writeToFile(records, recordsSize);
+  const uint64_t chunkLength = filePosition - chunkStart;
+
+  // The message index of each channel follows the chunk, the chunk index
+  // points to them
+  const uint64_t messageIndexStart = filePosition;
+  const size_t chunkIndexStart = beginRecord(chunkIndexRecords, CHUNK_INDEX);
+  appendInt<uint64_t>(chunkIndexRecords, startTime);
+  appendInt<uint64_t>(chunkIndexRecords, endTime);
+  appendInt<uint64_t>(chunkIndexRecords, chunkStart);
+  appendInt<uint64_t>(chunkIndexRecords, chunkLength);
+  const size_t offsetsStart = beginLengthPrefix(chunkIndexRecords);
+  recordBuffer.clear();
+  for (size_t channelId = 0; channelId < pendingChunk.messageIndices.size(); ++channelId) {
+    auto& entries = pendingChunk.messageIndices[channelId];
+    if (entries.empty()) {
+      continue;
+    }
+    appendInt<uint16_t>(chunkIndexRecords, static_cast<uint16_t>(channelId));
+    appendInt<uint64_t>(chunkIndexRecords, messageIndexStart + recordBuffer.size());
+
+    const size_t start = beginRecord(recordBuffer, MESSAGE_INDEX);
+    appendInt<uint16_t>(recordBuffer, static_cast<uint16_t>(channelId));
+    const size_t entriesStart = beginLengthPrefix(recordBuffer);
+    for (const auto& entry : entries) {
+      appendInt<uint64_t>(recordBuffer, entry.first);
+      appendInt<uint64_t>(recordBuffer, entry.second);
+    }
+    endLengthPrefix(recordBuffer, entriesStart);
+    endRecord(recordBuffer, start);
+    entries.clear();
+  }
+  endLengthPrefix(chunkIndexRecords, offsetsStart);
+  writeToFile(recordBuffer);
+  appendInt<uint64_t>(chunkIndexRecords, filePosition - messageIndexStart);
+  appendString(chunkIndexRecords, compressionName);
+  appendInt<uint64_t>(chunkIndexRecords, recordsSize);
+  appendInt<uint64_t>(chunkIndexRecords, uncompressedSize);
+  endRecord(chunkIndexRecords, chunkIndexStart);
+
+  chunkCount++;
+}
+
+void
+McapWriter::close()
+{
+  if (closed) {
+    return;
+  }
+  closed = true;
+
+  writeChunk();
+  waitPendingChunk();
+  writePendingChunk();
+
+  recordBuffer.clear();
+  const size_t dataEndStart = beginRecord(recordBuffer, DATA_END);
+  appendInt<uint32_t>(recordBuffer, 0);
+  endRecord(recordBuffer, dataEndStart);
+  writeToFile(recordBuffer);
+
+  // Summary, one group of records per opcode
+  const uint64_t summaryStart = filePosition;
+  Bytes summaryOffsets;
+  auto writeGroup = [this, &summaryOffsets](Opcode opcode, const Bytes& records) {
+    if (records.empty()) {
+      return;
+    }
+    const size_t start = beginRecord(summaryOffsets, SUMMARY_OFFSET);
+    summaryOffsets.push_back(opcode);
+    appendInt<uint64_t>(summaryOffsets, filePosition);
+    appendInt<uint64_t>(summaryOffsets, records.size());
+    endRecord(summaryOffsets, start);
+    writeToFile(records);
+  };
+  writeGroup(SCHEMA, schemaRecords);
+  writeGroup(CHANNEL, channelRecords);
+
+  recordBuffer.clear();
+  const size_t statisticsStart = beginRecord(recordBuffer, STATISTICS);
+  appendInt<uint64_t>(recordBuffer, messageCount);
+  appendInt<uint16_t>(recordBuffer, static_cast<uint16_t>(schemaIds.size()));
+  appendInt<uint32_t>(recordBuffer, static_cast<uint32_t>(channelIds.size()));
+  // Attachments and metadata
+  appendInt<uint32_t>(recordBuffer, 0);
+  appendInt<uint32_t>(recordBuffer, 0);
+  appendInt<uint32_t>(recordBuffer, chunkCount);
+  appendInt<uint64_t>(recordBuffer, (messageCount > 0) ? messageStartTime : 0);
+  appendInt<uint64_t>(recordBuffer, messageEndTime);
+  const size_t countsStart = beginLengthPrefix(recordBuffer);
+  for (size_t channelId = 0; channelId < channelMessageCounts.size(); ++channelId) {
+    appendInt<uint16_t>(recordBuffer, static_cast<uint16_t>(channelId));
+    appendInt<uint64_t>(recordBuffer, channelMessageCounts[channelId]);
+  }
+  endLengthPrefix(recordBuffer, countsStart);
+  endRecord(recordBuffer, statisticsStart);
+  writeGroup(STATISTICS, recordBuffer);
+
+  writeGroup(CHUNK_INDEX, chunkIndexRecords);
+
+  const uint64_t summaryOffsetStart = filePosition;
+  writeToFile(summaryOffsets);
+
+  recordBuffer.clear();
+  const size_t footerStart = beginRecord(recordBuffer, FOOTER);
+  appendInt<uint64_t>(recordBuffer, summaryStart);
+  appendInt<uint64_t>(recordBuffer, summaryOffsetStart);
+  appendInt<uint32_t>(recordBuffer, 0);
+  endRecord(recordBuffer, footerStart);
+  writeToFile(recordBuffer);
+  writeToFile(MAGIC, sizeof(MAGIC));
+
+  file.close();
+  if (!file) {
+    throw std::runtime_error("Unable to write " + path);
+  }
+}
+
+void
+McapWriter::writeToFile(const uint8_t* bytes, size_t size)
+{
+  file.write(reinterpret_cast<const char*>(bytes), size);
+  if (!file) {
+    throw std::runtime_error("Unable to write " + path);
+  }
+  filePosition += size;
+}
+
+}
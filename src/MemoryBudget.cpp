@@ -0,0 +1,45 @@
+#include "nuscenes2bag/MemoryBudget.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace nuscenes2bag {
+
+MemoryBudget::MemoryBudget(uint64_t limitBytes)
+  : limitBytes((limitBytes > 0) ? limitBytes
+                                : std::numeric_limits<uint64_t>::max())
+  , usedBytes(0)
+{
+  stats.limitBytes = limitBytes;
+}
+
+void
+MemoryBudget::charge(ConversionStage stage, uint64_t bytes)
+{
+  const size_t stageIndex = static_cast<size_t>(stage);
+  std::lock_guard<std::mutex> lock(mutex);
+  const uint64_t used = usedBytes.load(std::memory_order_relaxed) + bytes;
+  usedBytes.store(used, std::memory_order_relaxed);
+  stageBytes[stageIndex] += bytes;
+  stats.peakBytes = std::max(stats.peakBytes, used);
+  stats.stagePeakBytes[stageIndex] =
+    std::max(stats.stagePeakBytes[stageIndex], stageBytes[stageIndex]);
+}
+
+void
+MemoryBudget::release(ConversionStage stage, uint64_t bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  usedBytes.store(usedBytes.load(std::memory_order_relaxed) - bytes,
+                  std::memory_order_relaxed);
+  stageBytes[static_cast<size_t>(stage)] -= bytes;
+}
+
+MemoryStats
+MemoryBudget::getStats() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+}
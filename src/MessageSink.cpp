@@ -0,0 +1,80 @@
+#include "nuscenes2bag/MessageSink.hpp"
+
+#include <rosgraph_msgs/Clock.h>
+
+#include <stdexcept>
+#include <thread>
+
+namespace nuscenes2bag {
+
+// Time given to the subscribers to connect to a new topic, the messages
+// published before they do are lost. rosbag play waits the same.
+static const std::chrono::milliseconds ADVERTISE_DELAY(200);
+
+MessageSink::MessageSink(rosbag::Bag& bag)
+  : bag(&bag)
+  , mcap(nullptr)
+  , nodeHandle(nullptr)
+  , speedFactor(1.0)
+{}
+
+MessageSink::MessageSink(McapWriter& mcap)
+  : bag(nullptr)
+  , mcap(&mcap)
+  , nodeHandle(nullptr)
+  , speedFactor(1.0)
+{}
+
+MessageSink::MessageSink(ros::NodeHandle& nodeHandle, double speedFactor)
+  : bag(nullptr)
+  , mcap(nullptr)
+  , nodeHandle(&nodeHandle)
+  , speedFactor(speedFactor)
+{
+  clockPublisher = nodeHandle.advertise<rosgraph_msgs::Clock>("/clock", 1);
+}
+
+void
+MessageSink::restartPlayback()
+{
+  playbackStarted = false;
+}
+
+void
+MessageSink::waitForSubscribers()
+{
+  std::this_thread::sleep_for(ADVERTISE_DELAY);
+  // The schedule of the messages still to publish is kept
+  playbackStartWallTime += ADVERTISE_DELAY;
+}
+
+void
+MessageSink::waitForTime(const ros::Time& time)
+{
+  if (!ros::ok()) {
+    throw std::runtime_error("ROS was shut down");
+  }
+
+  if (!playbackStarted) {
+    playbackStarted = true;
+    playbackStartTime = time;
+    playbackStartWallTime = Clock::now();
+  }
+
+  // A late message is published right away, the following ones catch up
+  const double offsetSeconds =
+    (static_cast<double>(time.toNSec()) -
+     static_cast<double>(playbackStartTime.toNSec())) * 1e-9 / speedFactor;
+  if (offsetSeconds > 0) {
+    std::this_thread::sleep_until(
+      playbackStartWallTime +
+      std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(offsetSeconds)));
+  }
+
+  rosgraph_msgs::Clock clockMsg;
+  clockMsg.clock = time;
+  clockPublisher.publish(clockMsg);
+}
+
+}
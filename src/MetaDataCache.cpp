@@ -0,0 +1,668 @@
+#include "nuscenes2bag/MetaDataReader.hpp"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+
+namespace nuscenes2bag {
+
+// The cache is a header followed by sections of flat, trivially copyable
+// records. Tokens are stored as their 128-bit value, every other string
+// (names, file names) is interned once in the string table and referenced by
+// its index. One-to-many relations are stored as a contiguous record array
+// plus an index of [begin, end) ranges per key. The layout is the one of the
+// host, the cache is not meant to be shared between machines.
+namespace {
+
+typedef uint32_t StringId;
+
+const char CACHE_MAGIC[8] = { 'N', '2', 'B', 'C', 'A', 'C', 'H', 'E' };
+// 5: the ego pose tokens are filled, the caches before have them zeroed
+const uint32_t CACHE_FORMAT_VERSION = 5;
+
+const char* const TABLE_FILES[] = {
+  "scene.json",          "sample.json",   "sample_data.json",
+  "ego_pose.json",       "calibrated_sensor.json",
+  "sensor.json",         "category.json", "instance.json",
+  "sample_annotation.json"
+};
+const size_t TABLE_FILE_NUMBER = sizeof(TABLE_FILES) / sizeof(TABLE_FILES[0]);
+
+struct SourceStamp
+{
+  uint64_t size;
+  int64_t modificationTimeNs;
+};
+
+struct CacheHeader
+{
+  char magic[8];
+  uint32_t formatVersion;
+  uint32_t tableFileNumber;
+  // Shard the tables were restricted to, see MetaDataReader::loadFromDirectory
+  uint32_t shardIndex;
+  uint32_t shardCount;
+  SourceStamp stamps[TABLE_FILE_NUMBER];
+};
+
+struct IndexRecord
+{
+  Token key;
+  uint32_t begin;
+  uint32_t end;
+};
+
+struct SceneRecord
+{
+  Token token;
+  StringId name;
+  StringId description;
+  Token firstSampleToken;
+  uint32_t sampleNumber;
+  SceneId sceneId;
+};
+
+struct SampleRecord
+{
+  Token sceneToken;
+  Token token;
+  Token prev;
+  TimeStamp timeStamp;
+};
+
+struct SampleDataRecord
+{
+  Token token;
+  Token sampleToken;
+  Token egoPoseToken;
+  Token calibratedSensorToken;
+  StringId fileFormat;
+  StringId fileName;
+  uint32_t isKeyFrame;
+  uint32_t reserved;
+  TimeStamp timeStamp;
+};
+
+struct EgoPoseRecord
+{
+  Token token;
+  TimeStamp timeStamp;
+  double translation[3];
+  double rotation[4];
+};
+
+struct CalibratedSensorRecord
+{
+  Token token;
+  Token sensorToken;
+  double translation[3];
+  double rotation[4];
+};
+
+struct SensorRecord
+{
+  Token token;
+  StringId name;
+  StringId modality;
+};
+
+struct CategoryRecord
+{
+  Token token;
+  StringId name;
+  StringId description;
+};
+
+struct InstanceRecord
+{
+  Token token;
+  Token categoryToken;
+  uint32_t nbrAnnotations;
+  uint32_t reserved;
+};
+
+struct SampleAnnotationRecord
+{
+  Token token;
+  Token instanceToken;
+  float translation[3];
+  float rotation[4];
+  float size[3];
+};
+
+const size_t SECTION_ALIGNMENT = 8;
+
+bool
+readSourceStamps(const fs::path& directoryPath,
+                 SourceStamp (&stamps)[TABLE_FILE_NUMBER])
+{
+  for (size_t i = 0; i < TABLE_FILE_NUMBER; ++i) {
+    struct stat fileStat;
+    const fs::path filePath = directoryPath / TABLE_FILES[i];
+    if (::stat(filePath.string().c_str(), &fileStat) != 0) {
+      return false;
+    }
+    stamps[i].size = static_cast<uint64_t>(fileStat.st_size);
+    stamps[i].modificationTimeNs =
+      static_cast<int64_t>(fileStat.st_mtim.tv_sec) * 1000000000 +
+      fileStat.st_mtim.tv_nsec;
+  }
+  return true;
+}
+
+class CacheWriter
+{
+public:
+  StringId intern(const std::string& str)
+  {
+    auto it = stringIds.find(str);
+    if (it != stringIds.end()) {
+      return it->second;
+    }
+    const StringId id = static_cast<StringId>(stringOffsets.size());
+    stringOffsets.push_back(static_cast<uint32_t>(stringChars.size()));
+    stringChars.insert(stringChars.end(), str.begin(), str.end());
+    stringIds.emplace(str, id);
+    return id;
+  }
+
+  template<typename T>
+  void addSection(const std::vector<T>& records)
+  {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "cache records must be trivially copyable");
+    appendSection(records.data(), records.size(), sizeof(T));
+  }
+
+  void write(const fs::path& filePath, const CacheHeader& header)
+  {
+    std::ofstream file(filePath.string(),
+                       std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      throw std::runtime_error("Unable to create " + filePath.string());
+    }
+
+    std::vector<uint8_t> out;
+    appendBytes(out, &header, sizeof(header));
+
+    // The string table goes first so that the loader can resolve ids while
+    // reading the following sections
+    std::vector<uint32_t> offsets(stringOffsets);
+    offsets.push_back(static_cast<uint32_t>(stringChars.size()));
+    appendCounted(out, offsets.data(), offsets.size(), sizeof(uint32_t));
+    appendCounted(out, stringChars.data(), stringChars.size(), sizeof(char));
+    out.insert(out.end(), sections.begin(), sections.end());
+
+    file.write(reinterpret_cast<const char*>(out.data()), out.size());
+    if (!file) {
+      throw std::runtime_error("Unable to write " + filePath.string());
+    }
+  }
+
+private:
+  static void appendBytes(std::vector<uint8_t>& out,
+                          const void* data,
+                          size_t size)
+  {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    out.insert(out.end(), bytes, bytes + size);
+  }
+
+  static void appendCounted(std::vector<uint8_t>& out,
+                            const void* data,
+                            size_t count,
+                            size_t recordSize)
+  {
+    const uint64_t count64 = count;
+    appendBytes(out, &count64, sizeof(count64));
+    appendBytes(out, data, count * recordSize);
+    out.resize((out.size() + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT *
+               SECTION_ALIGNMENT);
+  }
+
+  void appendSection(const void* data, size_t count, size_t recordSize)
+  {
+    appendCounted(sections, data, count, recordSize);
+  }
+
+private:
+  std::unordered_map<std::string, StringId> stringIds;
+  std::vector<uint32_t> stringOffsets;
+  std::vector<char> stringChars;
+  std::vector<uint8_t> sections;
+};
+
+// Bounds-checked sequential view over the cache file bytes. Any inconsistency
+// throws, the caller then falls back to parsing the JSON files.
+class CacheReader
+{
+public:
+  CacheReader(const uint8_t* data, size_t size)
+    : data(data)
+    , size(size)
+  {}
+
+  template<typename T>
+  const T* take(size_t count)
+  {
+    if ((size - position) < count * sizeof(T)) {
+      throw std::runtime_error("truncated cache");
+    }
+    const T* records = reinterpret_cast<const T*>(data + position);
+    position += count * sizeof(T);
+    return records;
+  }
+
+  template<typename T>
+  std::pair<const T*, size_t> takeSection()
+  {
+    static_assert(alignof(T) <= SECTION_ALIGNMENT,
+                  "cache records must fit the section alignment");
+    const uint64_t count = *take<uint64_t>(1);
+    if (count > (size - position) / sizeof(T)) {
+      throw std::runtime_error("truncated cache");
+    }
+    const T* records = take<T>(count);
+    position = std::min(size,
+                        (position + SECTION_ALIGNMENT - 1) /
+                          SECTION_ALIGNMENT * SECTION_ALIGNMENT);
+    return std::make_pair(records, static_cast<size_t>(count));
+  }
+
+  void readStrings()
+  {
+    auto offsets = takeSection<uint32_t>();
+    auto chars = takeSection<char>();
+    if (offsets.second == 0) {
+      throw std::runtime_error("missing string table");
+    }
+    strings.clear();
+    strings.reserve(offsets.second - 1);
+    for (size_t i = 0; i + 1 < offsets.second; ++i) {
+      const uint32_t begin = offsets.first[i];
+      const uint32_t end = offsets.first[i + 1];
+      if ((begin > end) || (end > chars.second)) {
+        throw std::runtime_error("invalid string table");
+      }
+      strings.emplace_back(chars.first + begin, end - begin);
+    }
+  }
+
+  const std::string& str(StringId id) const
+  {
+    if (id >= strings.size()) {
+      throw std::runtime_error("invalid string id");
+    }
+    return strings[id];
+  }
+
+  template<typename Record, typename Value, typename Convert>
+  std::unordered_map<Token, std::vector<Value>> readRelation(const Convert& convert)
+  {
+    auto index = takeSection<IndexRecord>();
+    auto records = takeSection<Record>();
+    std::unordered_map<Token, std::vector<Value>> relation;
+    for (size_t i = 0; i < index.second; ++i) {
+      const IndexRecord& range = index.first[i];
+      if ((range.begin > range.end) || (range.end > records.second)) {
+        throw std::runtime_error("invalid cache index");
+      }
+      std::vector<Value>& values = relation[range.key];
+      values.reserve(range.end - range.begin);
+      for (uint32_t j = range.begin; j < range.end; ++j) {
+        values.push_back(convert(records.first[j]));
+      }
+    }
+    return relation;
+  }
+
+private:
+  const uint8_t* data;
+  size_t size;
+  size_t position = 0;
+  std::vector<std::string> strings;
+};
+
+// Values is a std::vector or an EgoPoseStore
+template<typename Record, typename Values, typename Convert>
+void
+addRelation(CacheWriter& writer,
+            const std::unordered_map<Token, Values>& relation,
+            const Convert& convert)
+{
+  std::vector<IndexRecord> index;
+  std::vector<Record> records;
+  for (const auto& keyValues : relation) {
+    IndexRecord range;
+    range.key = keyValues.first;
+    range.begin = static_cast<uint32_t>(records.size());
+    const Values& values = keyValues.second;
+    for (size_t i = 0; i < values.size(); ++i) {
+      records.push_back(convert(values[i]));
+    }
+    range.end = static_cast<uint32_t>(records.size());
+    index.push_back(range);
+  }
+  writer.addSection(index);
+  writer.addSection(records);
+}
+
+}
+
+void
+MetaDataReader::saveToCache(const fs::path& cachePath,
+                            const fs::path& directoryPath) const
+{
+  assert(loadFromDirectoryCalled);
+
+  CacheHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.formatVersion = CACHE_FORMAT_VERSION;
+  header.tableFileNumber = TABLE_FILE_NUMBER;
+  header.shardIndex = loadedShardIndex;
+  header.shardCount = loadedShardCount;
+  if (!readSourceStamps(directoryPath, header.stamps)) {
+    throw std::runtime_error("Unable to stat metadata files in " +
+                             directoryPath.string());
+  }
+
+  CacheWriter writer;
+
+  std::vector<SceneRecord> sceneRecords;
+  for (const SceneInfo& scene : scenes) {
+    sceneRecords.push_back(SceneRecord{ scene.token,
+                                        writer.intern(scene.name),
+                                        writer.intern(scene.description),
+                                        scene.firstSampleToken,
+                                        scene.sampleNumber,
+                                        scene.sceneId });
+  }
+  writer.addSection(sceneRecords);
+
+  addRelation<SampleRecord>(
+    writer, scene2Samples, [](const SampleInfo& sample) {
+      return SampleRecord{ sample.scene_token,
+                           sample.token,
+                           sample.prev,
+                           sample.timeStamp };
+    });
+
+  addRelation<SampleDataRecord>(
+    writer, scene2SampleData, [&writer](const SampleDataInfo& sampleData) {
+      return SampleDataRecord{ sampleData.token,
+                               sampleData.sampleToken,
+                               sampleData.egoPoseToken,
+                               sampleData.calibratedSensorToken,
+                               writer.intern(sampleData.fileFormat),
+                               writer.intern(sampleData.fileName),
+                               sampleData.isKeyFrame ? 1u : 0u,
+                               0,
+                               sampleData.timeStamp };
+    });
+
+  addRelation<EgoPoseRecord>(
+    writer, scene2EgoPose, [](const EgoPoseInfo& egoPose) {
+      EgoPoseRecord record;
+      record.token = egoPose.token;
+      record.timeStamp = egoPose.timeStamp;
+      std::memcpy(
+        record.translation, egoPose.translation, sizeof(record.translation));
+      std::memcpy(record.rotation, egoPose.rotation, sizeof(record.rotation));
+      return record;
+    });
+
+  std::vector<CalibratedSensorRecord> calibratedSensorRecords;
+  for (const auto& keyValue : calibratedSensorToken2CalibratedSensorInfo) {
+    const CalibratedSensorInfo& info = keyValue.second;
+    CalibratedSensorRecord record;
+    record.token = info.token;
+    record.sensorToken = info.sensorToken;
+    std::memcpy(
+      record.translation, info.translation, sizeof(record.translation));
+    std::memcpy(record.rotation, info.rotation, sizeof(record.rotation));
+    calibratedSensorRecords.push_back(record);
+  }
+  writer.addSection(calibratedSensorRecords);
+
+  std::vector<SensorRecord> sensorRecords;
+  for (const auto& keyValue : sensorToken2CalibratedSensorName) {
+    const CalibratedSensorName& sensor = keyValue.second;
+    sensorRecords.push_back(SensorRecord{ sensor.token,
+                                          writer.intern(sensor.name),
+                                          writer.intern(sensor.modality) });
+  }
+  writer.addSection(sensorRecords);
+
+  std::vector<CategoryRecord> categoryRecords;
+  for (const auto& keyValue : categories) {
+    categoryRecords.push_back(
+      CategoryRecord{ keyValue.first,
+                      writer.intern(keyValue.second.name),
+                      writer.intern(keyValue.second.description) });
+  }
+  writer.addSection(categoryRecords);
+
+  std::vector<InstanceRecord> instanceRecords;
+  for (const auto& keyValue : instances) {
+    instanceRecords.push_back(
+      InstanceRecord{ keyValue.first,
+                      keyValue.second.categoryToken,
+                      keyValue.second.nbrAnnotations,
+                      0 });
+  }
+  writer.addSection(instanceRecords);
+
+  addRelation<SampleAnnotationRecord>(
+    writer,
+    sample2SampleAnnotations,
+    [](const SampleAnnotationInfo& annotation) {
+      SampleAnnotationRecord record;
+      record.token = annotation.token;
+      record.instanceToken = annotation.instanceToken;
+      std::memcpy(
+        record.translation, annotation.translation, sizeof(record.translation));
+      std::memcpy(record.rotation, annotation.rotation, sizeof(record.rotation));
+      std::memcpy(record.size, annotation.size, sizeof(record.size));
+      return record;
+    });
+
+  // Write next to the final file and rename, so that a concurrent or
+  // interrupted run never sees a partial cache
+  fs::path tmpPath = cachePath;
+  tmpPath += ".tmp";
+  writer.write(tmpPath, header);
+  fs::rename(tmpPath, cachePath);
+}
+
+bool
+MetaDataReader::loadFromCache(const fs::path& cachePath,
+                              const fs::path& directoryPath,
+                              uint32_t shardIndex,
+                              uint32_t shardCount)
+{
+  CacheHeader expectedHeader;
+  if (!fs::exists(cachePath) ||
+      !readSourceStamps(directoryPath, expectedHeader.stamps)) {
+    return false;
+  }
+
+  try {
+    // Read in one go, the records are then copied into the tables: the load
+    // cost is the one of rebuilding the hash maps, not of parsing JSON
+    std::ifstream file(cachePath.string(), std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+      return false;
+    }
+    std::vector<uint8_t> bytes(static_cast<size_t>(file.tellg()));
+    file.seekg(0, std::ios::beg);
+    if (!file.read(reinterpret_cast<char*>(bytes.data()), bytes.size())) {
+      throw std::runtime_error("unable to read the cache");
+    }
+    CacheReader reader(bytes.data(), bytes.size());
+
+    CacheHeader header;
+    std::memcpy(&header, reader.take<CacheHeader>(1), sizeof(header));
+    if ((std::memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0) ||
+        (header.formatVersion != CACHE_FORMAT_VERSION) ||
+        (header.tableFileNumber != TABLE_FILE_NUMBER)) {
+      return false;
+    }
+    if (shardCount <= 1) {
+      shardIndex = 0;
+      shardCount = 1;
+    }
+    if ((header.shardIndex != shardIndex) || (header.shardCount != shardCount)) {
+      return false;
+    }
+    for (size_t i = 0; i < TABLE_FILE_NUMBER; ++i) {
+      if ((header.stamps[i].size != expectedHeader.stamps[i].size) ||
+          (header.stamps[i].modificationTimeNs !=
+           expectedHeader.stamps[i].modificationTimeNs)) {
+        return false;
+      }
+    }
+
+    reader.readStrings();
+
+    std::vector<SceneInfo> cachedScenes;
+    auto sceneRecords = reader.takeSection<SceneRecord>();
+    for (size_t i = 0; i < sceneRecords.second; ++i) {
+      const SceneRecord& record = sceneRecords.first[i];
+      cachedScenes.push_back(SceneInfo{ record.token,
+                                        record.sampleNumber,
+                                        record.sceneId,
+                                        reader.str(record.name),
+                                        reader.str(record.description),
+                                        record.firstSampleToken });
+    }
+
+    auto cachedScene2Samples = reader.readRelation<SampleRecord, SampleInfo>(
+      [](const SampleRecord& record) {
+        return SampleInfo{ record.sceneToken,
+                           record.token,
+                           record.timeStamp,
+                           record.prev };
+      });
+
+    auto cachedScene2SampleData =
+      reader.readRelation<SampleDataRecord, SampleDataInfo>(
+        [&reader](const SampleDataRecord& record) {
+          return SampleDataInfo{ record.token,
+                                 record.sampleToken,
+                                 record.timeStamp,
+                                 record.egoPoseToken,
+                                 record.calibratedSensorToken,
+                                 reader.str(record.fileFormat),
+                                 record.isKeyFrame != 0,
+                                 reader.str(record.fileName) };
+        });
+
+    auto cachedScene2EgoPoseInfos = reader.readRelation<EgoPoseRecord, EgoPoseInfo>(
+      [](const EgoPoseRecord& record) {
+        EgoPoseInfo egoPose;
+        egoPose.token = record.token;
+        egoPose.timeStamp = record.timeStamp;
+        std::memcpy(
+          egoPose.translation, record.translation, sizeof(egoPose.translation));
+        std::memcpy(egoPose.rotation, record.rotation, sizeof(egoPose.rotation));
+        return egoPose;
+      });
+    // Written sorted by timestamp, sorting them again is cheap
+    std::unordered_map<Token, EgoPoseStore> cachedScene2EgoPose;
+    for (auto& sceneEgoPoses : cachedScene2EgoPoseInfos) {
+      cachedScene2EgoPose.emplace(sceneEgoPoses.first,
+                                  EgoPoseStore(std::move(sceneEgoPoses.second)));
+    }
+
+    std::unordered_map<Token, CalibratedSensorInfo> cachedCalibratedSensors;
+    auto calibratedSensorRecords = reader.takeSection<CalibratedSensorRecord>();
+    for (size_t i = 0; i < calibratedSensorRecords.second; ++i) {
+      const CalibratedSensorRecord& record = calibratedSensorRecords.first[i];
+      CalibratedSensorInfo info{ record.token,
+                                 record.sensorToken,
+                                 {},
+                                 {},
+                                 {} // IntrinsicsMatrix
+      };
+      std::memcpy(info.translation, record.translation, sizeof(info.translation));
+      std::memcpy(info.rotation, record.rotation, sizeof(info.rotation));
+      cachedCalibratedSensors.emplace(info.token, info);
+    }
+
+    std::unordered_map<Token, CalibratedSensorName> cachedSensorNames;
+    auto sensorRecords = reader.takeSection<SensorRecord>();
+    for (size_t i = 0; i < sensorRecords.second; ++i) {
+      const SensorRecord& record = sensorRecords.first[i];
+      cachedSensorNames.emplace(
+        record.token,
+        CalibratedSensorName{ record.token,
+                              reader.str(record.name),
+                              reader.str(record.modality) });
+    }
+
+    std::unordered_map<Token, CategoryInfo> cachedCategories;
+    auto categoryRecords = reader.takeSection<CategoryRecord>();
+    for (size_t i = 0; i < categoryRecords.second; ++i) {
+      const CategoryRecord& record = categoryRecords.first[i];
+      cachedCategories.emplace(
+        record.token,
+        CategoryInfo{ reader.str(record.name), reader.str(record.description) });
+    }
+
+    std::unordered_map<Token, InstanceInfo> cachedInstances;
+    auto instanceRecords = reader.takeSection<InstanceRecord>();
+    for (size_t i = 0; i < instanceRecords.second; ++i) {
+      const InstanceRecord& record = instanceRecords.first[i];
+      cachedInstances.emplace(
+        record.token,
+        InstanceInfo{ record.categoryToken, record.nbrAnnotations });
+    }
+
+    auto cachedSample2SampleAnnotations =
+      reader.readRelation<SampleAnnotationRecord, SampleAnnotationInfo>(
+        [](const SampleAnnotationRecord& record) {
+          SampleAnnotationInfo annotation;
+          annotation.token = record.token;
+          annotation.instanceToken = record.instanceToken;
+          std::memcpy(annotation.translation,
+                      record.translation,
+                      sizeof(annotation.translation));
+          std::memcpy(
+            annotation.rotation, record.rotation, sizeof(annotation.rotation));
+          std::memcpy(annotation.size, record.size, sizeof(annotation.size));
+          return annotation;
+        });
+
+    scenes.swap(cachedScenes);
+    scene2Samples.swap(cachedScene2Samples);
+    scene2SampleData.swap(cachedScene2SampleData);
+    scene2EgoPose.swap(cachedScene2EgoPose);
+    calibratedSensorToken2CalibratedSensorInfo.swap(cachedCalibratedSensors);
+    sensorToken2CalibratedSensorName.swap(cachedSensorNames);
+    categories.swap(cachedCategories);
+    instances.swap(cachedInstances);
+    sample2SampleAnnotations.swap(cachedSample2SampleAnnotations);
+
+    // The derived tables are cheap to rebuild from the restored ones
+    decorateSampleAnnotations();
+    buildSceneRelations();
+  } catch (const std::exception& e) {
+    std::cerr << "Ignoring metadata cache " << cachePath.string() << ": "
+              << e.what() << std::endl;
+    return false;
+  }
+
+  loadFromDirectoryCalled = true;
+  loadedShardIndex = shardIndex;
+  loadedShardCount = shardCount;
+  return true;
+}
+
+}
@@ -1,14 +1,20 @@
 #include "nuscenes2bag/utils.hpp"
+#include "nuscenes2bag/JsonTableReader.hpp"
+#include "nuscenes2bag/SceneSharding.hpp"
 #include <nuscenes2bag/MetaDataReader.hpp>
 
 #include <algorithm>
-#include <fstream>
+#include <array>
+#include <chrono>
+#include <future>
 #include <iostream>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <regex>
+#include <sstream>
 
 using namespace std;
-namespace json = nlohmann;
 
 namespace nuscenes2bag {
 
@@ -16,10 +22,9 @@ template<typename T>
 void
 throwKeyNotFound(const T& key, const char* msg)
 {
-  std::string errorMsg = "MetaDataError: ";
-  errorMsg += msg;
-  errorMsg += " [" + key + "]";
-  throw InvalidMetaDataException(errorMsg);
+  std::ostringstream errorMsg;
+  errorMsg << "MetaDataError: " << msg << " [" << key << "]";
+  throw InvalidMetaDataException(errorMsg.str());
 }
 
 template<template<class, class, class...> class Container,
@@ -38,8 +43,35 @@ findOrThrow(const Container<Key, Value, TArgs...>& container,
   return it->second;
 }
 
+static double
+secondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+    .count();
+}
+
+// Runs load(filePath) and stores its duration in seconds
+template<typename Load>
+static auto
+timedLoad(const Load& load, const fs::path& filePath, double& seconds)
+  -> decltype(load(filePath))
+{
+  const auto start = std::chrono::steady_clock::now();
+  auto table = load(filePath);
+  seconds = secondsSince(start);
+  return table;
+}
+
+const std::vector<std::pair<std::string, double>>&
+MetaDataReader::getTableLoadSeconds() const
+{
+  return tableLoadSeconds;
+}
+
 void
-MetaDataReader::loadFromDirectory(const fs::path& directoryPath)
+MetaDataReader::loadFromDirectory(const fs::path& directoryPath,
+                                  uint32_t shardIndex,
+                                  uint32_t shardCount)
 {
   const fs::path sceneFile = directoryPath / "scene.json";
   const fs::path sampleFile = directoryPath / "sample.json";
@@ -52,18 +84,210 @@ MetaDataReader::loadFromDirectory(const fs::path& directoryPath)
   const fs::path instanceFile = directoryPath / "instance.json";
   const fs::path sampleAnnotationFile = directoryPath / "sample_annotation.json";
 
-  scenes = loadScenesFromFile(sceneFile);
-  scene2Samples = loadSampleInfos(sampleFile);
-  sample2SampleData = loadSampleDataInfos(sampleDataFile);
-  calibratedSensorToken2CalibratedSensorInfo =
-    loadCalibratedSensorInfo(calibratedSensorFile);
-  sensorToken2CalibratedSensorName = loadCalibratedSensorNames(sensorFile);
+  double sceneSeconds = 0;
+  double sampleSeconds = 0;
+  double sampleDataSeconds = 0;
+  double calibratedSensorSeconds = 0;
+  double sensorSeconds = 0;
+  double categorySeconds = 0;
+  double instanceSeconds = 0;
+  double sampleAnnotationSeconds = 0;
+
+  // The tables are independent of each other, parse them concurrently
+  auto scenesFuture = std::async(std::launch::async, [&]() {
+    return timedLoad(loadScenesFromFile, sceneFile, sceneSeconds);
+  });
+  auto samplesFuture = std::async(std::launch::async, [&]() {
+    return timedLoad(loadSampleInfos, sampleFile, sampleSeconds);
+  });
+  auto sampleDatasFuture = std::async(std::launch::async, [&]() {
+    return timedLoad(loadSampleDataInfos, sampleDataFile, sampleDataSeconds);
+  });
+  auto calibratedSensorsFuture = std::async(std::launch::async, [&]() {
+    return timedLoad(
+      loadCalibratedSensorInfo, calibratedSensorFile, calibratedSensorSeconds);
+  });
+  auto sensorsFuture = std::async(std::launch::async, [&]() {
+    return timedLoad(loadCalibratedSensorNames, sensorFile, sensorSeconds);
+  });
+  auto categoriesFuture = std::async(std::launch::async, [&]() {
+    return timedLoad(loadCategories, categoryFile, categorySeconds);
+  });
+  auto instancesFuture = std::async(std::launch::async, [&]() {
+    return timedLoad(loadInstances, instanceFile, instanceSeconds);
+  });
+  auto sampleAnnotationsFuture = std::async(std::launch::async, [&]() {
+    return timedLoad(
+      loadSampleAnnotations, sampleAnnotationFile, sampleAnnotationSeconds);
+  });
+
+  scenes = scenesFuture.get();
+  scene2Samples = samplesFuture.get();
+  auto sample2SampleData = sampleDatasFuture.get();
+  calibratedSensorToken2CalibratedSensorInfo = calibratedSensorsFuture.get();
+  sensorToken2CalibratedSensorName = sensorsFuture.get();
   //attributeInfo = loadAttributeInfo(attributeFile);
-  categories = loadCategories(categoryFile);
-  instances = loadInstances(instanceFile);
-  sample2SampleAnnotations = loadSampleAnnotations(sampleAnnotationFile);
+  categories = categoriesFuture.get();
+  instances = instancesFuture.get();
+  sample2SampleAnnotations = sampleAnnotationsFuture.get();
+
+  const auto relationsStart = std::chrono::steady_clock::now();
+  groupSampleDataByScene(sample2SampleData);
+  if (shardCount > 1) {
+    // The sample data of every scene is needed to partition them, the
+    // relations and the ego poses are only built for the kept ones
+    std::vector<Token> sceneTokens;
+    for (const SceneInfo& sceneInfo : scenes) {
+      sceneTokens.push_back(sceneInfo.token);
+    }
+    keepScenes(selectShardScenes(sceneTokens,
+                                 getSceneSampleDataNumbers(),
+                                 shardIndex,
+                                 shardCount));
+  }
+  decorateSampleAnnotations();
+  std::unordered_map<Token, Token> egoPoseToken2sceneToken = buildSceneRelations();
+  const double relationsSeconds = secondsSince(relationsStart);
+
+  double egoPoseSeconds = 0;
+  scene2EgoPose = timedLoad(
+    [&egoPoseToken2sceneToken, shardCount](const fs::path& filePath) {
+      return loadEgoPoseInfos(
+        filePath, egoPoseToken2sceneToken, shardCount > 1);
+    },
+    egoPoseFile,
+    egoPoseSeconds);
+
+  tableLoadSeconds = {
+    { "scene", sceneSeconds },
+    { "sample", sampleSeconds },
+    { "sample_data", sampleDataSeconds },
+    { "calibrated_sensor", calibratedSensorSeconds },
+    { "sensor", sensorSeconds },
+    { "category", categorySeconds },
+    { "instance", instanceSeconds },
+    { "sample_annotation", sampleAnnotationSeconds },
+    { "relations", relationsSeconds },
+    { "ego_pose", egoPoseSeconds }
+  };
+
+  loadFromDirectoryCalled = true;
+  loadedShardIndex = (shardCount > 1) ? shardIndex : 0;
+  loadedShardCount = std::max<uint32_t>(shardCount, 1);
+}
+
+void
+MetaDataReader::groupSampleDataByScene(
+  std::unordered_map<Token, std::vector<SampleDataInfo>>& sample2SampleData)
+{
+  // Store the sample data of a scene contiguously, so that it can be handed
+  // out as a single view
+  scene2SampleData.clear();
+  for (const auto& scene2SamplesEntry : scene2Samples) {
+    std::vector<SampleDataInfo>& sceneSampleDatas =
+      scene2SampleData[scene2SamplesEntry.first];
+    for (const auto& sampleInfo : scene2SamplesEntry.second) {
+      auto it = sample2SampleData.find(sampleInfo.token);
+      if (it == sample2SampleData.end()) {
+        continue;
+      }
+      std::move(it->second.begin(),
+                it->second.end(),
+                std::back_inserter(sceneSampleDatas));
+    }
+  }
+}
+
+std::vector<uint64_t>
+MetaDataReader::getSceneSampleDataNumbers() const
+{
+  std::vector<uint64_t> sampleDataNumbers;
+  for (const SceneInfo& scene : scenes) {
+    auto it = scene2SampleData.find(scene.token);
+    sampleDataNumbers.push_back(
+      (it != scene2SampleData.end()) ? it->second.size() : 0);
+  }
+  return sampleDataNumbers;
+}
+
+void
+MetaDataReader::keepScenes(const std::vector<Token>& sceneTokens)
+{
+  const std::unordered_set<Token> keptSceneTokens(sceneTokens.begin(),
+                                                  sceneTokens.end());
+  auto isDropped = [&keptSceneTokens](const Token& sceneToken) {
+    return keptSceneTokens.count(sceneToken) == 0;
+  };
+
+  scenes.erase(std::remove_if(scenes.begin(),
+                              scenes.end(),
+                              [&isDropped](const SceneInfo& scene) {
+                                return isDropped(scene.token);
+                              }),
+               scenes.end());
+  for (auto it = scene2Samples.begin(); it != scene2Samples.end();) {
+    if (!isDropped(it->first)) {
+      ++it;
+      continue;
+    }
+    for (const auto& sampleInfo : it->second) {
+      sample2SampleAnnotations.erase(sampleInfo.token);
+    }
+    it = scene2Samples.erase(it);
+  }
+  for (auto it = scene2SampleData.begin(); it != scene2SampleData.end();) {
+    if (isDropped(it->first)) {
+      it = scene2SampleData.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// Checked in order, the first name part found in the category name wins
+static const struct
+{
+  const char* namePart;
+  float color[4];
+} CATEGORY_COLORS[] = {
+  { "bicycle", { 1.0f, 0.239f, 0.388f, 1.0f } },      // Red
+  { "motorcycle", { 1.0f, 0.239f, 0.388f, 1.0f } },   // Red
+  { "vehicle", { 1.0f, 0.619f, 0.0f, 1.0f } },        // Orange
+  { "bus", { 1.0f, 0.619f, 0.0f, 1.0f } },            // Orange
+  { "car", { 1.0f, 0.619f, 0.0f, 1.0f } },            // Orange
+  { "trailer", { 1.0f, 0.619f, 0.0f, 1.0f } },        // Orange
+  { "truck", { 1.0f, 0.619f, 0.0f, 1.0f } },          // Orange
+  { "pedestrian", { 0.0f, 0.0f, 0.901f, 1.0f } },     // Blue
+  { "cone", { 0.0f, 0.0f, 0.0f, 1.0f } },             // Black
+  { "barrier", { 0.0f, 0.0f, 0.0f, 1.0f } },          // Black
+};
+static const float DEFAULT_CATEGORY_COLOR[4] = { 1.0f, 0.0f, 1.0f, 1.0f }; // Magenta
+
+void
+getCategoryColor(const std::string& categoryName, float color[4])
+{
+  const float* found = DEFAULT_CATEGORY_COLOR;
+  for (const auto& categoryColor : CATEGORY_COLORS) {
+    if (categoryName.find(categoryColor.namePart) != std::string::npos) {
+      found = categoryColor.color;
+      break;
+    }
+  }
+  std::copy(found, found + 4, color);
+}
+
+void
+MetaDataReader::decorateSampleAnnotations()
+{
+  // The color only depends on the category, resolve it once per category
+  std::unordered_map<Token, std::array<float, 4>> categoryColors;
+  for (const auto& category : categories) {
+    getCategoryColor(category.second.name,
+                     categoryColors[category.first].data());
+  }
 
   // Decorate (add short-cut) sample_annotation info with the category name
+  // and color
   for (auto& sample2SampleAnnotation : sample2SampleAnnotations)
   {
     for (auto& sampleAnnotation : sample2SampleAnnotation.second)
@@ -77,165 +301,165 @@ MetaDataReader::loadFromDirectory(const fs::path& directoryPath)
                                              "unable to find category_token");
 
       sampleAnnotation.categoryName = categoryInfo.name;
+      const auto& color = categoryColors.at(instanceInfo.categoryToken);
+      std::copy(color.begin(), color.end(), sampleAnnotation.color);
     }
   }
+}
 
-  // build inverse (EgoPose.token -> Scene.token) map
-  // and (scene.token -> calibratedSensor[]) map
-  std::map<Token, Token> egoPoseToken2sceneToken;
+std::unordered_map<Token, Token>
+MetaDataReader::buildSceneRelations()
+{
+  // build the sample.token index, the inverse (EgoPose.token -> Scene.token)
+  // map and the (scene.token -> calibratedSensor[]) map
+  std::unordered_map<Token, Token> egoPoseToken2sceneToken;
+  scene2CalibratedSensorInfo.clear();
+
+  sampleToken2SampleInfo.clear();
+  for (const auto& scene2SamplesEntry : scene2Samples) {
+    for (const auto& sampleInfo : scene2SamplesEntry.second) {
+      sampleToken2SampleInfo.emplace(sampleInfo.token, sampleInfo);
+    }
+  }
 
 #if CMAKE_CXX_STANDARD >= 17
-  for (const auto& [sceneToken, sampleInfos] : scene2Samples) {
+  for (const auto& [sceneToken, sampleDatas] : scene2SampleData) {
 #else
-  for (const auto& keyvalue : scene2Samples) {
+  for (const auto& keyvalue : scene2SampleData) {
     const Token& sceneToken = keyvalue.first;
-    const std::vector<SampleInfo>& sampleInfos = keyvalue.second;
+    const std::vector<SampleDataInfo>& sampleDatas = keyvalue.second;
 #endif
 
-    for (const auto& sampleInfo : sampleInfos) {
-      for (const auto& sampleData : sample2SampleData[sampleInfo.token]) {
-        // add egoPoseInfo
-        egoPoseToken2sceneToken.emplace(sampleData.egoPoseToken, sceneToken);
-
-        // add calibrated sensor info
-        auto& calibratedSensorInfoSet =
-          getExistingOrDefault(scene2CalibratedSensorInfo, sceneToken);
-        const auto& calibratedSensorInfo =
-          findOrThrow(calibratedSensorToken2CalibratedSensorInfo,
-                      sampleData.calibratedSensorToken,
-                      "unable to find calibrated sensor");
-        const auto& calibratedSensorName =
-          findOrThrow(sensorToken2CalibratedSensorName,
-                      calibratedSensorInfo.sensorToken,
-                      "unable to find sensor");
-        calibratedSensorInfoSet.insert(CalibratedSensorInfoAndName{
-          calibratedSensorInfo, calibratedSensorName });
-      }
+    for (const auto& sampleData : sampleDatas) {
+      // add egoPoseInfo
+      egoPoseToken2sceneToken.emplace(sampleData.egoPoseToken, sceneToken);
+
+      // add calibrated sensor info
+      auto& calibratedSensorInfoSet =
+        getExistingOrDefault(scene2CalibratedSensorInfo, sceneToken);
+      const auto& calibratedSensorInfo =
+        findOrThrow(calibratedSensorToken2CalibratedSensorInfo,
+                    sampleData.calibratedSensorToken,
+                    "unable to find calibrated sensor");
+      const auto& calibratedSensorName =
+        findOrThrow(sensorToken2CalibratedSensorName,
+                    calibratedSensorInfo.sensorToken,
+                    "unable to find sensor");
+      calibratedSensorInfoSet.insert(CalibratedSensorInfoAndName{
+        calibratedSensorInfo, calibratedSensorName });
     }
   }
 
-  scene2EgoPose = loadEgoPoseInfos(egoPoseFile, egoPoseToken2sceneToken);
-
-  loadFromDirectoryCalled = true;
-}
-
-json::json
-MetaDataReader::slurpJsonFile(const fs::path& filePath)
-{
-  std::ifstream file(filePath.string());
-  if (!file.is_open()) {
-    std::string errMsg = string("Unable to open ") + filePath.string();
-    throw std::runtime_error(errMsg);
-  }
-  json::json newJson;
-  file >> newJson;
-  return newJson;
+  return egoPoseToken2sceneToken;
 }
 
 std::vector<SceneInfo>
 MetaDataReader::loadScenesFromFile(const fs::path& filePath)
 {
-  auto sceneJsons = slurpJsonFile(filePath);
   std::vector<SceneInfo> sceneInfos;
 
   std::regex sceneIdRegex("scene-(\\d+)");
 
-  for (const auto& sceneJson : sceneJsons) {
-    std::string sceneIdStr = sceneJson["name"];
+  readJsonTable(filePath, [&](const JsonRecord& sceneJson) {
+    const std::string& sceneIdStr = sceneJson.getString("name");
     std::smatch match;
     std::regex_search(sceneIdStr, match, sceneIdRegex);
     SceneId sceneId = std::stoi(match.str(1));
     sceneInfos.push_back(SceneInfo{
-      sceneJson["token"],
-      sceneJson["nbr_samples"],
+      sceneJson.getToken("token"),
+      static_cast<uint32_t>(sceneJson.getUnsigned("nbr_samples")),
       sceneId,
-      sceneJson["name"],
-      sceneJson["description"],
-      sceneJson["first_sample_token"],
+      sceneJson.getString("name"),
+      sceneJson.getString("description"),
+      sceneJson.getToken("first_sample_token"),
     });
-  }
+  });
 
   return sceneInfos;
 }
 
-std::map<Token, std::vector<SampleInfo>>
+std::unordered_map<Token, std::vector<SampleInfo>>
 MetaDataReader::loadSampleInfos(const fs::path& filePath)
 {
-  auto sampleInfos = slurpJsonFile(filePath);
-  std::map<Token, std::vector<SampleInfo>> token2Samples;
+  std::unordered_map<Token, std::vector<SampleInfo>> token2Samples;
 
-  for (const auto& sampleInfo : sampleInfos) {
-    Token sampleToken = sampleInfo["token"];
-    Token sceneToken = sampleInfo["scene_token"];
+  readJsonTable(filePath, [&](const JsonRecord& sampleInfo) {
+    const Token sampleToken = sampleInfo.getToken("token");
+    const Token sceneToken = sampleInfo.getToken("scene_token");
     std::vector<SampleInfo>& samples =
       getExistingOrDefault(token2Samples, sceneToken);
     samples.push_back(
       SampleInfo{sceneToken,
                  sampleToken,
-                 sampleInfo["timestamp"],
-                 sampleInfo["prev"]
+                 sampleInfo.getUnsigned("timestamp"),
+                 sampleInfo.getToken("prev")
                  });
-  }
+  });
 
   return token2Samples;
 }
 
-std::map<Token, std::vector<SampleDataInfo>>
+std::unordered_map<Token, std::vector<SampleDataInfo>>
 MetaDataReader::loadSampleDataInfos(const fs::path& filePath)
 {
-  auto sampleDataJsons = slurpJsonFile(filePath);
-  std::map<Token, std::vector<SampleDataInfo>> sample2SampleData;
+  std::unordered_map<Token, std::vector<SampleDataInfo>> sample2SampleData;
 
-  for (const auto& sampleDataJson : sampleDataJsons) {
-    Token sampleToken = sampleDataJson["sample_token"];
-    Token sampleDataToken = sampleDataJson["token"];
+  readJsonTable(filePath, [&](const JsonRecord& sampleDataJson) {
+    const Token sampleToken = sampleDataJson.getToken("sample_token");
     std::vector<SampleDataInfo>& sampleDatas =
       getExistingOrDefault(sample2SampleData, sampleToken);
     sampleDatas.push_back(SampleDataInfo{
-      sampleDataToken,
+      sampleDataJson.getToken("token"),
       sampleToken,
-      sampleDataJson["timestamp"],
-      sampleDataJson["ego_pose_token"],
-      sampleDataJson["calibrated_sensor_token"],
-      sampleDataJson["fileformat"],
-      sampleDataJson["is_key_frame"],
-      sampleDataJson["filename"],
+      sampleDataJson.getUnsigned("timestamp"),
+      sampleDataJson.getToken("ego_pose_token"),
+      sampleDataJson.getToken("calibrated_sensor_token"),
+      sampleDataJson.getString("fileformat"),
+      sampleDataJson.getBoolean("is_key_frame"),
+      sampleDataJson.getString("filename"),
     });
-  }
+  });
 
   return sample2SampleData;
 }
 
 EgoPoseInfo
-egoPoseJson2EgoPoseInfo(const json::json& egoPoseJson)
+egoPoseJson2EgoPoseInfo(const JsonRecord& egoPoseJson)
 {
   EgoPoseInfo egoPoseInfo;
+  egoPoseInfo.token = egoPoseJson.getToken("token");
 
-  egoPoseInfo.translation[0] = egoPoseJson["translation"][0];
-  egoPoseInfo.translation[1] = egoPoseJson["translation"][1];
-  egoPoseInfo.translation[2] = egoPoseJson["translation"][2];
+  const auto& translation = egoPoseJson.getNumbers("translation", 3);
+  egoPoseInfo.translation[0] = translation[0];
+  egoPoseInfo.translation[1] = translation[1];
+  egoPoseInfo.translation[2] = translation[2];
 
-  egoPoseInfo.rotation[0] = egoPoseJson["rotation"][0];
-  egoPoseInfo.rotation[1] = egoPoseJson["rotation"][1];
-  egoPoseInfo.rotation[2] = egoPoseJson["rotation"][2];
-  egoPoseInfo.rotation[3] = egoPoseJson["rotation"][3];
+  const auto& rotation = egoPoseJson.getNumbers("rotation", 4);
+  egoPoseInfo.rotation[0] = rotation[0];
+  egoPoseInfo.rotation[1] = rotation[1];
+  egoPoseInfo.rotation[2] = rotation[2];
+  egoPoseInfo.rotation[3] = rotation[3];
 
-  egoPoseInfo.timeStamp = egoPoseJson["timestamp"];
+  egoPoseInfo.timeStamp = egoPoseJson.getUnsigned("timestamp");
 
   return egoPoseInfo;
 }
 
-std::map<Token, std::vector<EgoPoseInfo>>
+std::unordered_map<Token, EgoPoseStore>
 MetaDataReader::loadEgoPoseInfos(
   const fs::path& filePath,
-  std::map<Token, Token> sampleDataToken2SceneToken)
+  const std::unordered_map<Token, Token>& sampleDataToken2SceneToken,
+  bool skipUnknownSampleData)
 {
 
-  auto egoPoseJsons = slurpJsonFile(filePath);
-  std::map<Token, std::vector<EgoPoseInfo>> sceneToken2EgoPoseInfos;
+  std::unordered_map<Token, std::vector<EgoPoseInfo>> sceneToken2EgoPoseInfos;
 
-  for (const auto& egoPoseJson : egoPoseJsons) {
-    Token sampleDataToken = egoPoseJson["token"];
+  readJsonTable(filePath, [&](const JsonRecord& egoPoseJson) {
+    const Token sampleDataToken = egoPoseJson.getToken("token");
+    if (skipUnknownSampleData &&
+        (sampleDataToken2SceneToken.count(sampleDataToken) == 0)) {
+      return;
+    }
     const auto& sceneToken = findOrThrow(sampleDataToken2SceneToken,
                                          sampleDataToken,
                                          " Unable to find sample token");
@@ -244,61 +468,53 @@ MetaDataReader::loadEgoPoseInfos(
 
     EgoPoseInfo egoPoseInfo = egoPoseJson2EgoPoseInfo(egoPoseJson);
     egoPoses.push_back(egoPoseInfo);
-  }
+  });
 
-  return sceneToken2EgoPoseInfos;
+  std::unordered_map<Token, EgoPoseStore> sceneToken2EgoPoses;
+  for (auto& sceneEgoPoses : sceneToken2EgoPoseInfos) {
+    sceneToken2EgoPoses.emplace(sceneEgoPoses.first,
+                                EgoPoseStore(std::move(sceneEgoPoses.second)));
+  }
+  return sceneToken2EgoPoses;
 }
 
-std::map<Token, CalibratedSensorInfo>
+std::unordered_map<Token, CalibratedSensorInfo>
 MetaDataReader::loadCalibratedSensorInfo(const fs::path& filePath)
 {
-  auto calibratedSensorJsons = slurpJsonFile(filePath);
-  std::map<Token, CalibratedSensorInfo>
+  std::unordered_map<Token, CalibratedSensorInfo>
     calibratedSensorToken2CalibratedSensorInfo;
 
-  for (const auto& calibratedSensorJson : calibratedSensorJsons) {
-    Token token = calibratedSensorJson["token"];
-    auto translation = calibratedSensorJson["translation"];
-    auto rotation = calibratedSensorJson["rotation"];
+  readJsonTable(filePath, [&](const JsonRecord& calibratedSensorJson) {
+    const Token token = calibratedSensorJson.getToken("token");
+    const auto& translation = calibratedSensorJson.getNumbers("translation", 3);
+    const auto& rotation = calibratedSensorJson.getNumbers("rotation", 4);
     CalibratedSensorInfo calibratedSensorInfo{
       token,
-      calibratedSensorJson["sensor_token"],
+      calibratedSensorJson.getToken("sensor_token"),
       { translation[0], translation[1], translation[2] },
       { rotation[0], rotation[1], rotation[2], rotation[3] },
-
-#if CMAKE_CXX_STANDARD < 17
       {} // IntrinsicsMatrix
-#endif
-
     };
 
-#if CMAKE_CXX_STANDARD >= 17
-    std::optional<json::json> sensor_intrinsics =
-#else
-    json::json sensor_intrinsics =
-#endif
-      calibratedSensorJson["rotation"];
-
     calibratedSensorToken2CalibratedSensorInfo.emplace(token,
                                                        calibratedSensorInfo);
-  }
+  });
 
   return calibratedSensorToken2CalibratedSensorInfo;
 }
 
-std::map<Token, CalibratedSensorName>
+std::unordered_map<Token, CalibratedSensorName>
 MetaDataReader::loadCalibratedSensorNames(const fs::path& filePath)
 {
-  auto calibratedSensorNameJsons = slurpJsonFile(filePath);
-  std::map<Token, CalibratedSensorName> sensorToken2CalibratedSensorName;
+  std::unordered_map<Token, CalibratedSensorName> sensorToken2CalibratedSensorName;
 
-  for (const auto& calibratedSensorNameJson : calibratedSensorNameJsons) {
+  readJsonTable(filePath, [&](const JsonRecord& calibratedSensorNameJson) {
     sensorToken2CalibratedSensorName.emplace(
-      calibratedSensorNameJson["token"],
-      CalibratedSensorName{ calibratedSensorNameJson["token"],
-                            calibratedSensorNameJson["channel"],
-                            calibratedSensorNameJson["modality"] });
-  };
+      calibratedSensorNameJson.getToken("token"),
+      CalibratedSensorName{ calibratedSensorNameJson.getToken("token"),
+                            calibratedSensorNameJson.getString("channel"),
+                            calibratedSensorNameJson.getString("modality") });
+  });
 
   return sensorToken2CalibratedSensorName;
 }
@@ -315,6 +531,26 @@ MetaDataReader::getAllSceneTokens() const
   return tokens;
 }
 
+std::vector<Token>
+MetaDataReader::getShardSceneTokens(uint32_t shardIndex,
+                                    uint32_t shardCount) const
+{
+  assert(loadFromDirectoryCalled);
+  shardCount = std::max<uint32_t>(shardCount, 1);
+  if (loadedShardCount > 1) {
+    if ((shardIndex != loadedShardIndex) || (shardCount != loadedShardCount)) {
+      throw std::invalid_argument("the metadata was loaded for another shard");
+    }
+    // The other scenes were dropped
+    return getAllSceneTokens();
+  }
+  if (shardCount == 1) {
+    return getAllSceneTokens();
+  }
+  return selectShardScenes(
+    getAllSceneTokens(), getSceneSampleDataNumbers(), shardIndex, shardCount);
+}
+
 #if CMAKE_CXX_STANDARD >= 17
 std::optional<SceneInfo> MetaDataReader::getSceneInfo(const Token& sceneToken) const
 #else
@@ -344,62 +580,45 @@ boost::shared_ptr<SceneInfo> MetaDataReader::getSceneInfo(const Token& sceneToke
 
 }
 
-std::vector<SampleDataInfo>
+Span<SampleDataInfo>
 MetaDataReader::getSceneSampleData(const Token& sceneToken) const
 {
-  std::vector<SampleDataInfo> sampleDataInfos;
-
-  const auto& sceneSamples = findOrThrow(scene2Samples, sceneToken, " sample for scene token");
-  for (const auto& sceneSample : sceneSamples) {
-    const Token& sceneSampleToken = sceneSample.token;
-    const auto& sceneSampleDatas = findOrThrow(sample2SampleData, sceneSampleToken, " sample data for sample token");
-
-    for (const SampleDataInfo& sampleData : sceneSampleDatas) {
-      sampleDataInfos.push_back(sampleData);
-    }
-  }
-
-  return sampleDataInfos;
+  return findOrThrow(scene2SampleData, sceneToken, " sample data for scene token");
 }
 
-std::vector<EgoPoseInfo>
-MetaDataReader::getEgoPoseInfo(const Token& sceneToken) const
+const EgoPoseStore&
+MetaDataReader::getEgoPoses(const Token& sceneToken) const
 {
   return findOrThrow(scene2EgoPose, sceneToken, "ego pose by scene token");
 }
 
-std::map<Token, SampleInfo>
+Span<SampleInfo>
 MetaDataReader::getSceneSamples(const Token& sceneToken) const
 {
-  std::map<Token, SampleInfo> samples;
-
-  const auto& sceneSamples = findOrThrow(scene2Samples, sceneToken, "unable to find sample for scene token");
+  return findOrThrow(scene2Samples, sceneToken, "unable to find sample for scene token");
+}
 
-  for (const auto& sample : sceneSamples)
-  {
-    samples.insert({sample.token, sample});
+const SampleInfo*
+MetaDataReader::findSampleInfo(const Token& sampleToken) const
+{
+  auto it = sampleToken2SampleInfo.find(sampleToken);
+  if (it == sampleToken2SampleInfo.end()) {
+    return nullptr;
   }
-
-  return samples;
+  return &it->second;
 }
 
-std::map<Token, std::vector<SampleAnnotationInfo>>
-MetaDataReader::getSceneSampleAnnotations(const Token& sceneToken) const
+Span<SampleAnnotationInfo>
+MetaDataReader::getSampleAnnotations(const Token& sampleToken) const
 {
-  std::map<Token, std::vector<SampleAnnotationInfo>> annotations;
-
-  const auto& sceneSamples = findOrThrow(scene2Samples, sceneToken, "unable to find sample for scene token");
-
-  for (const auto& sceneSample : sceneSamples) {
-    const Token& sampleToken = sceneSample.token;
-    const std::vector<SampleAnnotationInfo>& sampleAnnotations = findOrThrow(sample2SampleAnnotations, sampleToken, "unable to find sample for scene token");
-    annotations.insert({sampleToken, sampleAnnotations});
+  auto it = sample2SampleAnnotations.find(sampleToken);
+  if (it == sample2SampleAnnotations.end()) {
+    return Span<SampleAnnotationInfo>();
   }
-
-  return annotations;
+  return it->second;
 }
 
-CalibratedSensorInfo
+const CalibratedSensorInfo&
 MetaDataReader::getCalibratedSensorInfo(
   const Token& calibratedSensorToken) const
 {
@@ -407,7 +626,7 @@ MetaDataReader::getCalibratedSensorInfo(
   "calibrated sensor info by sensor token");
 }
 
-CalibratedSensorName
+const CalibratedSensorName&
 MetaDataReader::getSensorName(const Token& sensorToken) const
 {
   return findOrThrow(sensorToken2CalibratedSensorName, sensorToken, "sensor name by sensor token");
@@ -454,84 +673,81 @@ boost::shared_ptr<SceneInfo> MetaDataReader::getSceneInfoByNumber(const uint32_t
 
 #endif
 
-std::map<Token, AttributeInfo>
+std::unordered_map<Token, AttributeInfo>
 MetaDataReader::loadAttributeInfo(const fs::path& filePath)
 {
-  auto attributeJsons = slurpJsonFile(filePath);
-  std::map<Token, AttributeInfo> attributeInfo;
+  std::unordered_map<Token, AttributeInfo> attributeInfo;
 
-  for (const auto& json : attributeJsons)
+  readJsonTable(filePath, [&](const JsonRecord& json)
   {
-    attributeInfo.insert({json["token"], AttributeInfo{json["name"],
-                                                       json["description"]
-                                                       }
+    attributeInfo.insert({json.getToken("token"), AttributeInfo{json.getString("name"),
+                                                                 json.getString("description")
+                                                                 }
                           });
-  }
+  });
 
   return attributeInfo;
 }
 
-std::map<Token, CategoryInfo>
+std::unordered_map<Token, CategoryInfo>
 MetaDataReader::loadCategories(const fs::path& filePath)
 {
-  auto categoryJsons = slurpJsonFile(filePath);
-  std::map<Token, CategoryInfo> categoryInfo;
+  std::unordered_map<Token, CategoryInfo> categoryInfo;
 
-  for (const auto& json : categoryJsons)
+  readJsonTable(filePath, [&](const JsonRecord& json)
   {
-    categoryInfo.insert({json["token"], CategoryInfo{json["name"],
-                                                     json["description"]
-                                                     }
+    categoryInfo.insert({json.getToken("token"), CategoryInfo{json.getString("name"),
+                                                               json.getString("description")
+                                                               }
                          });
-  }
+  });
 
   return categoryInfo;
 }
 
-std::map<Token, InstanceInfo>
+std::unordered_map<Token, InstanceInfo>
 MetaDataReader::loadInstances(const fs::path& filePath)
 {
-  auto instanceJsons = slurpJsonFile(filePath);
-  std::map<Token, InstanceInfo> instanceInfo;
+  std::unordered_map<Token, InstanceInfo> instanceInfo;
 
-  for (const auto& json : instanceJsons)
+  readJsonTable(filePath, [&](const JsonRecord& json)
   {
-    instanceInfo.insert({json["token"], InstanceInfo{json["category_token"],
-                                                     json["nbr_annotations"]
-                                                     }
+    instanceInfo.insert({json.getToken("token"), InstanceInfo{json.getToken("category_token"),
+                                                               static_cast<uint32_t>(json.getUnsigned("nbr_annotations"))
+                                                               }
                          });
-  }
+  });
 
   return instanceInfo;
 }
 
-std::map<Token, std::vector<SampleAnnotationInfo>>
+std::unordered_map<Token, std::vector<SampleAnnotationInfo>>
 MetaDataReader::loadSampleAnnotations(const fs::path& filePath)
 {
-  auto sampleAnnotationJsons = slurpJsonFile(filePath);
-  std::map<Token, std::vector<SampleAnnotationInfo>> sampleAnnotations;
+  std::unordered_map<Token, std::vector<SampleAnnotationInfo>> sampleAnnotations;
 
-  for (const auto& json : sampleAnnotationJsons)
+  readJsonTable(filePath, [&](const JsonRecord& json)
   {
-    const Token sampleToken = json["sample_token"];
+    const Token sampleToken = json.getToken("sample_token");
     std::vector<SampleAnnotationInfo>& sampleAnnotationInfo = getExistingOrDefault(sampleAnnotations, sampleToken);
 
-    const auto translation = json["translation"];
-    const auto rotation = json["rotation"];
-    const auto size = json["size"];
+    const auto& translation = json.getNumbers("translation", 3);
+    const auto& rotation = json.getNumbers("rotation", 4);
+    const auto& size = json.getNumbers("size", 3);
 
-    sampleAnnotationInfo.push_back(SampleAnnotationInfo{json["token"],
+    sampleAnnotationInfo.push_back(SampleAnnotationInfo{json.getToken("token"),
                                                         //json["sample_token"], // not used
-                                                        json["instance_token"],
+                                                        json.getToken("instance_token"),
                                                         //json["visibility_token"], // not used
                                                         //json["attribute_tokens"], // not used
-                                                        {translation[0], translation[1], translation[2]},
-                                                        {rotation[0], rotation[1], rotation[2], rotation[3]},
-                                                        {size[0], size[1], size[2]},
-                                                        std::string("")
+                                                        {static_cast<float>(translation[0]), static_cast<float>(translation[1]), static_cast<float>(translation[2])},
+                                                        {static_cast<float>(rotation[0]), static_cast<float>(rotation[1]), static_cast<float>(rotation[2]), static_cast<float>(rotation[3])},
+                                                        {static_cast<float>(size[0]), static_cast<float>(size[1]), static_cast<float>(size[2])},
+                                                        std::string(""),
+                                                        {0.0f, 0.0f, 0.0f, 0.0f}
                                                         }
                                    );
-  }
+  });
 
   return sampleAnnotations;
 }
@@ -1,6 +1,10 @@
 #include "nuscenes2bag/NuScenes2Bag.hpp"
+#include "nuscenes2bag/ConversionManifest.hpp"
+#include "nuscenes2bag/ConversionStats.hpp"
 #include "nuscenes2bag/ImageDirectoryConverter.hpp"
 #include "nuscenes2bag/LidarDirectoryConverter.hpp"
+#include "nuscenes2bag/MemoryBudget.hpp"
+#include "nuscenes2bag/MessageSink.hpp"
 #include "nuscenes2bag/RadarObjects.h"
 #include "nuscenes2bag/RunEvery.hpp"
 #include "nuscenes2bag/SceneConverter.hpp"
@@ -22,7 +26,11 @@
 
 #include <iostream>
 
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <future>
+#include <memory>
 #include <std_msgs/Int32.h>
 #include <std_msgs/String.h>
 #include <thread>
@@ -34,10 +42,281 @@ namespace nuscenes2bag {
 NuScenes2Bag::NuScenes2Bag() {}
 
 void
+NuScenes2Bag::setSceneCompletionCallback(const SceneCompletionCallback& callback)
+{
+  sceneCompletionCallback = callback;
+}
+
+// Largest scenes first (LPT), so that the end of the run is not spent on a
+// few big scenes while the other threads are idle
+template<typename SceneConverterPtr>
+static std::vector<size_t>
+orderByDecreasingCost(const std::vector<SceneConverterPtr>& sceneConverters,
+                      const fs::path& inDatasetPath)
+{
+  std::vector<uint64_t> costs;
+  std::vector<size_t> order;
+  for (size_t i = 0; i < sceneConverters.size(); ++i) {
+    costs.push_back(sceneConverters[i]->estimateCost(inDatasetPath));
+    order.push_back(i);
+  }
+  std::stable_sort(order.begin(), order.end(), [&costs](size_t a, size_t b) {
+    return costs[a] > costs[b];
+  });
+  return order;
+}
+
+static double
+secondsSince(ConversionStats::Clock::time_point start)
+{
+  return std::chrono::duration<double>(ConversionStats::Clock::now() - start)
+    .count();
+}
+
+// Null unless statistics were requested
+static std::unique_ptr<ConversionStats>
+makeConversionStats(const ConversionOptions& conversionOptions,
+                    const std::vector<Token>& sceneTokens,
+                    const MetaDataReader& metaDataReader,
+                    const std::string& metaDataSource,
+                    double metaDataSeconds)
+{
+  std::unique_ptr<ConversionStats> stats;
+  if (conversionOptions.statsJsonPath.empty()) {
+    return stats;
+  }
+  stats.reset(new ConversionStats(sceneTokens.size()));
+  stats->setMetaDataLoad(metaDataSource,
+                         metaDataSeconds,
+                         (metaDataSource == "json")
+                           ? metaDataReader.getTableLoadSeconds()
+                           : std::vector<std::pair<std::string, double>>());
+  for (size_t i = 0; i < sceneTokens.size(); ++i) {
+    auto sceneInfo = metaDataReader.getSceneInfo(sceneTokens[i]);
+    stats->setScene(i, sceneTokens[i].str(), sceneInfo ? sceneInfo->name : "");
+  }
+  return stats;
+}
+
+// Scenes whose bag in the output directory was completed from the same
+// metadata and options, none if skipping is disabled
+static std::vector<bool>
+findUpToDateScenes(const std::vector<Token>& sceneTokens,
+                   const MetaDataReader& metaDataReader,
+                   const ConversionManifest& manifest,
+                   const std::string& fingerprint,
+                   const fs::path& outputRosbagPath,
+                   const ConversionOptions& conversionOptions)
+{
+  std::vector<bool> upToDateScenes(sceneTokens.size(), false);
+  if (!conversionOptions.skipUpToDateScenes) {
+    return upToDateScenes;
+  }
+  size_t upToDateSceneNumber = 0;
+  for (size_t i = 0; i < sceneTokens.size(); ++i) {
+    auto sceneInfo = metaDataReader.getSceneInfo(sceneTokens[i]);
+    if (sceneInfo &&
+        manifest.isUpToDate(sceneTokens[i], fingerprint,
+                            SceneConverter::getBagPath(outputRosbagPath, sceneInfo->sceneId, conversionOptions.outputFormat))) {
+      upToDateScenes[i] = true;
+      upToDateSceneNumber++;
+    }
+  }
+  if (upToDateSceneNumber > 0) {
+    std::cout << "Skipping " << upToDateSceneNumber
+              << " scenes already up to date in " << outputRosbagPath.string()
+              << std::endl;
+  }
+  return upToDateScenes;
+}
+
+// Converts one scene on a pool thread. The outcome is published exactly once
+// per scene, waitForScenes relies on it to return.
+static void
+runScene(SceneConverter& sceneConverter,
+         size_t sceneIndex,
+         std::promise<void>& scenePromise,
+         const fs::path& inDatasetPath,
+         const fs::path& outputRosbagPath,
+         FileProgress& fileProgress)
+{
+  try {
+    sceneConverter.run(inDatasetPath, outputRosbagPath, fileProgress);
+    scenePromise.set_value();
+  } catch (...) {
+    scenePromise.set_exception(std::current_exception());
+  }
+  fileProgress.addFinishedScene(sceneIndex);
+}
+
+// Sleeps until a scene finishes, reporting the progress once per second in
+// the meantime. The manifest is saved after every converted scene, so that
+// an interrupted run can be resumed. Returns the number of scenes that failed.
+static uint32_t
+waitForScenes(std::vector<std::future<void>>& sceneFutures,
+              const std::vector<Token>& sceneTokens,
+              const std::vector<bool>& upToDateScenes,
+              const MetaDataReader& metaDataReader,
+              ConversionManifest& manifest,
+              const std::string& fingerprint,
+              const fs::path& outputRosbagPath,
+              OutputFormat outputFormat,
+              FileProgress& fileProgress,
+              const SceneCompletionCallback& sceneCompletionCallback)
+{
+  auto printProgress = [&fileProgress]() {
+    std::cout << "Progress: "
+              << static_cast<int>(fileProgress.getProgressPercentage() * 100)
+              << "% [" << fileProgress.processedFiles << "/"
+              << fileProgress.toProcessFiles << "]" << std::endl;
+  };
+  RunEvery<decltype(printProgress)> showProgress(std::chrono::milliseconds(1000),
+                                                 std::move(printProgress));
+
+  uint32_t failedSceneNumber = 0;
+  for (size_t remaining = sceneFutures.size(); remaining > 0;) {
+    size_t sceneIndex = 0;
+    if (!fileProgress.waitForFinishedScene(sceneIndex,
+                                           showProgress.nextExecutionTime())) {
+      showProgress.update();
+      continue;
+    }
+    remaining--;
+
+    SceneConversionResult result;
+    result.sceneToken = sceneTokens[sceneIndex];
+    result.skipped = upToDateScenes[sceneIndex];
+    auto sceneInfo = metaDataReader.getSceneInfo(result.sceneToken);
+    result.sceneName = sceneInfo ? sceneInfo->name : result.sceneToken.str();
+    try {
+      sceneFutures[sceneIndex].get();
+    } catch (const std::exception& e) {
+      result.success = false;
+      result.errorMessage = e.what();
+    } catch (...) {
+      result.success = false;
+      result.errorMessage = "unknown error";
+    }
+
+    if (!result.skipped && sceneInfo) {
+      manifest.setSceneResult(
+        result.sceneToken, result.sceneName, fingerprint,
+        SceneConverter::getBagPath(outputRosbagPath, sceneInfo->sceneId, outputFormat),
+        result.success);
+      try {
+        manifest.save();
+      } catch (const std::exception& e) {
+        std::cerr << "Warning: unable to write the manifest: " << e.what()
+                  << std::endl;
+      }
+    }
+
+    if (!result.success) {
+      failedSceneNumber++;
+      std::cerr << "Error: unable to convert scene " << result.sceneName
+                << ": " << result.errorMessage << std::endl;
+    }
+    if (sceneCompletionCallback) {
+      sceneCompletionCallback(result);
+    }
+  }
+  showProgress.lambda();
+  return failedSceneNumber;
+}
+
+// The stages peak at different times, their peaks can add up to more than
+// the total one
+static void
+printMemoryStats(const MemoryStats& memoryStats)
+{
+  auto toMiB = [](uint64_t bytes) { return bytes / (1024 * 1024); };
+  std::cout << "Peak memory of the decoded messages: "
+            << toMiB(memoryStats.peakBytes) << " MiB";
+  if (memoryStats.limitBytes > 0) {
+    std::cout << " (limit " << toMiB(memoryStats.limitBytes) << " MiB)";
+  }
+  for (size_t i = 0; i < memoryStats.stagePeakBytes.size(); ++i) {
+    if (memoryStats.stagePeakBytes[i] > 0) {
+      std::cout << ", " << getStageName(static_cast<ConversionStage>(i))
+                << " " << toMiB(memoryStats.stagePeakBytes[i]) << " MiB";
+    }
+  }
+  std::cout << std::endl;
+}
+
+// The scenes of the shard of this node, all of them without sharding
+static std::vector<Token>
+selectShardSceneTokens(const MetaDataReader& metaDataReader,
+                       const ConversionOptions& conversionOptions)
+{
+  std::vector<Token> sceneTokens = metaDataReader.getShardSceneTokens(
+    conversionOptions.shardIndex, conversionOptions.shardCount);
+  if (conversionOptions.shardCount > 1) {
+    std::cout << "Shard " << conversionOptions.shardIndex << " of "
+              << conversionOptions.shardCount << ": " << sceneTokens.size()
+              << " scenes" << std::endl;
+  }
+  return sceneTokens;
+}
+
+// Publishes the scenes one after the other in the dataset order, on the
+// calling thread. Returns true if all of them were published.
+static bool
+publishScenes(const std::vector<Token>& sceneTokens,
+              const MetaDataReader& metaDataReader,
+              const ConversionOptions& conversionOptions,
+              const fs::path& inDatasetPath,
+              DecodeWorkerPool* decodeWorkerPool,
+              FileReadPool* fileReadPool,
+              MemoryBudget* memoryBudget,
+              const SceneCompletionCallback& sceneCompletionCallback)
+{
+  ros::NodeHandle nodeHandle;
+  // Shared by the scenes, so that subscribers stay connected between them
+  MessageSink sink(nodeHandle, conversionOptions.publishSpeedFactor);
+  FileProgress fileProgress;
+
+  uint32_t publishedSceneNumber = 0;
+  for (const Token& sceneToken : sceneTokens) {
+    if (!ros::ok()) {
+      break;
+    }
+    SceneConversionResult result;
+    result.sceneToken = sceneToken;
+    auto sceneInfo = metaDataReader.getSceneInfo(sceneToken);
+    result.sceneName = sceneInfo ? sceneInfo->name : sceneToken.str();
+    std::cout << "Publishing scene " << result.sceneName << std::endl;
+
+    try {
+      SceneConverter sceneConverter(metaDataReader, conversionOptions,
+                                    decodeWorkerPool, SceneStatsRecorder(),
+                                    fileReadPool, memoryBudget);
+      sceneConverter.submit(sceneToken, fileProgress);
+      sceneConverter.publish(inDatasetPath, sink, fileProgress);
+      publishedSceneNumber++;
+    } catch (const std::exception& e) {
+      result.success = false;
+      result.errorMessage = e.what();
+      std::cerr << "Error: unable to publish scene " << result.sceneName
+                << ": " << result.errorMessage << std::endl;
+    }
+    if (sceneCompletionCallback) {
+      sceneCompletionCallback(result);
+    }
+  }
+
+  std::cout << "Published " << publishedSceneNumber << " of "
+            << sceneTokens.size() << " scenes" << std::endl;
+  printMemoryStats(memoryBudget->getStats());
+  return publishedSceneNumber == sceneTokens.size();
+}
+
+bool
 NuScenes2Bag::convertDirectory(const fs::path& inDatasetPath,
                                const std::string& version,
                                const fs::path& outputRosbagPath,
                                int threadNumber,
+                               const ConversionOptions& conversionOptions,
 #if CMAKE_CXX_STANDARD >= 17
                                std::optional<int32_t> sceneNumberOpt
 #else
@@ -50,33 +329,97 @@ NuScenes2Bag::convertDirectory(const fs::path& inDatasetPath,
     threadNumber = 1;
   }
 
+  const auto startTime = ConversionStats::Clock::now();
+
   MetaDataReader metaDataReader;
 
   fs::path metadataPath = inDatasetPath;
   metadataPath /= fs::path(version); // Append sub-directory
   std::cout << "Loading metadata from " + metadataPath.string() + " ..." << std::endl;
 
-  try {
-    // If file is not found, a runtime_error is thrown
-  metaDataReader.loadFromDirectory(metadataPath);
-  } catch (const runtime_error& e) {
+  // Restricted to the scenes of the shard, then cached per shard
+  uint32_t metaDataShardIndex = 0;
+  uint32_t metaDataShardCount = 1;
+  if (conversionOptions.shardMetaDataOnly && (conversionOptions.shardCount > 1)) {
+    metaDataShardIndex = conversionOptions.shardIndex;
+    metaDataShardCount = conversionOptions.shardCount;
+  }
+
+  fs::path cachePath = conversionOptions.metaDataCachePath;
+  if (cachePath.empty()) {
+    cachePath = inDatasetPath / (version + ".cache");
+  }
+  if (metaDataShardCount > 1) {
+    cachePath += ".shard-" + std::to_string(metaDataShardIndex) + "-of-" +
+                 std::to_string(metaDataShardCount);
+  }
+
+  std::string metaDataSource = "cache";
+  if (conversionOptions.useMetaDataCache &&
+      metaDataReader.loadFromCache(cachePath, metadataPath, metaDataShardIndex,
+                                   metaDataShardCount)) {
+    std::cout << "Loaded metadata cache " + cachePath.string() << std::endl;
+  } else {
+    metaDataSource = "json";
+    try {
+      // If file is not found, a runtime_error is thrown, if it is malformed
+      // an InvalidMetaDataException
+      metaDataReader.loadFromDirectory(metadataPath, metaDataShardIndex,
+                                       metaDataShardCount);
+    } catch (const std::exception& e) {
       std::cerr << "Error: " << e.what() << '\n';
-      std::exit(-1);
+      return false;
+    }
+
+    if (conversionOptions.useMetaDataCache) {
+      try {
+        metaDataReader.saveToCache(cachePath, metadataPath);
+      } catch (const std::exception& e) {
+        std::cerr << "Warning: unable to write metadata cache: " << e.what()
+                  << std::endl;
+      }
+    }
   }
 
+  const double metaDataSeconds = secondsSince(startTime);
+
   cout << "Initializing " << threadNumber << " threads..." << endl;
 
-#if (CMAKE_CXX_STANDARD >= 17) && (BOOST_VERSION >= 106600)
-  boost::asio::thread_pool pool(threadNumber);
-  std::vector<std::unique_ptr<SceneConverter>> sceneConverters;
+  // Shared by all the scenes, workers left idle by a finished scene decode
+  // samples of the scenes still in progress
+#if CMAKE_CXX_STANDARD >= 17
+  std::unique_ptr<DecodeWorkerPool> decodeWorkerPool;
+  if (conversionOptions.decodeThreadNumber > 1) {
+    decodeWorkerPool = std::make_unique<DecodeWorkerPool>(conversionOptions.decodeThreadNumber);
+  }
 #else
-  ThreadPool<FIFO> pool(threadNumber);
-  std::vector<boost::shared_ptr<SceneConverter>> sceneConverters;
+  boost::shared_ptr<DecodeWorkerPool> decodeWorkerPool;
+  if (conversionOptions.decodeThreadNumber > 1) {
+    decodeWorkerPool = boost::make_shared<DecodeWorkerPool>(conversionOptions.decodeThreadNumber);
+  }
+#endif
+
+  // Likewise shared, reading the files of all the scenes in progress
+#if CMAKE_CXX_STANDARD >= 17
+  std::unique_ptr<FileReadPool> fileReadPool;
+  if (conversionOptions.readThreadNumber > 0) {
+    fileReadPool = std::make_unique<FileReadPool>(conversionOptions.readThreadNumber);
+  }
+#else
+  boost::shared_ptr<FileReadPool> fileReadPool;
+  if (conversionOptions.readThreadNumber > 0) {
+    fileReadPool = boost::make_shared<FileReadPool>(conversionOptions.readThreadNumber);
+  }
 #endif
 
+  // Bounds the decoded messages of all the scenes, and measures them
+  MemoryBudget memoryBudget(conversionOptions.maxMemoryBytes);
+
   FileProgress fileProgress;
 
-  fs::create_directories(outputRosbagPath);
+  if (!conversionOptions.publish) {
+    fs::create_directories(outputRosbagPath);
+  }
 
   std::vector<Token> chosenSceneTokens;
 
@@ -88,35 +431,78 @@ NuScenes2Bag::convertDirectory(const fs::path& inDatasetPath,
       chosenSceneTokens.push_back(sceneInfoOpt->token);
     } else {
       std::cout << "Scene with ID=" << sceneNumberOpt.value() << " not found!" << std::endl;
+      return false;
     }
   } else {
-    chosenSceneTokens = metaDataReader.getAllSceneTokens();;
+    chosenSceneTokens = selectShardSceneTokens(metaDataReader, conversionOptions);
+  }
+
+  if (conversionOptions.publish) {
+    return publishScenes(chosenSceneTokens, metaDataReader, conversionOptions,
+                         inDatasetPath, decodeWorkerPool.get(),
+                         fileReadPool.get(), &memoryBudget,
+                         sceneCompletionCallback);
   }
 
-  for (const auto& sceneToken : chosenSceneTokens) {
+  std::unique_ptr<ConversionStats> stats =
+    makeConversionStats(conversionOptions, chosenSceneTokens, metaDataReader,
+                        metaDataSource, metaDataSeconds);
+
+  ConversionManifest manifest(outputRosbagPath, conversionOptions.shardIndex,
+                              conversionOptions.shardCount);
+  manifest.load();
+  const std::string fingerprint =
+    makeConversionFingerprint(metadataPath, conversionOptions);
+  const std::vector<bool> upToDateScenes =
+    findUpToDateScenes(chosenSceneTokens, metaDataReader, manifest,
+                       fingerprint, outputRosbagPath, conversionOptions);
+
+  // Declared before the pool, which joins its threads when destroyed
+  std::vector<std::promise<void>> scenePromises(chosenSceneTokens.size());
+  std::vector<std::future<void>> sceneFutures;
+  std::vector<std::unique_ptr<SceneConverter>> sceneConverters;
+  std::vector<size_t> converterSceneIndices;
+
+  for (size_t sceneIndex = 0; sceneIndex < chosenSceneTokens.size(); ++sceneIndex) {
+    sceneFutures.push_back(scenePromises[sceneIndex].get_future());
+    if (upToDateScenes[sceneIndex]) {
+      scenePromises[sceneIndex].set_value();
+      fileProgress.addFinishedScene(sceneIndex);
+      continue;
+    }
     std::unique_ptr<SceneConverter> sceneConverter =
-      std::make_unique<SceneConverter>(metaDataReader);
-    sceneConverter->submit(sceneToken, fileProgress);
-    SceneConverter* sceneConverterPtr = sceneConverter.get();
+      std::make_unique<SceneConverter>(metaDataReader, conversionOptions, decodeWorkerPool.get(),
+                                      SceneStatsRecorder(stats.get(), sceneIndex),
+                                      fileReadPool.get(), &memoryBudget);
+    try {
+      sceneConverter->submit(chosenSceneTokens[sceneIndex], fileProgress);
+    } catch (...) {
+      scenePromises[sceneIndex].set_exception(std::current_exception());
+      fileProgress.addFinishedScene(sceneIndex);
+      continue;
+    }
     sceneConverters.push_back(std::move(sceneConverter));
-    boost::asio::defer(pool, [&, sceneConverterPtr]() {
-      sceneConverterPtr->run(inDatasetPath, outputRosbagPath, fileProgress);
-    });
+    converterSceneIndices.push_back(sceneIndex);
   }
 
-  RunEvery showProgress(std::chrono::milliseconds(1000), [&fileProgress]() {
-    std::cout << "Progress: "
-              << static_cast<int>(fileProgress.getProgressPercentage() * 100)
-              << "% [" << fileProgress.processedFiles << "/"
-              << fileProgress.toProcessFiles << "]" << std::endl;
-  });
+  std::vector<size_t> converterOrder = orderByDecreasingCost(sceneConverters, inDatasetPath);
+
+  boost::asio::thread_pool pool(threadNumber);
 
-  // TODO: replace check with futures
-  while (fileProgress.processedFiles != fileProgress.toProcessFiles) {
-    showProgress.update();
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  for (size_t converterIndex : converterOrder) {
+    SceneConverter* sceneConverterPtr = sceneConverters[converterIndex].get();
+    const size_t sceneIndex = converterSceneIndices[converterIndex];
+    boost::asio::defer(pool, [&, sceneConverterPtr, sceneIndex]() {
+      runScene(*sceneConverterPtr, sceneIndex, scenePromises[sceneIndex],
+               inDatasetPath, outputRosbagPath, fileProgress);
+    });
   }
 
+  const uint32_t failedSceneNumber =
+    waitForScenes(sceneFutures, chosenSceneTokens, upToDateScenes,
+                  metaDataReader, manifest, fingerprint, outputRosbagPath,
+                  conversionOptions.outputFormat, fileProgress, sceneCompletionCallback);
+
   pool.join();
 
 #else
@@ -130,43 +516,109 @@ NuScenes2Bag::convertDirectory(const fs::path& inDatasetPath,
       chosenSceneTokens.push_back(sceneInfo->token);
     } else {
       std::cout << "Scene with ID=" << sceneNumber << " not found!" << std::endl;
+      return false;
     }
   } else {
-    chosenSceneTokens = metaDataReader.getAllSceneTokens();
+    chosenSceneTokens = selectShardSceneTokens(metaDataReader, conversionOptions);
     std::cout << "Found " << chosenSceneTokens.size() << " scenes in directory" << std::endl;
   }
 
+  if (conversionOptions.publish) {
+    return publishScenes(chosenSceneTokens, metaDataReader, conversionOptions,
+                         inDatasetPath, decodeWorkerPool.get(),
+                         fileReadPool.get(), &memoryBudget,
+                         sceneCompletionCallback);
+  }
+
+  std::unique_ptr<ConversionStats> stats =
+    makeConversionStats(conversionOptions, chosenSceneTokens, metaDataReader,
+                        metaDataSource, metaDataSeconds);
+
+  ConversionManifest manifest(outputRosbagPath, conversionOptions.shardIndex,
+                              conversionOptions.shardCount);
+  manifest.load();
+  const std::string fingerprint =
+    makeConversionFingerprint(metadataPath, conversionOptions);
+  const std::vector<bool> upToDateScenes =
+    findUpToDateScenes(chosenSceneTokens, metaDataReader, manifest,
+                       fingerprint, outputRosbagPath, conversionOptions);
+
+  // Declared before the pool, which joins its threads when destroyed
+  std::vector<std::promise<void>> scenePromises(chosenSceneTokens.size());
+  std::vector<std::future<void>> sceneFutures;
+  std::vector<boost::shared_ptr<SceneConverter>> sceneConverters;
+  std::vector<size_t> converterSceneIndices;
+
+  for (size_t sceneIndex = 0; sceneIndex < chosenSceneTokens.size(); ++sceneIndex) {
+    sceneFutures.push_back(scenePromises[sceneIndex].get_future());
+    if (upToDateScenes[sceneIndex]) {
+      scenePromises[sceneIndex].set_value();
+      fileProgress.addFinishedScene(sceneIndex);
+      continue;
+    }
+    boost::shared_ptr<SceneConverter> sceneConverter = boost::make_shared<SceneConverter>(metaDataReader, conversionOptions, decodeWorkerPool.get(), SceneStatsRecorder(stats.get(), sceneIndex), fileReadPool.get(), &memoryBudget);
+    try {
+      sceneConverter->submit(chosenSceneTokens[sceneIndex], fileProgress);
+    } catch (...) {
+      scenePromises[sceneIndex].set_exception(std::current_exception());
+      fileProgress.addFinishedScene(sceneIndex);
+      continue;
+    }
+    sceneConverters.push_back(sceneConverter);
+    converterSceneIndices.push_back(sceneIndex);
+  }
+
+  std::vector<size_t> converterOrder = orderByDecreasingCost(sceneConverters, inDatasetPath);
+
+  ThreadPool<FIFO> pool(threadNumber);
+
   int counter = 0;
 
-  for (const auto& sceneToken : chosenSceneTokens) {
-    boost::shared_ptr<SceneConverter> sceneConverter = boost::make_shared<SceneConverter>(SceneConverter(metaDataReader));
-    sceneConverter->submit(sceneToken, fileProgress);
-    sceneConverters.push_back(std::move(sceneConverter));
+  for (size_t converterIndex : converterOrder) {
+    boost::shared_ptr<SceneConverter> sceneConverter = sceneConverters[converterIndex];
+    const size_t sceneIndex = converterSceneIndices[converterIndex];
 
     // Add task to FIFO queue.
     // If we use 4 threads then we finish converting 4 scenes to bag files
     // before starting to convert the 5th.
-    auto fn1 = [&, sceneConverters]()
+    auto fn1 = [&, sceneConverter, sceneIndex, counter]()
     {
-      auto sceneInfo = metaDataReader.getSceneInfo(sceneToken);
+      auto sceneInfo = metaDataReader.getSceneInfo(chosenSceneTokens[sceneIndex]);
       std::cout << "Converting log " << counter << " of " << chosenSceneTokens.size() << ", " << sceneInfo->name << std::endl;
-      sceneConverters.back()->run(inDatasetPath, outputRosbagPath, fileProgress);
+      runScene(*sceneConverter, sceneIndex, scenePromises[sceneIndex],
+               inDatasetPath, outputRosbagPath, fileProgress);
     };
     pool.enqueue(fn1);
 
     counter++;
   }
 
-  while (fileProgress.processedFiles != fileProgress.toProcessFiles) {
-    std::cout << "Progress: "
-              << static_cast<int>(fileProgress.getProgressPercentage() * 100)
-              << "% [" << fileProgress.processedFiles << "/"
-              << fileProgress.toProcessFiles << "]" << std::endl;
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
-  }
+  const uint32_t failedSceneNumber =
+    waitForScenes(sceneFutures, chosenSceneTokens, upToDateScenes,
+                  metaDataReader, manifest, fingerprint, outputRosbagPath,
+                  conversionOptions.outputFormat, fileProgress, sceneCompletionCallback);
+
+  pool.close();
 
 #endif
 
+  std::cout << "Converted " << (chosenSceneTokens.size() - failedSceneNumber)
+            << " of " << chosenSceneTokens.size() << " scenes" << std::endl;
+
+  const MemoryStats memoryStats = memoryBudget.getStats();
+  printMemoryStats(memoryStats);
+
+  if (stats) {
+    stats->setMemoryStats(memoryStats);
+    try {
+      stats->writeJson(conversionOptions.statsJsonPath, secondsSince(startTime));
+    } catch (const std::exception& e) {
+      std::cerr << "Error: unable to write statistics: " << e.what() << std::endl;
+      return false;
+    }
+  }
+
+  return failedSceneNumber == 0;
 }
 
 }
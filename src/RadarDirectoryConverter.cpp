@@ -1,6 +1,17 @@
 #include "nuscenes2bag/RadarDirectoryConverter.hpp"
+#include "nuscenes2bag/BufferPool.hpp"
+#include "nuscenes2bag/utils.hpp"
 
-#include <pcl_ros/point_cloud.h>
+#include <cassert>
+#include <cstring>
+#include <exception>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if CMAKE_CXX_STANDARD < 17
+#include <boost/make_shared.hpp>
+#endif
 
 using namespace sensor_msgs;
 using namespace std;
@@ -8,23 +19,177 @@ using namespace nuscenes2bag;
 
 namespace nuscenes2bag {
 
+// The nuScenes radar point clouds all share this binary PCD layout, the
+// header is only checked against it
+static const char* const RADAR_FIELDS =
+  "x y z dyn_prop id rcs vx vy vx_comp vy_comp is_quality_valid ambig_state "
+  "x_rms y_rms invalid_state pdh0 vx_rms vy_rms";
+static const char* const RADAR_SIZES = "4 4 4 1 2 4 4 4 4 4 1 1 1 1 1 1 1 1";
+static const char* const RADAR_TYPES = "F F F I I F F F F F I I I I I I I I";
+static const char* const RADAR_COUNTS = "1 1 1 1 1 1 1 1 1 1 1 1 1 1 1 1 1 1";
+// Packed size of a point, without any alignment
+static const size_t RADAR_POINT_STEP = 43;
+
+// Parses the header, returns the offset of the point data.
+// Throws UnableToParseFileException if the layout is not the expected one.
+static size_t
+parseRadarHeader(const std::vector<uint8_t>& bytes,
+                 const std::string& fileName,
+                 size_t& pointNumber)
+{
+  const char* text = reinterpret_cast<const char*>(bytes.data());
+  const size_t size = bytes.size();
+  uint32_t checkedLines = 0;
+  uint64_t width = 0;
+  uint64_t height = 0;
+  bool hasPoints = false;
+
+  size_t lineStart = 0;
+  while (lineStart < size) {
+    const void* newLine =
+      std::memchr(text + lineStart, '\n', size - lineStart);
+    if (newLine == nullptr) {
+      break;
+    }
+    const size_t lineEnd = static_cast<const char*>(newLine) - text;
+    std::string line(text + lineStart, lineEnd - lineStart);
+    if (!line.empty() && (line.back() == '\r')) {
+      line.pop_back();
+    }
+    lineStart = lineEnd + 1;
+
+    const size_t keyEnd = line.find(' ');
+    const std::string key = line.substr(0, keyEnd);
+    const std::string value =
+      (keyEnd == std::string::npos) ? std::string() : line.substr(keyEnd + 1);
+
+    if ((key == "FIELDS" && value == RADAR_FIELDS) ||
+        (key == "SIZE" && value == RADAR_SIZES) ||
+        (key == "TYPE" && value == RADAR_TYPES) ||
+        (key == "COUNT" && value == RADAR_COUNTS)) {
+      checkedLines++;
+    } else if (key == "WIDTH") {
+      width = std::stoull(value);
+    } else if (key == "HEIGHT") {
+      height = std::stoull(value);
+    } else if (key == "POINTS") {
+      pointNumber = std::stoull(value);
+      hasPoints = true;
+    } else if (key == "DATA") {
+      if ((value != "binary") || (checkedLines != 4) || !hasPoints ||
+          (width * height != pointNumber) ||
+          // Divided rather than multiplied, a huge POINTS must not wrap
+          (pointNumber > (size - lineStart) / RADAR_POINT_STEP)) {
+        break;
+      }
+      return lineStart;
+    } else if (key.empty() || (key[0] == '#') || (key == "VERSION") ||
+               (key == "VIEWPOINT")) {
+      continue;
+    } else {
+      break;
+    }
+  }
+  throw UnableToParseFileException(fileName);
+}
+
+// Point fields of the PCD layout, built once from the header description
+static std::vector<PointField>
+makeRadarPointFields()
+{
+  std::istringstream names(RADAR_FIELDS);
+  std::istringstream sizes(RADAR_SIZES);
+  std::istringstream types(RADAR_TYPES);
+  std::vector<PointField> fields;
+  std::string name;
+  uint32_t size = 0;
+  char type = 0;
+  uint32_t offset = 0;
+  while ((names >> name) && (sizes >> size) && (types >> type)) {
+    PointField field;
+    field.name = name;
+    field.offset = offset;
+    field.count = 1;
+    if (type == 'F') {
+      field.datatype = PointField::FLOAT32;
+    } else {
+      field.datatype = (size == 1) ? PointField::INT8 : PointField::INT16;
+    }
+    fields.push_back(field);
+    offset += size;
+  }
+  assert(offset == RADAR_POINT_STEP);
+  return fields;
+}
+
+static const std::vector<PointField>&
+radarPointFields()
+{
+  static const std::vector<PointField> fields = makeRadarPointFields();
+  return fields;
+}
+
+template<typename T>
+static T
+readValue(const uint8_t* point, size_t offset)
+{
+  T value;
+  std::memcpy(&value, point + offset, sizeof(T));
+  return value;
+}
+
+static void
+unpackRadarObject(const uint8_t* point, RadarObject& obj)
+{
+  obj.pose.x = readValue<float>(point, 0);
+  obj.pose.y = readValue<float>(point, 4);
+  obj.pose.z = readValue<float>(point, 8);
+  obj.dyn_prop = readValue<int8_t>(point, 12);
+  obj.id = readValue<int16_t>(point, 13);
+  obj.rcs = readValue<float>(point, 15);
+  obj.vx = readValue<float>(point, 19);
+  obj.vy = readValue<float>(point, 23);
+  obj.vx_comp = readValue<float>(point, 27);
+  obj.vy_comp = readValue<float>(point, 31);
+  obj.is_quality_valid = readValue<int8_t>(point, 35);
+  obj.ambig_state = readValue<int8_t>(point, 36);
+  obj.x_rms = readValue<int8_t>(point, 37);
+  obj.y_rms = readValue<int8_t>(point, 38);
+  obj.invalid_state = readValue<int8_t>(point, 39);
+  obj.pdh0 = readValue<int8_t>(point, 40);
+  obj.vx_rms = readValue<int8_t>(point, 41);
+  obj.vy_rms = readValue<int8_t>(point, 42);
+}
+
 #if CMAKE_CXX_STANDARD >= 17
-std::optional<RadarObjects> readRadarFile(const fs::path& filePath)
+std::optional<RadarObjects> readRadarFile(const fs::path& filePath,
+                                          std::vector<uint8_t>* fileBytes)
 #else
-RadarObjectsPtr readRadarFile(const fs::path& filePath)
+RadarObjectsPtr readRadarFile(const fs::path& filePath,
+                              std::vector<uint8_t>* fileBytes)
 #endif
 {
   const auto fileName = filePath.string();
-  pcl::PointCloud<PclRadarObject>::Ptr cloud(
-    new pcl::PointCloud<PclRadarObject>);
+  // Radar files are a few KB but the pool may hand out a buffer of MBs, it
+  // is only borrowed while parsing
+  std::vector<uint8_t> bytes;
 
-  if (pcl::io::loadPCDFile<PclRadarObject>(fileName, *cloud) ==
-      -1) //* load the file
-  {
-    std::string error = "Could not read ";
-    error += fileName;
-    cout << error << endl;
-    // PCL_ERROR(error);
+  RadarObjects radarObjects;
+  try {
+    takeFileBytes(fileName, fileBytes, bytes);
+    size_t pointNumber = 0;
+    const size_t dataOffset = parseRadarHeader(bytes, fileName, pointNumber);
+
+    radarObjects.objects.resize(pointNumber);
+    const uint8_t* point = bytes.data() + dataOffset;
+    for (auto& obj : radarObjects.objects) {
+      unpackRadarObject(point, obj);
+      point += RADAR_POINT_STEP;
+    }
+    getMessageBufferPool().release(std::move(bytes));
+  } catch (const std::exception& e) {
+    PRINT_EXCEPTION(e);
+    getMessageBufferPool().release(std::move(bytes));
 
 #if CMAKE_CXX_STANDARD >= 17
     return std::nullopt;
@@ -35,36 +200,66 @@ RadarObjectsPtr readRadarFile(const fs::path& filePath)
 
   }
 
-  RadarObjects radarObjects;
+#if CMAKE_CXX_STANDARD >= 17
+  return std::optional(std::move(radarObjects));
+#else
+  return boost::make_shared<RadarObjects>(std::move(radarObjects));
+#endif
+
+}
+
+#if CMAKE_CXX_STANDARD >= 17
+std::optional<sensor_msgs::PointCloud2> readRadarFileAsPointCloud(const fs::path& filePath,
+                                                                  std::vector<uint8_t>* fileBytes)
+#else
+sensor_msgs::PointCloud2Ptr readRadarFileAsPointCloud(const fs::path& filePath,
+                                                      std::vector<uint8_t>* fileBytes)
+#endif
+{
+  const auto fileName = filePath.string();
+
+  PointCloud2 cloud;
+  cloud.is_bigendian = false;
+  cloud.is_dense = true;
+  cloud.point_step = RADAR_POINT_STEP;
+  cloud.height = 1;
+
+  // Borrowed from the pool like in readRadarFile
+  std::vector<uint8_t> bytes;
+
+  try {
+    // The points already are in the PointCloud2 layout, they are copied
+    // without the header to a buffer of their size, rather than keeping a
+    // pool buffer of MBs for a message of a few KB
+    takeFileBytes(fileName, fileBytes, bytes);
+    size_t pointNumber = 0;
+    const size_t dataOffset = parseRadarHeader(bytes, fileName, pointNumber);
+    const auto points = bytes.begin() + dataOffset;
+    cloud.data.assign(points, points + pointNumber * RADAR_POINT_STEP);
+    getMessageBufferPool().release(std::move(bytes));
+
+    cloud.width = pointNumber;
+    cloud.row_step = cloud.data.size();
+    cloud.fields = radarPointFields();
+  } catch (const std::exception& e) {
+    PRINT_EXCEPTION(e);
+    getMessageBufferPool().release(std::move(bytes));
+
+#if CMAKE_CXX_STANDARD >= 17
+    return std::nullopt;
+#else
+    sensor_msgs::PointCloud2Ptr empty_msg;
+    return empty_msg;
+#endif
 
-  for (const auto& pclRadarObject : *cloud) {
-    RadarObject obj;
-    obj.pose.x = pclRadarObject.x;
-    obj.pose.y = pclRadarObject.y;
-    obj.pose.z = pclRadarObject.z;
-    obj.dyn_prop = pclRadarObject.dyn_prop;
-    obj.rcs = pclRadarObject.rcs;
-    obj.vx = pclRadarObject.vx;
-    obj.vy = pclRadarObject.vy;
-    obj.vx_comp = pclRadarObject.vx_comp;
-    obj.vy_comp = pclRadarObject.vy_comp;
-    obj.is_quality_valid = pclRadarObject.is_quality_valid;
-    obj.ambig_state = pclRadarObject.ambig_state;
-    obj.x_rms = pclRadarObject.x_rms;
-    obj.y_rms = pclRadarObject.y_rms;
-    obj.invalid_state = pclRadarObject.invalid_state;
-    obj.pdh0 = pclRadarObject.pdh0;
-    obj.vx_rms = pclRadarObject.vx_rms;
-    obj.vy_rms = pclRadarObject.vy_rms;
-    radarObjects.objects.push_back(obj);
   }
 
 #if CMAKE_CXX_STANDARD >= 17
-  return std::optional(radarObjects);
+  return std::optional(std::move(cloud));
 #else
-  return boost::make_shared<RadarObjects>(radarObjects);
+  return boost::make_shared<sensor_msgs::PointCloud2>(std::move(cloud));
 #endif
 
 }
 
-}
\ No newline at end of file
+}
@@ -1,5 +1,8 @@
 #include "nuscenes2bag/SceneConverter.hpp"
+#include "nuscenes2bag/BufferPool.hpp"
 #include "nuscenes2bag/DatasetTypes.hpp"
+#include "nuscenes2bag/DecodePipeline.hpp"
+#include "nuscenes2bag/MemoryBudget.hpp"
 #include "nuscenes2bag/utils.hpp"
 
 #include "nuscenes2bag/EgoPoseConverter.hpp"
@@ -8,18 +11,36 @@
 #include "nuscenes2bag/LidarDirectoryConverterXYZIR.hpp"
 #include "nuscenes2bag/RadarDirectoryConverter.hpp"
 
+#include <ros/serialization.h>
+
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <regex>
+#include <stdexcept>
 #include <string>
+#include <tuple>
 
 using namespace std;
 
 namespace nuscenes2bag {
 
-SceneConverter::SceneConverter(const MetaDataProvider& metaDataProvider)
+SceneConverter::SceneConverter(const MetaDataProvider& metaDataProvider,
+                               const ConversionOptions& options,
+                               DecodeWorkerPool* decodeWorkerPool,
+                               const SceneStatsRecorder& statsRecorder,
+                               FileReadPool* fileReadPool,
+                               MemoryBudget* memoryBudget)
   : metaDataProvider(metaDataProvider)
+  , options(options)
+  , decodeWorkerPool(decodeWorkerPool)
+  , statsRecorder(statsRecorder)
+  , fileReadPool(fileReadPool)
+  , memoryBudget(memoryBudget)
 {}
 
 
@@ -65,141 +86,175 @@ SampleType getSampleType(const std::string &filename)
 
 #endif
 
+// Gives the payload of a written message back to the buffer pool, for the
+// next sample decoded
+static void
+recycleMsg(sensor_msgs::Image& msg)
+{
+  getMessageBufferPool().release(std::move(msg.data));
+}
+
+static void
+recycleMsg(sensor_msgs::CompressedImage& msg)
+{
+  getMessageBufferPool().release(std::move(msg.data));
+}
+
+static void
+recycleMsg(sensor_msgs::PointCloud2& msg)
+{
+  getMessageBufferPool().release(std::move(msg.data));
+}
+
+// A few KB, the allocator serves them from its thread caches
+static void
+recycleMsg(RadarObjects&)
+{}
+
 #if CMAKE_CXX_STANDARD >= 17
 
+// False if the sample could not be read, there is no message to write
 template<typename T>
-void
-writeMsg(const std::string_view topicName,
+bool
+writeMsg(const std::string& topicName,
          const std::string &frameID,
          const TimeStamp timeStamp,
-         rosbag::Bag& outBag,
-         std::optional<T> msgOpt)
+         MessageSink& sink,
+         std::optional<T>& msgOpt)
+{
+  if (!msgOpt.has_value()) {
+    return false;
+  }
+  auto& msg = msgOpt.value();
+  msg.header.frame_id = frameID;
+  msg.header.stamp = stampUs2RosTime(timeStamp);
+  sink.write(topicName, msg.header.stamp, msg);
+  return true;
+}
+
+template<typename T>
+uint32_t
+messageSize(const std::optional<T>& msgOpt)
+{
+  return msgOpt.has_value() ? ros::serialization::serializationLength(*msgOpt)
+                            : 0;
+}
+
+template<typename T>
+void
+recycleMsg(std::optional<T>& msgOpt)
 {
   if (msgOpt.has_value()) {
-    auto& msg = msgOpt.value();
-    msg.header.frame_id = frameID;
-    msg.header.stamp = stampUs2RosTime(timeStamp);
-    outBag.write(std::string(topicName).c_str(), msg.header.stamp, msg);
+    recycleMsg(msgOpt.value());
   }
 }
 
 #else
 
-template<typename T> void writeMsg(const std::string &topicName,
+template<typename T> bool writeMsg(const std::string &topicName,
                                    const std::string &frameID,
                                    const TimeStamp timeStamp,
-                                   rosbag::Bag& outBag,
-                                   T msg)
+                                   MessageSink& sink,
+                                   T& msg)
 {
-  if (msg) {
-    msg->header.frame_id = frameID;
-    msg->header.stamp = stampUs2RosTime(timeStamp);
-    outBag.write(std::string(topicName).c_str(), msg->header.stamp, msg);
+  if (!msg) {
+    return false;
   }
+  msg->header.frame_id = frameID;
+  msg->header.stamp = stampUs2RosTime(timeStamp);
+  sink.write(topicName, msg->header.stamp, *msg);
+  return true;
 }
 
-#endif
-
-static const std::regex TOPIC_REGEX = std::regex(".*__([A-Z_]+)__.*");
-
-void
-SceneConverter::submit(const Token& sceneToken, FileProgress& fileProgress)
+template<typename T> uint32_t messageSize(const T& msg)
 {
-
-#if CMAKE_CXX_STANDARD >= 17
-  std::optional sceneInfoOpt = metaDataProvider.getSceneInfo(sceneToken);
-  // if(!sceneInfoOpt.has_value()) {
-  //     // cout << "SceneInfo for " << sceneToken << " not found!" << endl;
-  //     return;
-  // }
-  assert(sceneInfoOpt.has_value());
-  SceneInfo& sceneInfo = sceneInfoOpt.value();
-#else
-  boost::shared_ptr<SceneInfo> sceneInfoPtr = metaDataProvider.getSceneInfo(sceneToken);
-  assert(sceneInfoPtr != nullptr);
-  SceneInfo& sceneInfo = *sceneInfoPtr;
-#endif
-
-  sceneId = sceneInfo.sceneId;
-  this->sceneToken = sceneToken;
-  sceneSamples = metaDataProvider.getSceneSamples(sceneToken);
-  sceneAnnotations = metaDataProvider.getSceneSampleAnnotations(sceneToken);
-  sampleDatas = metaDataProvider.getSceneSampleData(sceneToken);
-  egoPoseInfos = metaDataProvider.getEgoPoseInfo(sceneToken);
-
-  fileProgress.addToProcess(sampleDatas.size());
+  return msg ? ros::serialization::serializationLength(*msg) : 0;
 }
 
-void
-SceneConverter::run(const fs::path& inPath,
-                    const fs::path& outDirectoryPath,
-                    FileProgress& fileProgress)
+template<typename T> void recycleMsg(boost::shared_ptr<T>& msg)
 {
+  if (msg) {
+    recycleMsg(*msg);
+  }
+}
 
-  std::string bagName =
-    outDirectoryPath.string() + "/" + std::to_string(sceneId) + ".bag";
-
-  rosbag::Bag outBag;
-  outBag.open(bagName, rosbag::bagmode::Write);
-
-  auto sensorInfos = metaDataProvider.getSceneCalibratedSensorInfo(sceneToken);
-  convertEgoPoseInfos(outBag, sensorInfos);
-  convertAnnotations(outBag);
-  convertSampleDatas(outBag, inPath, fileProgress);
+#endif
 
-  outBag.close();
+// Moves a decoded message into a task that writes it on the bag thread.
+// The topic and frame strings are owned by the scene converter. The size of
+// the message is charged to memoryBudget (if not null) until the task is
+// destroyed. If the sample could not be read, the task only counts it in
+// failedSampleNumber.
+template<typename T>
+DecodePipeline::WriteTask
+makeWriteTask(const std::string& topicName,
+              const std::string& frameID,
+              const TimeStamp timeStamp,
+              MessageSink& sink,
+              FileProgress& fileProgress,
+              const SceneStatsRecorder& statsRecorder,
+              MemoryBudget* memoryBudget,
+              const ConversionStage stage,
+              uint32_t& failedSampleNumber,
+              T msg)
+{
+  auto msgPtr = std::make_shared<T>(std::move(msg));
+  std::shared_ptr<MemoryCharge> charge;
+  if (memoryBudget != nullptr) {
+    charge = std::make_shared<MemoryCharge>(memoryBudget, stage, messageSize(*msgPtr));
+  }
+  return [&topicName, &frameID, timeStamp, &sink, &fileProgress, &statsRecorder, &failedSampleNumber, msgPtr, charge]() {
+    const auto start = statsRecorder.start();
+    if (!writeMsg(topicName, frameID, timeStamp, sink, *msgPtr)) {
+      failedSampleNumber++;
+    }
+    if (statsRecorder.enabled()) {
+      statsRecorder.record(ConversionStage::BAG_WRITE, start, 0, messageSize(*msgPtr));
+    }
+    recycleMsg(*msgPtr);
+    fileProgress.addToProcessed(1);
+  };
 }
 
-void
-SceneConverter::convertSampleDatas(rosbag::Bag& outBag,
-                                   const fs::path& inPath,
-                                   FileProgress& fileProgress)
+// Records the time to read and decode a sample file, with its size
+static void
+recordRead(const SceneStatsRecorder& statsRecorder,
+           const ConversionStage stage,
+           const ConversionStats::Clock::time_point start,
+           const fs::path& filePath)
 {
-  for (const auto& sampleData : sampleDatas) {
-    fs::path sampleFilePath = inPath / sampleData.fileName;
-
+  if (!statsRecorder.enabled()) {
+    return;
+  }
 #if CMAKE_CXX_STANDARD >= 17
-    std::optional<SampleType> sampleTypeOpt = getSampleType(sampleFilePath.string());
-    if (!sampleTypeOpt.has_value()) {
-      continue;
-    }
-    SampleType& sampleType = sampleTypeOpt.value();
+  std::error_code error;
 #else
-    SampleType sampleType = getSampleType(sampleFilePath.string());
+  boost::system::error_code error;
 #endif
+  const auto fileSize = fs::file_size(filePath, error);
+  statsRecorder.record(stage, start, error ? 0 : fileSize, 0);
+}
 
-    CalibratedSensorInfo calibratedSensorInfo =
-      metaDataProvider.getCalibratedSensorInfo(
-        sampleData.calibratedSensorToken);
-    CalibratedSensorName calibratedSensorName =
-      metaDataProvider.getSensorName(calibratedSensorInfo.sensorToken);
-    std::string sensorName = toLower(calibratedSensorName.name);
-
-    if (sampleType == SampleType::CAMERA) {
-      auto topicName = sensorName + "/raw";
-      auto msg = readImageFile(sampleFilePath);
-      writeMsg(topicName, sensorName, sampleData.timeStamp, outBag, msg);
-
-    } else if (sampleType == SampleType::LIDAR) {
-      auto topicName = sensorName;
-
-      // PointCloud format:
-      auto msg = readLidarFile(sampleFilePath); // x,y,z,intensity
-      //auto msg = readLidarFileXYZIR(sampleFilePath); // x,y,z,intensity,ring
-
-      writeMsg(topicName, sensorName, sampleData.timeStamp, outBag, msg);
-
-    } else if (sampleType == SampleType::RADAR) {
-      auto topicName = sensorName;
-      auto msg = readRadarFile(sampleFilePath);
-      writeMsg(topicName, sensorName, sampleData.timeStamp, outBag, msg);
-
-    } else {
-      cout << "Unknown sample type" << endl;
-    }
-
-    fileProgress.addToProcessed(1);
+static rosbag::CompressionType
+toRosbagCompression(const BagCompression compression)
+{
+  switch (compression) {
+    case BagCompression::LZ4:
+      return rosbag::compression::LZ4;
+    case BagCompression::BZ2:
+      return rosbag::compression::BZ2;
+    case BagCompression::NONE:
+      break;
   }
+  return rosbag::compression::Uncompressed;
+}
+
+static McapCompression
+toMcapCompression(const BagCompression compression)
+{
+  // BZ2 is rejected by the option parsing, MCAP has no such compression
+  return (compression == BagCompression::LZ4) ? McapCompression::LZ4
+                                              : McapCompression::NONE;
 }
 
 geometry_msgs::TransformStamped
@@ -231,212 +286,777 @@ makeIdentityTransform(const char* frame_id,
   return msg;
 }
 
+// True if value is one of the selected names (ignoring case), or if there
+// is no selection
+static bool
+isSelected(const std::vector<std::string>& selection, const std::string& value)
+{
+  if (selection.empty()) {
+    return true;
+  }
+  const std::string lowerValue = toLower(value);
+  for (const auto& name : selection) {
+    if (toLower(name) == lowerValue) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static const std::regex TOPIC_REGEX = std::regex(".*__([A-Z_]+)__.*");
+
 void
-SceneConverter::convertEgoPoseInfos(
-  rosbag::Bag& outBag,
-  const std::vector<CalibratedSensorInfoAndName>& calibratedSensorInfos)
+SceneConverter::submit(const Token& sceneToken, FileProgress& fileProgress)
 {
 
-  std::vector<geometry_msgs::TransformStamped> constantTransforms;
-  for (const auto& calibratedSensorInfo : calibratedSensorInfos) {
-    auto sensorTransform =
-      makeTransform("base_link",
-                    toLower(calibratedSensorInfo.name.name).c_str(),
-                    calibratedSensorInfo.info.translation,
-                    calibratedSensorInfo.info.rotation);
-    constantTransforms.push_back(sensorTransform);
+#if CMAKE_CXX_STANDARD >= 17
+  std::optional sceneInfoOpt = metaDataProvider.getSceneInfo(sceneToken);
+  // if(!sceneInfoOpt.has_value()) {
+  //     // cout << "SceneInfo for " << sceneToken << " not found!" << endl;
+  //     return;
+  // }
+  assert(sceneInfoOpt.has_value());
+  SceneInfo& sceneInfo = sceneInfoOpt.value();
+#else
+  boost::shared_ptr<SceneInfo> sceneInfoPtr = metaDataProvider.getSceneInfo(sceneToken);
+  assert(sceneInfoPtr != nullptr);
+  SceneInfo& sceneInfo = *sceneInfoPtr;
+#endif
+
+  sceneId = sceneInfo.sceneId;
+  this->sceneToken = sceneToken;
+  sampleDatas = metaDataProvider.getSceneSampleData(sceneToken);
+  egoPoses = &metaDataProvider.getEgoPoses(sceneToken);
+
+  // Resolve the sensor of every sample data once, so that converting a
+  // sample needs neither metadata lookups nor string building
+  sensorTopics.clear();
+  std::unordered_map<Token, uint32_t> calibratedSensorIndices;
+  for (const auto& sensorInfo :
+       metaDataProvider.getSceneCalibratedSensorInfo(sceneToken)) {
+    SensorTopic sensorTopic;
+#if CMAKE_CXX_STANDARD >= 17
+    sensorTopic.sampleType =
+      getSampleType(sensorInfo.name.name).value_or(SampleType::NONE);
+#else
+    sensorTopic.sampleType = getSampleType(sensorInfo.name.name);
+#endif
+    sensorTopic.frameID = toLower(sensorInfo.name.name);
+    sensorTopic.selected =
+      isSelected(options.channels, sensorInfo.name.name) &&
+      isSelected(options.modalities, sensorInfo.name.modality);
+    sensorTopic.transform = makeTransform("base_link",
+                                          sensorTopic.frameID.c_str(),
+                                          sensorInfo.info.translation,
+                                          sensorInfo.info.rotation);
+    sensorTopic.sensorToBase =
+      makePose(sensorInfo.info.translation, sensorInfo.info.rotation);
+    sensorTopic.topicName = sensorTopic.frameID;
+    sensorTopic.sweepsTopicName = sensorTopic.frameID + "/sweeps";
+    if (sensorTopic.sampleType == SampleType::CAMERA) {
+      sensorTopic.topicName +=
+        (options.imageFormat == ImageFormat::JPEG) ? "/compressed" : "/raw";
+    }
+    calibratedSensorIndices.emplace(sensorInfo.info.token,
+                                    static_cast<uint32_t>(sensorTopics.size()));
+    sensorTopics.push_back(std::move(sensorTopic));
+  }
+
+  sampleDataSensorIndices.clear();
+  sampleDataSensorIndices.reserve(sampleDatas.size());
+  for (const auto& sampleData : sampleDatas) {
+    auto it = calibratedSensorIndices.find(sampleData.calibratedSensorToken);
+    if (it == calibratedSensorIndices.end()) {
+      throw InvalidMetaDataException(
+        "MetaDataError: unable to find calibrated sensor of sample data [" +
+        sampleData.token.str() + "]");
+    }
+    sampleDataSensorIndices.push_back(it->second);
   }
-  geometry_msgs::TransformStamped tfMap2Odom =
-    makeIdentityTransform("map", "odom");
-  constantTransforms.push_back(tfMap2Odom);
 
-  const std::string odomTopic = "/odom";
-  for (const auto& egoPose : egoPoseInfos) {
-    // write odom
-    nav_msgs::Odometry odomMsg = egoPoseInfo2OdometryMsg(egoPose);
-    outBag.write(odomTopic.c_str(), odomMsg.header.stamp, odomMsg);
+  // The time window is relative to the first sample data of the scene
+  TimeStamp sceneStart = std::numeric_limits<TimeStamp>::max();
+  for (const auto& sampleData : sampleDatas) {
+    sceneStart = std::min(sceneStart, sampleData.timeStamp);
+  }
+  auto inTimeRange = [this, sceneStart](TimeStamp timeStamp) {
+    const uint64_t offset = (timeStamp > sceneStart) ? timeStamp - sceneStart : 0;
+    return (offset >= options.timeRangeBegin) && (offset < options.timeRangeEnd);
+  };
 
-    // write TFs
-    geometry_msgs::TransformStamped tfOdom2Base =
-      egoPoseInfo2TransformStamped(egoPose);
-    tf::tfMessage tfMsg;
-    tfMsg.transforms.push_back(tfOdom2Base);
-    for (const auto& constantTransform : constantTransforms) {
-      auto constantTransformWithNewStamp = constantTransform;
-      constantTransformWithNewStamp.header.stamp = odomMsg.header.stamp;
-      tfMsg.transforms.push_back(constantTransformWithNewStamp);
+  // Merge ego poses, boxes and sensor data into a single time ordered list,
+  // so that the bag is written in one sequential pass. At equal timestamps
+  // the ego pose (and its /tf) comes first. Records excluded by the selection
+  // options are left out here, their files are never opened.
+  timeline.clear();
+  timeline.reserve(egoPoses->size() + 2 * sampleDatas.size());
+  for (size_t i = 0; i < egoPoses->size(); ++i) {
+    if (inTimeRange(egoPoses->getTimeStamp(i))) {
+      timeline.push_back(TimelineRecord{
+        egoPoses->getTimeStamp(i), RecordType::EGO_POSE, static_cast<uint32_t>(i) });
+    }
+  }
+  uint32_t selectedSampleDataNumber = 0;
+  for (size_t i = 0; i < sampleDatas.size(); ++i) {
+    const SampleDataInfo& sampleData = sampleDatas[i];
+    if ((options.keyFramesOnly && !sampleData.isKeyFrame) ||
+        !inTimeRange(sampleData.timeStamp)) {
+      continue;
+    }
+    const SensorTopic& sensorTopic = sensorTopics[sampleDataSensorIndices[i]];
+    // The annotations are metadata only, they follow the lidar sweeps even
+    // if the lidar itself is not selected
+    if (sensorTopic.sampleType == SampleType::LIDAR) {
+      timeline.push_back(TimelineRecord{
+        sampleData.timeStamp, RecordType::BOXES, static_cast<uint32_t>(i) });
+    }
+    if (sensorTopic.selected) {
+      timeline.push_back(TimelineRecord{
+        sampleData.timeStamp, RecordType::SAMPLE_DATA, static_cast<uint32_t>(i) });
+      selectedSampleDataNumber++;
     }
-    outBag.write("/tf", odomMsg.header.stamp, tfMsg);
   }
+  std::stable_sort(timeline.begin(),
+                   timeline.end(),
+                   [](const TimelineRecord& a, const TimelineRecord& b) {
+                     return a.timeStamp < b.timeStamp;
+                   });
+  addStaticTransformRecords();
+
+  pairSampleAnnotations();
+
+  fileProgress.addToProcess(selectedSampleDataNumber);
 }
 
-bool compareByTimestamp(const SampleDataInfo& a, const SampleDataInfo& b)
+void
+SceneConverter::addStaticTransformRecords()
 {
-    return a.timeStamp < b.timeStamp;
+  // The sensor currently calibrated for each frame, in first use order. The
+  // first calibration of every frame goes in the /tf_static message at the
+  // start of the scene.
+  std::vector<uint32_t> frameSensors;
+  std::unordered_map<std::string, size_t> frameIndices;
+  for (const auto& record : timeline) {
+    if (record.type != RecordType::SAMPLE_DATA) {
+      continue;
+    }
+    const uint32_t sensorIndex = sampleDataSensorIndices[record.index];
+    if (frameIndices.emplace(sensorTopics[sensorIndex].frameID, frameSensors.size()).second) {
+      frameSensors.push_back(sensorIndex);
+    }
+  }
+
+  staticTransformSensors.clear();
+  staticTransformSensors.push_back(frameSensors);
+  std::vector<TimelineRecord> records;
+  records.reserve(timeline.size() + 1);
+  records.push_back(TimelineRecord{
+    timeline.empty() ? 0 : timeline.front().timeStamp, RecordType::STATIC_TRANSFORMS, 0 });
+  for (const auto& record : timeline) {
+    if (record.type == RecordType::SAMPLE_DATA) {
+      const uint32_t sensorIndex = sampleDataSensorIndices[record.index];
+      uint32_t& frameSensor =
+        frameSensors[frameIndices.at(sensorTopics[sensorIndex].frameID)];
+      if (frameSensor != sensorIndex) {
+        // Recalibrated sensor, /tf_static is latched so the new message
+        // holds all the transforms
+        frameSensor = sensorIndex;
+        records.push_back(TimelineRecord{
+          record.timeStamp, RecordType::STATIC_TRANSFORMS,
+          static_cast<uint32_t>(staticTransformSensors.size()) });
+        staticTransformSensors.push_back(frameSensors);
+      }
+    }
+    records.push_back(record);
+  }
+  timeline.swap(records);
 }
 
+static const uint32_t NO_PREV_ANNOTATION = std::numeric_limits<uint32_t>::max();
+
 void
-SceneConverter::convertAnnotations(rosbag::Bag& outBag) // SampleType& sensorType = SampleType::LIDAR
+SceneConverter::pairSampleAnnotations()
 {
-  // In sampleDatas the keyframes are ordered by timestamp but the intermediate frames are not.
-  // Sorting them can help with debugging.
-  //std::sort(sampleDatas.begin(), sampleDatas.end(), compareByTimestamp);
+  // Match the annotations of consecutive samples by instance once per scene,
+  // instead of once per interpolated sweep
+  sampleAnnotationPairings.clear();
+  sampleIndices.clear();
+  prevAnnotationIndices.clear();
+  std::unordered_map<Token, uint32_t> prevInstanceIndices;
+  for (const auto& sample : metaDataProvider.getSceneSamples(sceneToken)) {
+    SampleAnnotationPairing pairing;
+    pairing.sample = &sample;
+    pairing.prevSample = sample.prev.empty()
+                           ? nullptr
+                           : metaDataProvider.findSampleInfo(sample.prev);
+    pairing.annotations = metaDataProvider.getSampleAnnotations(sample.token);
+    pairing.prevIndicesOffset = prevAnnotationIndices.size();
+
+    if (pairing.prevSample != nullptr) {
+      pairing.prevAnnotations =
+        metaDataProvider.getSampleAnnotations(pairing.prevSample->token);
+      prevInstanceIndices.clear();
+      for (size_t i = 0; i < pairing.prevAnnotations.size(); ++i) {
+        prevInstanceIndices.emplace(pairing.prevAnnotations[i].instanceToken,
+                                    static_cast<uint32_t>(i));
+      }
+      for (const auto& annotation : pairing.annotations) {
+        auto it = prevInstanceIndices.find(annotation.instanceToken);
+        prevAnnotationIndices.push_back(
+          (it == prevInstanceIndices.end()) ? NO_PREV_ANNOTATION : it->second);
+      }
+    }
 
-  for (const auto& sampleData : sampleDatas) {
+    sampleIndices.emplace(sample.token,
+                          static_cast<uint32_t>(sampleAnnotationPairings.size()));
+    sampleAnnotationPairings.push_back(pairing);
+  }
+}
 
-#if CMAKE_CXX_STANDARD >= 17
-    std::optional<SampleType> sampleTypeOpt = getSampleType(sampleData.fileName);
-    if (!sampleTypeOpt.has_value()) {
+uint64_t
+SceneConverter::estimateCost(const fs::path& inPath) const
+{
+  // Stat a single file per sensor, sizes are similar within a sensor
+  std::vector<uint64_t> sensorFileSizes(sensorTopics.size(), 0);
+  std::vector<bool> sensorFileSizeKnown(sensorTopics.size(), false);
+  uint64_t cost = 0;
+  // Only the selected sample data are converted
+  for (const auto& record : timeline) {
+    if (record.type != RecordType::SAMPLE_DATA) {
       continue;
     }
-    SampleType& sampleType = sampleTypeOpt.value();
+    const size_t i = record.index;
+    const uint32_t sensorIndex = sampleDataSensorIndices[i];
+    if (!sensorFileSizeKnown[sensorIndex]) {
+#if CMAKE_CXX_STANDARD >= 17
+      std::error_code error;
 #else
-    SampleType sampleType = getSampleType(sampleData.fileName);
+      boost::system::error_code error;
 #endif
+      const auto fileSize =
+        fs::file_size(inPath / sampleDatas[i].fileName, error);
+      sensorFileSizes[sensorIndex] = error ? 0 : fileSize;
+      sensorFileSizeKnown[sensorIndex] = true;
+    }
+    // Count at least one byte per sample if the file can't be found
+    cost += std::max<uint64_t>(sensorFileSizes[sensorIndex], 1);
+  }
+  return cost;
+}
 
-    CalibratedSensorInfo calibratedSensorInfo =
-      metaDataProvider.getCalibratedSensorInfo(
-        sampleData.calibratedSensorToken);
-    CalibratedSensorName calibratedSensorName =
-      metaDataProvider.getSensorName(calibratedSensorInfo.sensorToken);
-    std::string sensorName = toLower(calibratedSensorName.name);
+fs::path
+SceneConverter::getBagPath(const fs::path& outDirectoryPath,
+                           SceneId sceneId,
+                           OutputFormat format)
+{
+  return outDirectoryPath /
+         (std::to_string(sceneId) + ((format == OutputFormat::MCAP) ? ".mcap" : ".bag"));
+}
 
-    if (sampleType == SampleType::LIDAR) {
-      std::vector<Box> boxes;
-      getBoxes(sampleData, boxes);
+void
+SceneConverter::run(const fs::path& inPath,
+                    const fs::path& outDirectoryPath,
+                    FileProgress& fileProgress)
+{
+  // Written under a temporary name and renamed once complete, so that a
+  // bag with the final name is never partial
+  const fs::path bagPath = getBagPath(outDirectoryPath, sceneId, options.outputFormat);
+  const fs::path partialBagPath = bagPath.string() + ".partial";
+
+  const auto start = ConversionStats::Clock::now();
 
-      const ros::Time& timestamp = stampUs2RosTime(sampleData.timeStamp);
+  rosbag::Bag outBag;
+  DecodePipeline::QueueStats queueStats;
+  try {
+    if (options.outputFormat == OutputFormat::MCAP) {
+      McapWriter outMcap(partialBagPath,
+                         toMcapCompression(options.bagCompression),
+                         options.bagChunkThreshold,
+                         decodeWorkerPool);
+      MessageSink sink(outMcap);
+      queueStats = writeTimeline(sink, inPath, fileProgress);
+      outMcap.close();
+    } else {
+      outBag.open(partialBagPath.string(), rosbag::bagmode::Write);
+      outBag.setCompression(toRosbagCompression(options.bagCompression));
+      outBag.setChunkThreshold(options.bagChunkThreshold);
 
-      Boxes boxesMsg;
-      boxesMsg.header.stamp = timestamp;
-      boxesMsg.header.frame_id = "map";
-      boxesMsg.boxes = boxes;
-      outBag.write("boxes", timestamp, boxesMsg);
+      MessageSink sink(outBag);
+      queueStats = writeTimeline(sink, inPath, fileProgress);
 
-      const ros::Duration lifetime(1.0/25.0); // Annotations are 25Hz
-      visualization_msgs::MarkerArray boxesVizMsg = makeMarkerArrayMsg(boxes, timestamp, lifetime);
-      outBag.write("boxes_viz", timestamp, boxesVizMsg);
+      outBag.close();
     }
+  } catch (...) {
+#if CMAKE_CXX_STANDARD >= 17
+    std::error_code error;
+#else
+    boost::system::error_code error;
+#endif
+    outBag.close();
+    fs::remove(partialBagPath, error);
+    throw;
   }
+  fs::rename(partialBagPath, bagPath);
+
+  statsRecorder.setSceneResult(
+    std::chrono::duration<double>(ConversionStats::Clock::now() - start).count(),
+    queueStats);
 }
 
-Eigen::Quaterniond makeQuaterniond(const float* rotation)
+void
+SceneConverter::publish(const fs::path& inPath,
+                        MessageSink& sink,
+                        FileProgress& fileProgress)
 {
-  return Eigen::Quaterniond(rotation[0], rotation[1], rotation[2], rotation[3]);
+  const auto start = ConversionStats::Clock::now();
+
+  sink.restartPlayback();
+  const DecodePipeline::QueueStats queueStats =
+    writeTimeline(sink, inPath, fileProgress);
+
+  statsRecorder.setSceneResult(
+    std::chrono::duration<double>(ConversionStats::Clock::now() - start).count(),
+    queueStats);
 }
 
-void
-SceneConverter::getBoxes(const SampleDataInfo& sampleData, std::vector<Box>& boxes)
+DecodePipeline::QueueStats
+SceneConverter::writeTimeline(MessageSink& sink,
+                              const fs::path& inPath,
+                              FileProgress& fileProgress)
 {
-  const Token& currSampleToken = sampleData.sampleToken;
+  // Messages are built on the pipeline workers (sample files are read and
+  // decoded there), while this thread writes them to the sink in timeline
+  // order.
+  DecodePipeline pipeline(decodeWorkerPool, options.maxSamplesInFlight, memoryBudget);
+  sweepAccumulators.clear();
+  failedSampleNumber = 0;
+  // The kept sweeps are charged to the memory budget, they are dropped as
+  // soon as the timeline is written (or fails) rather than with the converter
+  struct SweepsDropper {
+    std::unordered_map<std::string, LidarSweepAccumulator>& sweepAccumulators;
+    ~SweepsDropper() { sweepAccumulators.clear(); }
+  } sweepsDropper{ sweepAccumulators };
+
+  // The sample files are read ahead in the order they are decoded, the index
+  // of each record's file in the work list is kept in readIndices
+  std::unique_ptr<FileReadAhead> readAhead;
+  std::vector<uint32_t> readIndices;
+  if (fileReadPool != nullptr) {
+    std::vector<std::string> filePaths;
+    readIndices.resize(timeline.size());
+    for (size_t i = 0; i < timeline.size(); ++i) {
+      if (timeline[i].type == RecordType::SAMPLE_DATA) {
+        readIndices[i] = filePaths.size();
+        filePaths.push_back((inPath / sampleDatas[timeline[i].index].fileName).string());
+      }
+    }
+    readAhead.reset(
+      new FileReadAhead(fileReadPool, std::move(filePaths), options.readAheadDepth,
+                        memoryBudget));
+  }
 
-  SampleInfo currSample;
-  {
-    auto it = sceneSamples.find(currSampleToken);
-    if (it == sceneSamples.end()) {
-      std::cout << "can't find current sample token in sceneSamples" << std::endl;
-      return;
+  pipeline.run(timeline.size(), [&](size_t recordIndex) -> DecodePipeline::WriteTask {
+    const TimelineRecord& record = timeline[recordIndex];
+    switch (record.type) {
+      case RecordType::EGO_POSE:
+        return convertEgoPose((*egoPoses)[record.index], sink);
+      case RecordType::BOXES:
+        return convertBoxes(sampleDatas[record.index], sink);
+      case RecordType::STATIC_TRANSFORMS:
+        return convertStaticTransforms(
+          staticTransformSensors[record.index], record.timeStamp, sink);
+      case RecordType::SAMPLE_DATA:
+        break;
     }
-    currSample = it->second;
+    return convertSampleData(record.index, sink, inPath, fileProgress,
+                             readAhead.get(), readAhead ? readIndices[recordIndex] : 0);
+  });
+  // The files were reported by the readers. The scene must not be recorded
+  // as converted with messages missing.
+  if (failedSampleNumber > 0) {
+    throw std::runtime_error(std::to_string(failedSampleNumber) +
+                             " sample files could not be read");
   }
+  return pipeline.getQueueStats();
+}
 
-  if ((sampleData.isKeyFrame) || (currSample.prev.empty())) {
-    // If sample data is a key frame, or no previous annotations are available,
-    // return the annotations for the current sample.
+DecodePipeline::WriteTask
+SceneConverter::convertSampleData(size_t sampleDataIndex,
+                                  MessageSink& sink,
+                                  const fs::path& inPath,
+                                  FileProgress& fileProgress,
+                                  FileReadAhead* readAhead,
+                                  size_t readIndex)
+{
+  const SampleDataInfo& sampleData = sampleDatas[sampleDataIndex];
+  const SensorTopic& sensor =
+    sensorTopics[sampleDataSensorIndices[sampleDataIndex]];
+  const std::string& topicName = sensor.topicName;
+  const std::string& frameID = sensor.frameID;
+  fs::path sampleFilePath = inPath / sampleData.fileName;
+
+  const auto start = statsRecorder.start();
+
+  // Null when the readers read the file themselves
+  std::vector<uint8_t> readBytes;
+  std::vector<uint8_t>* fileBytes = nullptr;
+  if (readAhead != nullptr) {
+    // Read errors are rethrown by the pipeline, they fail the scene
+    readBytes = readAhead->take(readIndex);
+    fileBytes = &readBytes;
+  }
 
-    std::vector<SampleAnnotationInfo> annotations;
-    {
-      auto it = sceneAnnotations.find(currSampleToken);
-      if (it == sceneAnnotations.end()) {
-        std::cout << "can't find current sample token in sceneAnnotations" << std::endl;
-        return;
-      }
-      annotations = it->second;
+  if (sensor.sampleType == SampleType::CAMERA) {
+    if (options.imageFormat == ImageFormat::JPEG) {
+      auto msg = readCompressedImageFile(sampleFilePath, fileBytes);
+      recordRead(statsRecorder, ConversionStage::CAMERA_READ, start, sampleFilePath);
+      return makeWriteTask(topicName, frameID, sampleData.timeStamp, sink, fileProgress, statsRecorder, memoryBudget, ConversionStage::CAMERA_READ, failedSampleNumber, std::move(msg));
     }
-
-    for (const auto& annotation: annotations)
-    {
-      boxes.push_back(makeBox(annotation));
+    auto msg = readImageFile(sampleFilePath, fileBytes, options.imageScaleDenominator);
+    recordRead(statsRecorder, ConversionStage::CAMERA_READ, start, sampleFilePath);
+    return makeWriteTask(topicName, frameID, sampleData.timeStamp, sink, fileProgress, statsRecorder, memoryBudget, ConversionStage::CAMERA_READ, failedSampleNumber, std::move(msg));
+
+  } else if (sensor.sampleType == SampleType::LIDAR) {
+    // PointCloud format:
+    auto msg = readLidarFile(sampleFilePath, fileBytes); // x,y,z,intensity
+    //auto msg = readLidarFileXYZIR(sampleFilePath); // x,y,z,intensity,ring
+    recordRead(statsRecorder, ConversionStage::LIDAR_READ, start, sampleFilePath);
+
+    DecodePipeline::WriteTask writeSweeps;
+    if ((options.lidarSweepNumber > 0) && msg) {
+      writeSweeps = convertLidarSweep(sampleData, sensor, *msg, sink);
+    }
+    DecodePipeline::WriteTask writeTask = makeWriteTask(topicName, frameID, sampleData.timeStamp, sink, fileProgress, statsRecorder, memoryBudget, ConversionStage::LIDAR_READ, failedSampleNumber, std::move(msg));
+    if (!writeSweeps) {
+      return writeTask;
     }
+    return [writeTask, writeSweeps]() {
+      writeTask();
+      writeSweeps();
+    };
+
+  } else if (sensor.sampleType == SampleType::RADAR) {
+    if (options.radarFormat == RadarFormat::POINTCLOUD) {
+      auto msg = readRadarFileAsPointCloud(sampleFilePath, fileBytes);
+      recordRead(statsRecorder, ConversionStage::RADAR_READ, start, sampleFilePath);
+      return makeWriteTask(topicName, frameID, sampleData.timeStamp, sink, fileProgress, statsRecorder, memoryBudget, ConversionStage::RADAR_READ, failedSampleNumber, std::move(msg));
+    }
+    auto msg = readRadarFile(sampleFilePath, fileBytes);
+    recordRead(statsRecorder, ConversionStage::RADAR_READ, start, sampleFilePath);
+    return makeWriteTask(topicName, frameID, sampleData.timeStamp, sink, fileProgress, statsRecorder, memoryBudget, ConversionStage::RADAR_READ, failedSampleNumber, std::move(msg));
 
-    return;
+  } else {
+    cout << "Unknown sample type" << endl;
   }
-  else {
-    // Sample data is intermediate, use linear interpolation to estimate position of boxes
 
-    SampleInfo prevSample;
-    {
-      auto it = sceneSamples.find(currSample.prev);
-      if (it == sceneSamples.end()) {
-        std::cout << "can't find prev sample token in sceneSamples" << std::endl;
-        return;
-      }
-      prevSample = it->second;
+  return [&fileProgress]() { fileProgress.addToProcessed(1); };
+}
+
+DecodePipeline::WriteTask
+SceneConverter::convertLidarSweep(const SampleDataInfo& sampleData,
+                                  const SensorTopic& sensor,
+                                  const sensor_msgs::PointCloud2& cloud,
+                                  MessageSink& sink)
+{
+  if (egoPoses->empty()) {
+    std::cout << "Unable to find the ego pose of sweep " << sampleData.token
+              << std::endl;
+    return nullptr;
+  }
+  // The ego pose of a sample data has its timestamp, the interpolation only
+  // matters for the poses missing from the table
+  const EgoPoseInfo egoPose = egoPoses->interpolate(sampleData.timeStamp);
+
+  // Split into arrays here, in parallel with the other samples, the sweeps
+  // are only transformed on the writing thread where they come in order
+  auto sweep = std::make_shared<LidarSweep>(makeLidarSweep(
+    cloud, sampleData.timeStamp,
+    makePose(egoPose.translation, egoPose.rotation) * sensor.sensorToBase));
+  std::shared_ptr<MemoryCharge> charge;
+  if (memoryBudget != nullptr) {
+    charge = std::make_shared<MemoryCharge>(
+      memoryBudget, ConversionStage::LIDAR_SWEEPS, sweep->size() * 4 * sizeof(float));
+  }
+
+  return [this, &sensor, sweep, &sink, charge]() {
+    auto start = statsRecorder.start();
+    auto accumulatorIt = sweepAccumulators.find(sensor.frameID);
+    if (accumulatorIt == sweepAccumulators.end()) {
+      accumulatorIt =
+        sweepAccumulators
+          .emplace(std::piecewise_construct,
+                   std::forward_as_tuple(sensor.frameID),
+                   std::forward_as_tuple(options.lidarSweepNumber, memoryBudget))
+          .first;
     }
+    const ros::Time stamp = stampUs2RosTime(sweep->timeStamp);
+    accumulatorIt->second.addSweep(std::move(*sweep));
+
+    sensor_msgs::PointCloud2 cloud;
+    accumulatorIt->second.accumulate(cloud);
+    cloud.header.frame_id = sensor.frameID;
+    cloud.header.stamp = stamp;
+    statsRecorder.record(ConversionStage::LIDAR_SWEEPS, start, 0, 0);
+
+    start = statsRecorder.start();
+    sink.write(sensor.sweepsTopicName, stamp, cloud);
+    if (statsRecorder.enabled()) {
+      statsRecorder.record(ConversionStage::BAG_WRITE, start, 0,
+                           ros::serialization::serializationLength(cloud));
+    }
+    recycleMsg(cloud);
+  };
+}
 
-    std::vector<SampleAnnotationInfo> currAnnotations;
-    {
-      auto it = sceneAnnotations.find(currSampleToken);
-      if (it == sceneAnnotations.end()) {
-        std::cout << "can't find current sample token in sceneAnnotations" << std::endl;
-        return;
-      }
-      currAnnotations = it->second;
+static const std::string ODOM_TOPIC = "/odom";
+static const std::string TF_TOPIC = "/tf";
+static const std::string TF_STATIC_TOPIC = "/tf_static";
+static const std::string BOXES_TOPIC = "boxes";
+static const std::string BOXES_VIZ_TOPIC = "boxes_viz";
+
+DecodePipeline::WriteTask
+SceneConverter::convertStaticTransforms(const std::vector<uint32_t>& sensorIndices,
+                                        TimeStamp timeStamp,
+                                        MessageSink& sink)
+{
+  const ros::Time stamp = stampUs2RosTime(timeStamp);
+  auto tfMsg = std::make_shared<tf::tfMessage>();
+  tfMsg->transforms.reserve(sensorIndices.size() + 1);
+  for (const uint32_t sensorIndex : sensorIndices) {
+    tfMsg->transforms.push_back(sensorTopics[sensorIndex].transform);
+    tfMsg->transforms.back().header.stamp = stamp;
+  }
+  tfMsg->transforms.push_back(makeIdentityTransform("map", "odom", stamp));
+
+  return [this, tfMsg, stamp, &sink]() {
+    const auto start = statsRecorder.start();
+    // Latched like the messages of a tf2_ros::StaticTransformBroadcaster
+    sink.write(TF_STATIC_TOPIC, stamp, *tfMsg, true);
+    if (statsRecorder.enabled()) {
+      statsRecorder.record(ConversionStage::BAG_WRITE, start, 0,
+                           ros::serialization::serializationLength(*tfMsg));
     }
+  };
+}
 
-    std::vector<SampleAnnotationInfo> prevAnnotations;
-    {
-      auto it = sceneAnnotations.find(prevSample.token);
-      if (it == sceneAnnotations.end()) {
-        std::cout << "can't find previous sample token in sceneAnnotations" << std::endl;
-        return;
-      }
-      prevAnnotations = it->second;
+DecodePipeline::WriteTask
+SceneConverter::convertEgoPose(const EgoPoseInfo& egoPose, MessageSink& sink)
+{
+  const auto start = statsRecorder.start();
+
+  // odom
+  auto odomMsg = std::make_shared<nav_msgs::Odometry>(
+    egoPoseInfo2OdometryMsg(egoPose));
+
+  // TFs, the constant ones are on /tf_static
+  auto tfMsg = std::make_shared<tf::tfMessage>();
+  tfMsg->transforms.push_back(egoPoseInfo2TransformStamped(egoPose));
+
+  statsRecorder.record(ConversionStage::EGO_POSE, start, 0, 0);
+
+  return [this, odomMsg, tfMsg, &sink]() {
+    const auto start = statsRecorder.start();
+    sink.write(ODOM_TOPIC, odomMsg->header.stamp, *odomMsg);
+    sink.write(TF_TOPIC, odomMsg->header.stamp, *tfMsg);
+    if (statsRecorder.enabled()) {
+      statsRecorder.record(ConversionStage::BAG_WRITE, start, 0,
+                           ros::serialization::serializationLength(*odomMsg) +
+                             ros::serialization::serializationLength(*tfMsg));
     }
+  };
+}
 
-    // Map instance tokens to prev_ann records
-    std::map<std::string, SampleAnnotationInfo> prevInstanceMap;
-    for (const auto& annotation : prevAnnotations)
-    {
-      prevInstanceMap.insert({annotation.instanceToken, annotation});
+DecodePipeline::WriteTask
+SceneConverter::convertBoxes(const SampleDataInfo& sampleData,
+                             MessageSink& sink)
+{
+  const auto start = statsRecorder.start();
+
+  std::vector<Box> boxes;
+  getBoxes(sampleData, boxes);
+
+  const ros::Time& timestamp = stampUs2RosTime(sampleData.timeStamp);
+
+  const ros::Duration lifetime(1.0/25.0); // Annotations are 25Hz
+  auto boxesVizMsg = std::make_shared<visualization_msgs::MarkerArray>(
+    makeMarkerArrayMsg(boxes, timestamp, lifetime));
+
+  auto boxesMsg = std::make_shared<Boxes>();
+  boxesMsg->header.stamp = timestamp;
+  boxesMsg->header.frame_id = "map";
+  boxesMsg->boxes = std::move(boxes);
+
+  statsRecorder.record(ConversionStage::BOXES, start, 0, 0);
+
+  std::shared_ptr<MemoryCharge> charge;
+  if (memoryBudget != nullptr) {
+    charge = std::make_shared<MemoryCharge>(
+      memoryBudget, ConversionStage::BOXES,
+      ros::serialization::serializationLength(*boxesMsg) +
+        ros::serialization::serializationLength(*boxesVizMsg));
+  }
+
+  return [this, boxesMsg, boxesVizMsg, timestamp, &sink, charge]() {
+    const auto start = statsRecorder.start();
+    sink.write(BOXES_TOPIC, timestamp, *boxesMsg);
+    sink.write(BOXES_VIZ_TOPIC, timestamp, *boxesVizMsg);
+    if (statsRecorder.enabled()) {
+      statsRecorder.record(ConversionStage::BAG_WRITE, start, 0,
+                           ros::serialization::serializationLength(*boxesMsg) +
+                             ros::serialization::serializationLength(*boxesVizMsg));
     }
+  };
+}
 
-    const TimeStamp t0 = prevSample.timeStamp;
-    const TimeStamp t1 = currSample.timeStamp;
-    TimeStamp t = sampleData.timeStamp;
+void
+SceneConverter::getBoxes(const SampleDataInfo& sampleData, std::vector<Box>& boxes) const
+{
+  auto sampleIt = sampleIndices.find(sampleData.sampleToken);
+  if (sampleIt == sampleIndices.end()) {
+    std::cout << "can't find current sample token in sceneSamples" << std::endl;
+    return;
+  }
+  const SampleAnnotationPairing& pairing =
+    sampleAnnotationPairings[sampleIt->second];
+  const Span<SampleAnnotationInfo>& currAnnotations = pairing.annotations;
+  boxes.reserve(boxes.size() + currAnnotations.size());
 
-    // There are rare situations where the timestamps in the DB are off so ensure that t0 < t < t1.
-    t = std::max(t0, std::min(t1, t));
+  if ((sampleData.isKeyFrame) || (pairing.prevSample == nullptr)) {
+    // If sample data is a key frame, or no previous annotations are available,
+    // return the annotations for the current sample.
 
-    for (const auto& annotation : currAnnotations)
+    for (const auto& annotation: currAnnotations)
     {
-      auto it = prevInstanceMap.find(annotation.instanceToken);
-      if (it == prevInstanceMap.end()) {
-        // The instance does not exist in the previous frame so get the current annotation.
-        boxes.push_back(makeBox(annotation));
-      }
-      else {
-        // The annotated instance existed in the previous frame, therefore interpolate center & orientation.
-        const SampleAnnotationInfo prevAnnotation = it->second;
+      boxes.push_back(makeBox(annotation));
+    }
 
-        const uint64_t numerator = (t - t0); // unsigned long long
-        const uint64_t denominator = (t1 - t0);
+    return;
+  }
 
-        const double amount = static_cast<double>(numerator) / static_cast<double>(denominator);
+  // Sample data is intermediate, use linear interpolation to estimate position of boxes
+  const uint32_t* prevIndices =
+    prevAnnotationIndices.data() + pairing.prevIndicesOffset;
+
+  const TimeStamp t0 = pairing.prevSample->timeStamp;
+  const TimeStamp t1 = pairing.sample->timeStamp;
+  TimeStamp t = sampleData.timeStamp;
+
+  // There are rare situations where the timestamps in the DB are off so ensure that t0 < t < t1.
+  t = std::max(t0, std::min(t1, t));
+
+  const uint64_t numerator = (t - t0); // unsigned long long
+  const uint64_t denominator = (t1 - t0);
+  const double amount = (denominator == 0)
+                          ? 1.0
+                          : static_cast<double>(numerator) / static_cast<double>(denominator);
+
+  // Gather the instances present in both samples and interpolate them all at
+  // once. Reused from one frame to the next by each decoding thread.
+  thread_local BoxPoses prevPoses;
+  thread_local BoxPoses currPoses;
+  thread_local BoxPoses interpolatedPoses;
+  prevPoses.clear();
+  currPoses.clear();
+  for (size_t i = 0; i < currAnnotations.size(); ++i) {
+    if (prevIndices[i] != NO_PREV_ANNOTATION) {
+      prevPoses.push_back(pairing.prevAnnotations[prevIndices[i]]);
+      currPoses.push_back(currAnnotations[i]);
+    }
+  }
+  interpolateBoxPoses(prevPoses, currPoses, amount, interpolatedPoses);
+
+  const std::vector<double>* values = interpolatedPoses.values;
+  size_t poseIndex = 0;
+  for (size_t i = 0; i < currAnnotations.size(); ++i) {
+    if (prevIndices[i] == NO_PREV_ANNOTATION) {
+      // The instance does not exist in the previous frame so get the current annotation.
+      boxes.push_back(makeBox(currAnnotations[i]));
+      continue;
+    }
+    const Eigen::Vector3d center(values[BoxPoses::CX][poseIndex],
+                                 values[BoxPoses::CY][poseIndex],
+                                 values[BoxPoses::CZ][poseIndex]);
+    const Eigen::Quaterniond rotation(values[BoxPoses::QW][poseIndex],
+                                      values[BoxPoses::QX][poseIndex],
+                                      values[BoxPoses::QY][poseIndex],
+                                      values[BoxPoses::QZ][poseIndex]);
+    boxes.push_back(makeBox(currAnnotations[i], center, rotation));
+    poseIndex++;
+  }
+}
 
-        // Interpolate center
-        const Eigen::Vector3d c0(prevAnnotation.translation[0], prevAnnotation.translation[1], prevAnnotation.translation[2]);
-        const Eigen::Vector3d c1(annotation.translation[0], annotation.translation[1], annotation.translation[2]);
-        const Eigen::Vector3d center = lerp(amount, c1, c0);
+void
+BoxPoses::clear()
+{
+  for (auto& value : values) {
+    value.clear();
+  }
+}
 
-        // Interpolate orientation (w,x,y,z)
-        const Eigen::Quaterniond q0 = makeQuaterniond(prevAnnotation.rotation);
-        const Eigen::Quaterniond q1 = makeQuaterniond(annotation.rotation);
-        const Eigen::Quaterniond rotation = q0.slerp(amount, q1);
+void
+BoxPoses::push_back(const SampleAnnotationInfo& annotation)
+{
+  values[CX].push_back(annotation.translation[0]);
+  values[CY].push_back(annotation.translation[1]);
+  values[CZ].push_back(annotation.translation[2]);
+  values[QW].push_back(annotation.rotation[0]);
+  values[QX].push_back(annotation.rotation[1]);
+  values[QY].push_back(annotation.rotation[2]);
+  values[QZ].push_back(annotation.rotation[3]);
+}
 
-        boxes.push_back(makeBox(annotation, center, rotation));
-      }
+void
+interpolateBoxPoses(const BoxPoses& poses0,
+                    const BoxPoses& poses1,
+                    const double amount,
+                    BoxPoses& result)
+{
+  const size_t n = poses0.size();
+  for (auto& value : result.values) {
+    value.resize(n);
+  }
+
+  for (int c = BoxPoses::CX; c <= BoxPoses::CZ; ++c) {
+    const double* c0 = poses0.values[c].data();
+    const double* c1 = poses1.values[c].data();
+    double* center = result.values[c].data();
+    for (size_t i = 0; i < n; ++i) {
+      center[i] = amount * c1[i] + (1.0 - amount) * c0[i];
+    }
+  }
+
+  // Same computation as Eigen::Quaterniond::slerp, one quaternion per lane
+  const double* w0 = poses0.values[BoxPoses::QW].data();
+  const double* x0 = poses0.values[BoxPoses::QX].data();
+  const double* y0 = poses0.values[BoxPoses::QY].data();
+  const double* z0 = poses0.values[BoxPoses::QZ].data();
+  const double* w1 = poses1.values[BoxPoses::QW].data();
+  const double* x1 = poses1.values[BoxPoses::QX].data();
+  const double* y1 = poses1.values[BoxPoses::QY].data();
+  const double* z1 = poses1.values[BoxPoses::QZ].data();
+  double* w = result.values[BoxPoses::QW].data();
+  double* x = result.values[BoxPoses::QX].data();
+  double* y = result.values[BoxPoses::QY].data();
+  double* z = result.values[BoxPoses::QZ].data();
+  const double one = 1.0 - std::numeric_limits<double>::epsilon();
+  for (size_t i = 0; i < n; ++i) {
+    const double d = w0[i] * w1[i] + x0[i] * x1[i] + y0[i] * y1[i] + z0[i] * z1[i];
+    const double absD = std::abs(d);
+    double scale0 = 1.0 - amount;
+    double scale1 = amount;
+    if (absD < one) {
+      const double theta = std::acos(absD);
+      const double sinTheta = std::sin(theta);
+      scale0 = std::sin((1.0 - amount) * theta) / sinTheta;
+      scale1 = std::sin(amount * theta) / sinTheta;
     }
+    if (d < 0.0) {
+      scale1 = -scale1;
+    }
+    w[i] = scale0 * w0[i] + scale1 * w1[i];
+    x[i] = scale0 * x0[i] + scale1 * x1[i];
+    y[i] = scale0 * y0[i] + scale1 * y1[i];
+    z[i] = scale0 * z0[i] + scale1 * z1[i];
   }
 }
 
@@ -444,6 +1064,17 @@ Eigen::Vector3d lerp(const double t, const Eigen::Vector3d& p0, const Eigen::Vec
   return t*p0 + (1.0 - t)*p1;
 }
 
+static std_msgs::ColorRGBA
+makeColorMsg(const float* color)
+{
+  std_msgs::ColorRGBA colorMsg;
+  colorMsg.r = color[0];
+  colorMsg.g = color[1];
+  colorMsg.b = color[2];
+  colorMsg.a = color[3];
+  return colorMsg;
+}
+
 Box makeBox(const SampleAnnotationInfo& annotation)
 {
   Box boxMsg;
@@ -462,10 +1093,10 @@ Box makeBox(const SampleAnnotationInfo& annotation)
   boxMsg.orientation.y = static_cast<double>(annotation.rotation[2]);
   boxMsg.orientation.z = static_cast<double>(annotation.rotation[3]);
 
-  boxMsg.token = annotation.token;
+  boxMsg.token = annotation.token.str();
 
   boxMsg.category_name = annotation.categoryName;
-  boxMsg.color = getColor(annotation.categoryName);
+  boxMsg.color = makeColorMsg(annotation.color);
 
   return boxMsg;
 }
@@ -487,10 +1118,10 @@ Box makeBox(const SampleAnnotationInfo& annotation, const Eigen::Vector3d& cente
   boxMsg.orientation.z = rotation.z();
   boxMsg.orientation.w = rotation.w();
 
-  boxMsg.token = annotation.token;
+  boxMsg.token = annotation.token.str();
 
   boxMsg.category_name = annotation.categoryName;
-  boxMsg.color = getColor(annotation.categoryName);
+  boxMsg.color = makeColorMsg(annotation.color);
 
   return boxMsg;
 }
@@ -504,113 +1135,11 @@ geometry_msgs::Point makePointMsg(const Eigen::Vector3d& point)
   return pointMsg;
 }
 
-inline bool stringContains(const std::string& str, const std::string& substr)
-{
-  if (str.find(substr) != std::string::npos) {
-      return true;
-  }
-  return false;
-}
-
 std_msgs::ColorRGBA getColor(const std::string& categoryName)
 {
-  std_msgs::ColorRGBA color;
-
-  if (stringContains(categoryName, "bicycle")) {
-    // Red
-    color.r = 1.0; // 255
-    color.g = 0.239; // 61
-    color.b = 0.388; // 99
-    color.a = 1.0;
-    return color;
-  }
-  else if (stringContains(categoryName, "motorcycle")) {
-    // Red
-    color.r = 1.0; // 255
-    color.g = 0.239; // 61
-    color.b = 0.388; // 99
-    color.a = 1.0;
-    return color;
-  }
-  else if (stringContains(categoryName, "vehicle")) {
-    // Orange
-    color.r = 1.0; // 255
-    color.g = 0.619; // 158
-    color.b = 0.0; // 0
-    color.a = 1.0;
-    return color;
-  }
-  else if (stringContains(categoryName, "bus")) {
-    // Orange
-    color.r = 1.0; // 255
-    color.g = 0.619; // 158
-    color.b = 0.0; // 0
-    color.a = 1.0;
-    return color;
-  }
-  else if (stringContains(categoryName, "car")) {
-    // Orange
-    color.r = 1.0; // 255
-    color.g = 0.619; // 158
-    color.b = 0.0; // 0
-    color.a = 1.0;
-    return color;
-  }
-  else if (stringContains(categoryName, "construction_vehicle")) {
-    // Orange
-    color.r = 1.0; // 255
-    color.g = 0.619; // 158
-    color.b = 0.0; // 0
-    color.a = 1.0;
-    return color;
-  }
-  else if (stringContains(categoryName, "trailer")) {
-    // Orange
-    color.r = 1.0; // 255
-    color.g = 0.619; // 158
-    color.b = 0.0; // 0
-    color.a = 1.0;
-    return color;
-  }
-  else if (stringContains(categoryName, "truck")) {
-    // Orange
-    color.r = 1.0; // 255
-    color.g = 0.619; // 158
-    color.b = 0.0; // 0
-    color.a = 1.0;
-    return color;
-  }
-  else if (stringContains(categoryName, "pedestrian")) {
-    // Blue
-    color.r = 0.0; // 0
-    color.g = 0.0; // 0
-    color.b = 0.901; // 230
-    color.a = 1.0;
-    return color;
-  }
-  else if (stringContains(categoryName, "cone")) {
-    // Black
-    color.r = 0.0; // 0
-    color.g = 0.0; // 0
-    color.b = 0.0; // 0
-    color.a = 1.0;
-    return color;
-  }
-  else if (stringContains(categoryName, "barrier")) {
-    // Black
-    color.r = 0.0; // 0
-    color.g = 0.0; // 0
-    color.b = 0.0; // 0
-    color.a = 1.0;
-    return color;
-  }
-
-  // Magenta
-  color.r = 1.0; // 255
-  color.g = 0.0; // 0
-  color.b = 1.0; // 255
-  color.a = 1.0;
-  return color;
+  float color[4];
+  getCategoryColor(categoryName, color);
+  return makeColorMsg(color);
 }
 
 visualization_msgs::Marker makeMarkerMsg(const Box& box, const int32_t id, const ros::Time& timestamp, const ros::Duration& lifetime)
@@ -0,0 +1,49 @@
+#include "nuscenes2bag/SceneSharding.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace nuscenes2bag {
+
+std::vector<Token>
+selectShardScenes(const std::vector<Token>& sceneTokens,
+                  const std::vector<uint64_t>& sceneCosts,
+                  uint32_t shardIndex,
+                  uint32_t shardCount)
+{
+  assert(sceneTokens.size() == sceneCosts.size());
+  assert(shardIndex < shardCount);
+
+  // Largest scenes first, each to the least loaded shard (LPT). Ties are
+  // broken by token and by shard index, never by the order of the tables.
+  std::vector<size_t> order;
+  for (size_t i = 0; i < sceneTokens.size(); ++i) {
+    order.push_back(i);
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    if (sceneCosts[a] != sceneCosts[b]) {
+      return sceneCosts[a] > sceneCosts[b];
+    }
+    return sceneTokens[a] < sceneTokens[b];
+  });
+
+  std::vector<uint64_t> shardCosts(shardCount, 0);
+  std::vector<bool> inShard(sceneTokens.size(), false);
+  for (size_t sceneIndex : order) {
+    const size_t shard =
+      std::min_element(shardCosts.begin(), shardCosts.end()) -
+      shardCosts.begin();
+    shardCosts[shard] += sceneCosts[sceneIndex];
+    inShard[sceneIndex] = (shard == shardIndex);
+  }
+
+  std::vector<Token> shardSceneTokens;
+  for (size_t i = 0; i < sceneTokens.size(); ++i) {
+    if (inShard[i]) {
+      shardSceneTokens.push_back(sceneTokens[i]);
+    }
+  }
+  return shardSceneTokens;
+}
+
+}
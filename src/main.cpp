@@ -1,20 +1,110 @@
 #include "nuscenes2bag/MetaDataReader.hpp"
 #include "nuscenes2bag/NuScenes2Bag.hpp"
+#include "ros/ros.h"
 #include <boost/program_options.hpp>
+#include <algorithm>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 using namespace boost::program_options;
 using namespace nuscenes2bag;
 
+// Splits a comma separated list, empty items are dropped
+static std::vector<std::string>
+splitList(const std::string& list)
+{
+  std::vector<std::string> items;
+  std::istringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+// Parses "BEGIN:END" in seconds into microseconds, either bound may be empty
+static void
+parseTimeRange(const std::string& timeRange, uint64_t& begin, uint64_t& end)
+{
+  const size_t separator = timeRange.find(':');
+  if (separator == std::string::npos) {
+    throw validation_error(validation_error::invalid_option_value, "time-range", timeRange);
+  }
+  auto parseSeconds = [&timeRange](const std::string& text, uint64_t& microseconds) {
+    if (text.empty()) {
+      return;
+    }
+    size_t parsed = 0;
+    double seconds = -1;
+    try {
+      seconds = std::stod(text, &parsed);
+    } catch (const std::exception&) {
+    }
+    if ((parsed != text.size()) || !(seconds >= 0)) {
+      throw validation_error(validation_error::invalid_option_value, "time-range", timeRange);
+    }
+    microseconds = static_cast<uint64_t>(seconds * 1e6);
+  };
+  parseSeconds(timeRange.substr(0, separator), begin);
+  parseSeconds(timeRange.substr(separator + 1), end);
+  if (begin >= end) {
+    throw validation_error(validation_error::invalid_option_value, "time-range", timeRange);
+  }
+}
+
+// Parses a byte count, with an optional K, M or G (binary) suffix
+static uint64_t
+parseByteSize(const std::string& size)
+{
+  size_t parsed = 0;
+  uint64_t bytes = 0;
+  try {
+    bytes = std::stoull(size, &parsed);
+  } catch (const std::exception&) {
+    throw validation_error(validation_error::invalid_option_value, "max-memory", size);
+  }
+  const std::string suffix = size.substr(parsed);
+  if (suffix == "K") {
+    bytes <<= 10;
+  } else if (suffix == "M") {
+    bytes <<= 20;
+  } else if (suffix == "G") {
+    bytes <<= 30;
+  } else if (!suffix.empty()) {
+    throw validation_error(validation_error::invalid_option_value, "max-memory", size);
+  }
+  return bytes;
+}
+
+// Decoded samples buffered ahead of publication by default, about half a
+// second of the nuScenes sensors
+static const uint32_t PUBLISH_SAMPLES_IN_FLIGHT = 64;
+
 int
-main(const int argc, const char* argv[])
+main(int argc, char* argv[])
 {
+  bool converted = true;
   try {
     std::string dataroot;
     std::string version = "v1.0-mini";
     std::string outputBagName;
     int32_t threadNumber = -1;
     int32_t sceneNumber = -1;
+    ConversionOptions conversionOptions;
+    std::string imageFormat = "raw";
+    double imageScale = 1.0;
+    std::string radarFormat = "objects";
+    std::string compression = "none";
+    std::string outputFormat = "bag";
+    std::string channels;
+    std::string modalities;
+    std::string timeRange;
+    std::string maxMemory;
 
     options_description desc{ "Options" };
     desc.add_options()("help,h", "show help");
@@ -27,7 +117,78 @@ main(const int argc, const char* argv[])
       "out,o", value<std::string>(&outputBagName), "output bag name")(
       "jobs,j",
       value<int32_t>(&threadNumber),
-      "number of jobs (thread number)");
+      "number of jobs (thread number)")(
+      "decode-jobs",
+      value<uint32_t>(&conversionOptions.decodeThreadNumber),
+      "number of threads decoding samples, shared by all scenes (default = 1)")(
+      "in-flight",
+      value<uint32_t>(&conversionOptions.maxSamplesInFlight),
+      "maximum number of decoded samples waiting to be written, per scene (default = 8)")(
+      "max-memory",
+      value<std::string>(&maxMemory),
+      "maximum size of the decoded samples waiting to be written, for all scenes, e.g. '8G' (default = no limit)")(
+      "read-jobs",
+      value<uint32_t>(&conversionOptions.readThreadNumber),
+      "number of threads reading sample files ahead of decoding, shared by all scenes (default = 0, no read-ahead)")(
+      "read-ahead",
+      value<uint32_t>(&conversionOptions.readAheadDepth),
+      "maximum number of sample files read ahead, per scene (default = 32)")(
+      "image-format",
+      value<std::string>(&imageFormat),
+      "'raw' decodes images to bgr8, 'jpeg' writes the original JPEG as CompressedImage (default = 'raw')")(
+      "image-scale",
+      value<double>(&imageScale),
+      "size of the raw images relative to the camera: 1, 0.5, 0.25 or 0.125, scaled while decoding (default = 1)")(
+      "radar-format",
+      value<std::string>(&radarFormat),
+      "'objects' writes RadarObjects messages, 'pointcloud' writes PointCloud2 (default = 'objects')")(
+      "format",
+      value<std::string>(&outputFormat),
+      "'bag' writes one ROS bag per scene, 'mcap' one MCAP file per scene (default = 'bag')")(
+      "compression",
+      value<std::string>(&compression),
+      "bag chunk compression: 'none', 'lz4' or 'bz2', 'bz2' is not available with mcap (default = 'none')")(
+      "chunk-size",
+      value<uint32_t>(&conversionOptions.bagChunkThreshold),
+      "bag chunk size in bytes (default = 786432)")(
+      "metadata-cache",
+      value<std::string>(&conversionOptions.metaDataCachePath),
+      "binary metadata cache file (default = '<dataroot>/<version>.cache')")(
+      "no-metadata-cache", "always parse the JSON metadata, do not read or write the cache")(
+      "force", "convert every scene, including the ones already up to date in the output directory")(
+      "channels",
+      value<std::string>(&channels),
+      "comma separated sensor channels to convert, e.g. 'LIDAR_TOP,CAM_FRONT' (default = all)")(
+      "modalities",
+      value<std::string>(&modalities),
+      "comma separated modalities to convert: 'camera', 'lidar', 'radar' (default = all)")(
+      "lidar-sweeps",
+      value<uint32_t>(&conversionOptions.lidarSweepNumber),
+      "also write the last N lidar sweeps accumulated in the frame of the latest one, on <lidar>/sweeps (default = 0, disabled)")(
+      "keyframes-only",
+      bool_switch(&conversionOptions.keyFramesOnly),
+      "only convert the key frames (samples) and their annotations")(
+      "time-range",
+      value<std::string>(&timeRange),
+      "'BEGIN:END' window to convert, in seconds from the start of each scene, either bound may be omitted")(
+      "shard-index",
+      value<uint32_t>(&conversionOptions.shardIndex),
+      "index of the shard of the scenes to convert, from 0 to --shard-count - 1 (default = 0)")(
+      "shard-count",
+      value<uint32_t>(&conversionOptions.shardCount),
+      "number of shards the scenes are split into, balanced by sample data number (default = 1)")(
+      "shard-metadata",
+      bool_switch(&conversionOptions.shardMetaDataOnly),
+      "only keep (and cache) the metadata of the scenes of the shard")(
+      "publish",
+      bool_switch(&conversionOptions.publish),
+      "publish the scenes on ROS topics at the pace of the recording instead of writing bags")(
+      "rate,r",
+      value<double>(&conversionOptions.publishSpeedFactor),
+      "speed factor of --publish, e.g. 2 publishes twice as fast as recorded (default = 1)")(
+      "stats-json",
+      value<std::string>(&conversionOptions.statsJsonPath),
+      "write timing and throughput statistics of the run to this JSON file");
     variables_map vm;
 
     desc.add(inputDesc);
@@ -35,9 +196,108 @@ main(const int argc, const char* argv[])
     store(parse_command_line(argc, argv, desc), vm);
     notify(vm);
 
+    conversionOptions.useMetaDataCache = (vm.count("no-metadata-cache") == 0);
+    conversionOptions.skipUpToDateScenes = (vm.count("force") == 0);
+
+    if (imageFormat == "raw") {
+      conversionOptions.imageFormat = ImageFormat::RAW;
+    } else if (imageFormat == "jpeg") {
+      conversionOptions.imageFormat = ImageFormat::JPEG;
+    } else {
+      throw validation_error(validation_error::invalid_option_value, "image-format", imageFormat);
+    }
+
+    // The scales of the libjpeg inverse DCT
+    if ((imageScale == 1.0) || (imageScale == 0.5) || (imageScale == 0.25) ||
+        (imageScale == 0.125)) {
+      conversionOptions.imageScaleDenominator = static_cast<uint32_t>(1.0 / imageScale);
+    } else {
+      throw validation_error(validation_error::invalid_option_value, "image-scale",
+                             std::to_string(imageScale));
+    }
+    if ((conversionOptions.imageScaleDenominator != 1) &&
+        (conversionOptions.imageFormat != ImageFormat::RAW)) {
+      throw error("--image-scale only applies to --image-format raw");
+    }
+
+    if (radarFormat == "objects") {
+      conversionOptions.radarFormat = RadarFormat::OBJECTS;
+    } else if (radarFormat == "pointcloud") {
+      conversionOptions.radarFormat = RadarFormat::POINTCLOUD;
+    } else {
+      throw validation_error(validation_error::invalid_option_value, "radar-format", radarFormat);
+    }
+
+    if (outputFormat == "bag") {
+      conversionOptions.outputFormat = OutputFormat::BAG;
+    } else if (outputFormat == "mcap") {
+      conversionOptions.outputFormat = OutputFormat::MCAP;
+    } else {
+      throw validation_error(validation_error::invalid_option_value, "format", outputFormat);
+    }
+
+    if (compression == "none") {
+      conversionOptions.bagCompression = BagCompression::NONE;
+    } else if (compression == "lz4") {
+      conversionOptions.bagCompression = BagCompression::LZ4;
+    } else if ((compression == "bz2") &&
+               (conversionOptions.outputFormat == OutputFormat::BAG)) {
+      conversionOptions.bagCompression = BagCompression::BZ2;
+    } else {
+      throw validation_error(validation_error::invalid_option_value, "compression", compression);
+    }
+
+    conversionOptions.channels = splitList(channels);
+    conversionOptions.modalities = splitList(modalities);
+    for (const auto& modality : conversionOptions.modalities) {
+      if ((modality != "camera") && (modality != "lidar") && (modality != "radar")) {
+        throw validation_error(validation_error::invalid_option_value, "modalities", modality);
+      }
+    }
+    if (!maxMemory.empty()) {
+      conversionOptions.maxMemoryBytes = parseByteSize(maxMemory);
+    }
+    if (!timeRange.empty()) {
+      parseTimeRange(timeRange, conversionOptions.timeRangeBegin, conversionOptions.timeRangeEnd);
+    }
+
+    if (conversionOptions.bagChunkThreshold == 0) {
+      throw validation_error(validation_error::invalid_option_value, "chunk-size", "0");
+    }
+
+    if (conversionOptions.shardCount == 0) {
+      throw validation_error(validation_error::invalid_option_value, "shard-count", "0");
+    }
+    if (conversionOptions.shardIndex >= conversionOptions.shardCount) {
+      throw validation_error(validation_error::invalid_option_value, "shard-index",
+                             std::to_string(conversionOptions.shardIndex));
+    }
+    if ((conversionOptions.shardCount > 1) && (sceneNumber > 0)) {
+      throw error("--scene_number and --shard-count can't be used together");
+    }
+
+    if (!(conversionOptions.publishSpeedFactor > 0)) {
+      throw validation_error(validation_error::invalid_option_value, "rate",
+                             std::to_string(conversionOptions.publishSpeedFactor));
+    }
+    if (conversionOptions.publish) {
+      // Writing waits for the time of each message, the samples must be
+      // decoded by other threads and far enough ahead to never be late
+      if (vm.count("decode-jobs") == 0) {
+        conversionOptions.decodeThreadNumber =
+          std::max(2u, std::thread::hardware_concurrency());
+      }
+      if (vm.count("in-flight") == 0) {
+        conversionOptions.maxSamplesInFlight = PUBLISH_SAMPLES_IN_FLIGHT;
+      }
+    }
+
     if (vm.count("help")) {
       std::cout << desc << '\n';
     } else {
+      if (conversionOptions.publish) {
+        ros::init(argc, argv, "nuscenes2bag", ros::init_options::AnonymousName);
+      }
       NuScenes2Bag converter{};
 
       fs::path sampleDirPath(dataroot);
@@ -47,15 +307,16 @@ main(const int argc, const char* argv[])
       if(sceneNumber > 0) {
         sceneNumberOpt = sceneNumber;
       }
-      converter.convertDirectory(sampleDirPath, version, outputBagName, threadNumber, sceneNumberOpt);
+      converted = converter.convertDirectory(sampleDirPath, version, outputBagName, threadNumber, conversionOptions, sceneNumberOpt);
 #else
-      converter.convertDirectory(sampleDirPath, version, outputBagName, threadNumber, sceneNumber);
+      converted = converter.convertDirectory(sampleDirPath, version, outputBagName, threadNumber, conversionOptions, sceneNumber);
 #endif
 
     }
   } catch (const error& ex) {
     std::cerr << ex.what() << '\n';
+    converted = false;
   }
 
-  return 0;
+  return converted ? 0 : 1;
 }
\ No newline at end of file
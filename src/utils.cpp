@@ -1,5 +1,7 @@
 #include "nuscenes2bag/utils.hpp"
+#include "nuscenes2bag/BufferPool.hpp"
 
+#include <fstream>
 #include <iostream>
 
 namespace nuscenes2bag {
@@ -51,4 +53,36 @@ stampUs2RosTime(uint64_t stampUs)
   return t;
 }
 
-}
\ No newline at end of file
+void
+readFileBytes(const std::string& filePath, std::vector<uint8_t>& bytes)
+{
+  std::ifstream fin(filePath, std::ios::binary | std::ios::ate);
+  if (!fin.is_open()) {
+    throw UnableToParseFileException(filePath);
+  }
+  const std::streamsize fileSize = fin.tellg();
+  fin.seekg(0, std::ios::beg);
+
+  if (bytes.capacity() < static_cast<size_t>(fileSize)) {
+    // A recycled buffer rather than a new allocation
+    bytes = getMessageBufferPool().acquire(fileSize);
+  }
+  bytes.resize(fileSize);
+  if (!fin.read(reinterpret_cast<char*>(bytes.data()), fileSize)) {
+    throw UnableToParseFileException(filePath);
+  }
+}
+
+void
+takeFileBytes(const std::string& filePath,
+              std::vector<uint8_t>* fileBytes,
+              std::vector<uint8_t>& bytes)
+{
+  if (fileBytes != nullptr) {
+    bytes = std::move(*fileBytes);
+  } else {
+    readFileBytes(filePath, bytes);
+  }
+}
+
+}
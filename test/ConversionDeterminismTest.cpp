@@ -0,0 +1,111 @@
+#include "SyntheticDataset.hpp"
+
+#include "nuscenes2bag/NuScenes2Bag.hpp"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+
+using namespace nuscenes2bag;
+
+namespace {
+
+// Content of the bags (or MCAP files) of the output directory, by file name
+std::map<std::string, std::string>
+readOutputFiles(const fs::path& outputPath, const std::string& extension)
+{
+  std::map<std::string, std::string> files;
+  for (const auto& entry : fs::directory_iterator(outputPath)) {
+    if (entry.path().extension() != extension) {
+      continue;
+    }
+    std::ifstream file(entry.path().string(), std::ios::binary);
+    files[entry.path().filename().string()] =
+      std::string(std::istreambuf_iterator<char>(file),
+                  std::istreambuf_iterator<char>());
+  }
+  return files;
+}
+
+// Converts every scene of the dataset to outputPath
+bool
+convert(const SyntheticDataset& dataset,
+        const fs::path& outputPath,
+        int32_t threadNumber,
+        const ConversionOptions& conversionOptions)
+{
+  NuScenes2Bag converter;
+#if CMAKE_CXX_STANDARD >= 17
+  return converter.convertDirectory(dataset.getDataRoot(), dataset.getVersion(),
+                                    outputPath, threadNumber,
+                                    conversionOptions, std::nullopt);
+#else
+  return converter.convertDirectory(dataset.getDataRoot(), dataset.getVersion(),
+                                    outputPath, threadNumber,
+                                    conversionOptions, 0);
+#endif
+}
+
+SyntheticDatasetOptions
+makeDatasetOptions()
+{
+  SyntheticDatasetOptions options;
+  options.sceneNumber = 2;
+  options.samplesPerScene = 4;
+  options.sweepsPerSample = 2;
+  options.lidarPoints = 2000;
+  options.imageWidth = 160;
+  options.imageHeight = 90;
+  return options;
+}
+
+// The decoding threads finish in any order, the files must not depend on it
+void
+expectSameOutput(OutputFormat outputFormat, const std::string& extension)
+{
+  SyntheticDataset dataset(makeDatasetOptions());
+
+  ConversionOptions conversionOptions;
+  conversionOptions.useMetaDataCache = false;
+  conversionOptions.skipUpToDateScenes = false;
+  conversionOptions.outputFormat = outputFormat;
+  conversionOptions.lidarSweepNumber = 3;
+
+  const fs::path sequentialPath = dataset.getDataRoot() / "j1";
+  conversionOptions.decodeThreadNumber = 1;
+  conversionOptions.readThreadNumber = 0;
+  ASSERT_TRUE(convert(dataset, sequentialPath, 1, conversionOptions));
+
+  const fs::path parallelPath = dataset.getDataRoot() / "j16";
+  conversionOptions.decodeThreadNumber = 16;
+  conversionOptions.readThreadNumber = 4;
+  conversionOptions.maxSamplesInFlight = 64;
+  ASSERT_TRUE(convert(dataset, parallelPath, 2, conversionOptions));
+
+  const auto sequentialFiles = readOutputFiles(sequentialPath, extension);
+  const auto parallelFiles = readOutputFiles(parallelPath, extension);
+  ASSERT_EQ(sequentialFiles.size(), 2u);
+  ASSERT_EQ(parallelFiles.size(), sequentialFiles.size());
+  for (const auto& file : sequentialFiles) {
+    auto parallelFile = parallelFiles.find(file.first);
+    ASSERT_NE(parallelFile, parallelFiles.end()) << file.first;
+    // Not EXPECT_EQ, which would print both files
+    EXPECT_TRUE(parallelFile->second == file.second)
+      << file.first << " differs between 1 and 16 decoding threads";
+  }
+}
+
+}
+
+TEST(ConversionDeterminism, SameBagsWithOneAndSixteenDecodingThreads)
+{
+  expectSameOutput(OutputFormat::BAG, ".bag");
+}
+
+TEST(ConversionDeterminism, SameMcapFilesWithOneAndSixteenDecodingThreads)
+{
+  expectSameOutput(OutputFormat::MCAP, ".mcap");
+}